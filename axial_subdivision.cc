@@ -0,0 +1,409 @@
+/*
+ * This file is part of the Electron Orbital Explorer. The Electron
+ * Orbital Explorer is distributed under the Simplified BSD License
+ * (also called the "BSD 2-Clause License"), in hopes that these
+ * rendering techniques might be used by other programmers in
+ * applications such as scientific visualization, video gaming, and so
+ * on. If you find value in this software and use its technologies for
+ * another purpose, I would love to hear back from you at bjthinks (at)
+ * gmail (dot) com. If you improve this software and agree to release
+ * your modifications under the below license, I encourage you to fork
+ * the development tree on github and push your modifications. The
+ * Electron Orbital Explorer's development URL is:
+ * https://github.com/bjthinks/orbital-explorer
+ * (This paragraph is not part of the software license and may be
+ * removed.)
+ *
+ * Copyright (c) 2013, Brian W. Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * + Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * + Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+#include "axial_subdivision.hh"
+
+using namespace std;
+
+static Vector<3> to_color_space(complex<double> x)
+{
+  Vector<3> r;
+  double n = abs(x);
+  r[0] = n * x.real();
+  r[1] = n * x.imag();
+  r[2] = n;
+  return r;
+}
+
+// f at (rho, z) in the plane phi = 0
+static complex<double> evaluate_at(const Function<3,complex<double> > &f,
+                                   const Vector<2> &p)
+{
+  double xs[1] = { p[0] }, ys[1] = { 0.0 }, zs[1] = { p[1] };
+  const double *coords[3] = { xs, ys, zs };
+  complex<double> value;
+  f.evaluate(coords, 1, &value);
+  return value;
+}
+
+// As for TetrahedralSubdivision, the test points of a triangle have
+// barycentric coordinates that are multiples of 1/n, other than the
+// vertices
+static const unsigned lattice_denominator = 11;
+
+static vector<Array<3,unsigned> > make_lattice()
+{
+  const unsigned n = lattice_denominator;
+  vector<Array<3,unsigned> > lattice;
+  Array<3,unsigned> bary;
+  for (bary[0] = 0; bary[0] < n; ++bary[0])
+    for (bary[1] = 0; bary[1] <= n - bary[0]; ++bary[1]) {
+      bary[2] = n - bary[0] - bary[1];
+      if (bary[1] != n && bary[2] != n)
+        lattice.push_back(bary);
+    }
+  return lattice;
+}
+
+static const vector<Array<3,unsigned> > lattice = make_lattice();
+
+// The test point of a triangle where linear interpolation of f is
+// worst, and the error there
+static pair<Vector<2>,double>
+worst_point(const Function<3,complex<double> > &f, const Vector<2> vertex[3],
+            const complex<double> vertex_value[3])
+{
+  const unsigned n = lattice_denominator;
+  vector<double> xs(lattice.size()), ys(lattice.size(), 0.0);
+  vector<double> zs(lattice.size());
+  for (unsigned t = 0; t < lattice.size(); ++t) {
+    Vector<2> p = (double(lattice[t][0]) / double(n)) * vertex[0];
+    for (unsigned i = 1; i < 3; ++i)
+      p += (double(lattice[t][i]) / double(n)) * vertex[i];
+    xs[t] = p[0];
+    zs[t] = p[1];
+  }
+  vector<complex<double> > values(lattice.size());
+  const double *coords[3] = { &xs[0], &ys[0], &zs[0] };
+  f.evaluate(coords, lattice.size(), &values[0]);
+
+  Vector<3> vertex_color[3];
+  for (unsigned i = 0; i < 3; ++i)
+    vertex_color[i] = to_color_space(vertex_value[i]);
+  unsigned worst = 0;
+  double worst_error = 0.0;
+  for (unsigned t = 0; t < lattice.size(); ++t) {
+    Vector<3> interpolated;
+    interpolated = 0.0;
+    for (unsigned i = 0; i < 3; ++i)
+      interpolated += (double(lattice[t][i]) / double(n)) * vertex_color[i];
+    double error = norm(to_color_space(values[t]) - interpolated);
+    if (error > worst_error) {
+      worst_error = error;
+      worst = t;
+    }
+  }
+  return make_pair(Vector2(xs[worst], zs[worst]), worst_error);
+}
+
+bool AxialSubdivision::applies(const Orbital &orbital)
+{
+  return !orbital.real || orbital.M == 0;
+}
+
+unsigned AxialSubdivision::segments(int M, double phase_tolerance)
+{
+  // Between the edges of a step, interpolation takes the color along a
+  // chord of the circle the phase turns M dphi around, which falls
+  // 1 - cos(M dphi / 2) short of it in the middle
+  double turn = 2.0 * acos(1.0 - phase_tolerance);
+  double dphi = turn / double(max(abs(M), 1));
+  return max(1u, unsigned(ceil(M_PI / 2.0 / dphi)));
+}
+
+AxialSubdivision::AxialSubdivision(const Function<3,complex<double> > &f_,
+                                   int M_, double radius,
+                                   double phase_tolerance) :
+  f(f_), M(M_), num_segments(segments(M_, phase_tolerance)),
+  stop(false), running(false), finished(false)
+{
+  // A bounding triangle of a large size, and the corners of the
+  // quarter plane inside it
+  Array<3,Vector<2> > bounding_triangle;
+  double big = 10.0 * radius;
+  bounding_triangle[0] = Vector2(-big, -big);
+  bounding_triangle[1] = Vector2(3.0 * big, -big);
+  bounding_triangle[2] = Vector2(-big, 3.0 * big);
+  Array<3,complex<double> > bounding_values;
+  for (unsigned i = 0; i < 3; ++i)
+    bounding_values[i] = evaluate_at(f, bounding_triangle[i]);
+  plane = Delaunay<2,complex<double> >(bounding_triangle, bounding_values);
+  for (int i = 0; i <= 1; ++i)
+    for (int j = 0; j <= 1; ++j) {
+      Vector<2> point = Vector2(i * radius, j * radius);
+      plane.inefficientAddPoint(point, evaluate_at(f, point));
+    }
+
+  examined = 0;
+  handleNewTriangles();
+}
+
+AxialSubdivision::~AxialSubdivision()
+{
+  cancelAsync();
+  wait();
+}
+
+bool AxialSubdivision::isBoundary(unsigned triangle) const
+{
+  const Simplex<2> &simplex = plane.getSimplex(triangle);
+  for (unsigned i = 0; i < 3; ++i)
+    if (simplex.formingPoint(i) < 3)
+      return true;
+  return false;
+}
+
+void AxialSubdivision::handleNewTriangles()
+{
+  for (; examined <= plane.maxSimplex(); ++examined) {
+    if (!plane.hasSimplex(examined) || isBoundary(examined))
+      continue;
+    const Simplex<2> &simplex = plane.getSimplex(examined);
+    Vector<2> vertex[3];
+    complex<double> value[3];
+    for (unsigned i = 0; i < 3; ++i) {
+      vertex[i] = plane.getPoint(simplex.formingPoint(i));
+      value[i] = plane.getPayload(simplex.formingPoint(i));
+    }
+    pair<Vector<2>,double> worst = worst_point(f, vertex, value);
+    // Swept around the axis, the triangle makes a volume in proportion
+    // to its area times the rho of its centroid
+    Vector<2> a = vertex[1] - vertex[0], b = vertex[2] - vertex[0];
+    double area = fabs(a[0] * b[1] - a[1] * b[0]) / 2.0;
+    double rho = (vertex[0][0] + vertex[1][0] + vertex[2][0]) / 3.0;
+    double error = pow(worst.second, 2.0) * area * rho;
+    heap_of_triangles.push(examined,
+                           TriangleItem(error, examined, worst.first));
+  }
+}
+
+bool AxialSubdivision::encroachesEdge(const Vector<2> &point,
+                                      unsigned triangle, Vector<2> &split,
+                                      unsigned &split_triangle) const
+{
+  set<unsigned> deleted = plane.findDeletedSimplices(point, triangle);
+  for (set<unsigned>::const_iterator i = deleted.begin();
+       i != deleted.end(); ++i) {
+    const Simplex<2> &simplex = plane.getSimplex(*i);
+    Vector<2> v[2];
+    unsigned n = 0;
+    for (unsigned j = 0; j < 3; ++j)
+      if (simplex.formingPoint(j) >= 3 && n < 2)
+        v[n++] = plane.getPoint(simplex.formingPoint(j));
+    if (n != 2 || !isBoundary(*i))
+      continue;
+    for (unsigned a = 0; a < 2; ++a)
+      if (v[0][a] == 0.0 && v[1][a] == 0.0 && point[a] != 0.0) {
+        split = 0.5 * (v[0] + v[1]);
+        split_triangle = *i;
+        return true;
+      }
+  }
+  return false;
+}
+
+void AxialSubdivision::addPoints(unsigned vertices)
+{
+  while (!stop && plane.numPoints() < vertices + 3 &&
+         !heap_of_triangles.empty()) {
+    TriangleItem next = heap_of_triangles.top();
+    heap_of_triangles.pop();
+
+    // Keep the edges on the axis and on z = 0, as
+    // TetrahedralSubdivision::addPoints keeps the planes of an octant
+    Vector<2> point = next.point;
+    unsigned triangle = next.triangle;
+    Vector<2> split_point;
+    unsigned split_triangle;
+    bool split = false;
+    while (encroachesEdge(point, triangle, split_point, split_triangle)) {
+      split = true;
+      point = split_point;
+      triangle = split_triangle;
+    }
+    if (split)
+      heap_of_triangles.push(next.triangle, next);
+
+    plane.addPoint(point, triangle, evaluate_at(f, point));
+    const vector<unsigned> &deleted = plane.lastDeletedSimplexIndices();
+    for (unsigned i = 0; i < deleted.size(); ++i)
+      if (heap_of_triangles.contains(deleted[i]))
+        heap_of_triangles.remove(deleted[i]);
+    handleNewTriangles();
+  }
+}
+
+void AxialSubdivision::sweep()
+{
+  const unsigned K = num_segments;
+  vector<double> cosines(K + 1), sines(K + 1);
+  vector<complex<double> > phases(K + 1);
+  for (unsigned k = 0; k <= K; ++k) {
+    double phi = M_PI / 2.0 * double(k) / double(K);
+    // The ends lie exactly on the planes the octant is reflected in
+    cosines[k] = k == 0 ? 1.0 : k == K ? 0.0 : cos(phi);
+    sines[k] = k == 0 ? 0.0 : k == K ? 1.0 : sin(phi);
+    phases[k] = polar(1.0, double(M) * phi);
+  }
+
+  // A vertex of the plane off the axis gives one vertex at each step,
+  // and one on the axis just the one
+  positions.clear();
+  values.clear();
+  vector<unsigned> first(plane.numPoints());
+  for (unsigned v = 3; v < plane.numPoints(); ++v) {
+    const Vector<2> &p = plane.getPoint(v);
+    first[v] = positions.size();
+    unsigned copies = p[0] == 0.0 ? 1 : K + 1;
+    for (unsigned k = 0; k < copies; ++k) {
+      positions.push_back(Vector3(p[0] * cosines[k], p[0] * sines[k], p[1]));
+      values.push_back(plane.getPayload(v) * phases[k]);
+    }
+  }
+
+  indices.clear();
+  for (unsigned s = 0; s <= plane.maxSimplex(); ++s) {
+    if (!plane.hasSimplex(s) || isBoundary(s))
+      continue;
+    unsigned u[3];
+    for (unsigned i = 0; i < 3; ++i)
+      u[i] = plane.getSimplex(s).formingPoint(i);
+    sort(u, u + 3);
+    for (unsigned k = 0; k < K; ++k) {
+      // Vertex i of the triangle at the start and end of the step
+      unsigned a[3], b[3];
+      for (unsigned i = 0; i < 3; ++i) {
+        bool axis = plane.getPoint(u[i])[0] == 0.0;
+        a[i] = first[u[i]] + (axis ? 0 : k);
+        b[i] = first[u[i]] + (axis ? 0 : k + 1);
+      }
+      unsigned tetrahedra[3][4] = {
+        { a[0], a[1], a[2], b[2] },
+        { a[0], a[1], b[1], b[2] },
+        { a[0], b[0], b[1], b[2] }
+      };
+      for (unsigned t = 0; t < 3; ++t) {
+        const unsigned *tet = tetrahedra[t];
+        if (tet[0] == tet[1] || tet[1] == tet[2] || tet[2] == tet[3] ||
+            tet[0] == tet[3])
+          continue;
+        indices.insert(indices.end(), tet, tet + 4);
+      }
+    }
+  }
+}
+
+void AxialSubdivision::work(unsigned vertices)
+{
+  addPoints(vertices);
+  sweep();
+}
+
+void AxialSubdivision::runUntil(unsigned vertices)
+{
+  // Only one worker at a time
+  wait();
+  stop = false;
+  running = true;
+  worker = thread(&AxialSubdivision::runWorker, this, vertices);
+}
+
+void AxialSubdivision::runWorker(unsigned vertices)
+{
+  addPoints(vertices);
+  if (!stop) {
+    sweep();
+    finished = true;
+  }
+  running = false;
+}
+
+bool AxialSubdivision::isRunning()
+{
+  return running;
+}
+
+bool AxialSubdivision::isFinished()
+{
+  return finished.exchange(false);
+}
+
+void AxialSubdivision::cancelAsync()
+{
+  stop = true;
+}
+
+void AxialSubdivision::wait()
+{
+  if (worker.joinable())
+    worker.join();
+}
+
+unsigned AxialSubdivision::numPlaneVertices()
+{
+  return plane.numPoints() - 3;
+}
+
+vector<Vector<3> > AxialSubdivision::vertexPositions()
+{
+  return positions;
+}
+
+vector<complex<double> > AxialSubdivision::vertexValues()
+{
+  return values;
+}
+
+vector<unsigned> AxialSubdivision::tetrahedronVertexIndices()
+{
+  return indices;
+}
+
+MeshDelta AxialSubdivision::mesh()
+{
+  MeshDelta delta;
+  delta.version = 1;
+  delta.first_vertex = 0;
+  delta.positions = positions;
+  delta.values = values;
+  delta.added_indices = indices;
+  for (unsigned t = 0; t < indices.size() / 4; ++t)
+    delta.added.push_back(t);
+  return delta;
+}
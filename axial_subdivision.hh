@@ -0,0 +1,153 @@
+/*
+ * This file is part of the Electron Orbital Explorer. The Electron
+ * Orbital Explorer is distributed under the Simplified BSD License
+ * (also called the "BSD 2-Clause License"), in hopes that these
+ * rendering techniques might be used by other programmers in
+ * applications such as scientific visualization, video gaming, and so
+ * on. If you find value in this software and use its technologies for
+ * another purpose, I would love to hear back from you at bjthinks (at)
+ * gmail (dot) com. If you improve this software and agree to release
+ * your modifications under the below license, I encourage you to fork
+ * the development tree on github and push your modifications. The
+ * Electron Orbital Explorer's development URL is:
+ * https://github.com/bjthinks/orbital-explorer
+ * (This paragraph is not part of the software license and may be
+ * removed.)
+ *
+ * Copyright (c) 2013, Brian W. Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * + Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * + Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AXIAL_SUBDIVISION_HH
+#define AXIAL_SUBDIVISION_HH
+
+#include <atomic>
+#include <complex>
+#include <thread>
+#include <vector>
+
+#include "vector.hh"
+#include "function.hh"
+#include "delaunay.hh"
+#include "indexed_heap.hh"
+#include "wavefunction.hh"
+#include "tetrahedralize.hh"
+
+// A mesh of the octant x, y, z >= 0 for an orbital whose magnitude
+// doesn't depend on phi, made from a mesh of the quarter plane of rho
+// and z instead of by TetrahedralSubdivision. There, f(rho, phi, z) is
+// f(rho, 0, z) e^(iM phi), so only the plane phi = 0 is subdivided, as
+// TetrahedralSubdivision would subdivide space, and the triangles are
+// swept around the z axis in equal steps of phi. Each step is a prism,
+// cut into three tetrahedra. Each side of a prism is cut from its
+// lowest numbered vertex, so that neighbouring prisms agree. Prisms
+// with a vertex on the axis have no width there, and leave fewer.
+class AxialSubdivision
+{
+public:
+  // Whether this works for an orbital: a complex one, or one with M = 0
+  static bool applies(const Orbital &orbital);
+  // The number of steps of phi across the octant, so that the phase of
+  // f turns little enough in each that the colors between the edges of
+  // a step are within phase_tolerance of the largest, relative to the
+  // magnitude; and so that a step's chord is as close to its arc.
+  static unsigned segments(int M, double phase_tolerance);
+  // Subdivide [0, radius]^2 in rho and z, for f with
+  // f(rho, phi, z) = f(rho, 0, z) e^(iM phi), such as an orbital that
+  // applies
+  AxialSubdivision(const Function<3,std::complex<double> > &f_, int M_,
+                   double radius, double phase_tolerance = 0.02);
+  ~AxialSubdivision();
+
+  // Subdivide the plane until it has this many vertices, and sweep it,
+  // in a worker thread, or in the calling thread with work
+  void runUntil(unsigned vertices);
+  void work(unsigned vertices);
+  // These don't lock anything, so they're cheap enough to poll. As for
+  // TetrahedralSubdivision, isFinished is true once for each time the
+  // worker finishes.
+  bool isRunning();
+  bool isFinished();
+  // Ask the worker to stop after the point it's adding, leaving no mesh
+  void cancelAsync();
+  // Block until the worker stops
+  void wait();
+
+  // The vertices in the plane, and the steps of phi
+  unsigned numPlaneVertices();
+  unsigned numSegments() const { return num_segments; }
+  // The swept mesh, for a subdivision that isn't working: its vertices,
+  // with f at each, and four vertex numbers for each tetrahedron
+  std::vector<Vector<3> > vertexPositions();
+  std::vector<std::complex<double> > vertexValues();
+  std::vector<unsigned> tetrahedronVertexIndices();
+  // All of it as the change from an empty mesh, for Cloud::applyDelta
+  MeshDelta mesh();
+
+private:
+  AxialSubdivision(const AxialSubdivision &);
+  AxialSubdivision &operator=(const AxialSubdivision &);
+  struct TriangleItem
+  {
+    TriangleItem(double error_, unsigned triangle_, Vector<2> point_) :
+      error(error_), triangle(triangle_), point(point_) {}
+    double error;
+    unsigned triangle;
+    Vector<2> point;
+    bool operator<(const TriangleItem &rhs) const
+    {
+      return error < rhs.error;
+    }
+  };
+  bool isBoundary(unsigned triangle) const;
+  void handleNewTriangles();
+  // Like TetrahedralSubdivision::encroachesPlane, for the axis and the
+  // plane z = 0, which are edges of the hull here
+  bool encroachesEdge(const Vector<2> &point, unsigned triangle,
+                      Vector<2> &split, unsigned &split_triangle) const;
+  void addPoints(unsigned vertices);
+  void sweep();
+  // The body of the thread runUntil starts
+  void runWorker(unsigned vertices);
+  const Function<3,std::complex<double> > &f;
+  const int M;
+  const unsigned num_segments;
+  std::atomic<bool> stop;
+  std::atomic<bool> running, finished;
+  std::thread worker;
+  // Points are (rho, z), with f at rho on the x axis
+  Delaunay<2,std::complex<double> > plane;
+  IndexedHeap<TriangleItem> heap_of_triangles;
+  unsigned examined;
+  // The swept mesh, made when the worker stops
+  std::vector<Vector<3> > positions;
+  std::vector<std::complex<double> > values;
+  std::vector<unsigned> indices;
+};
+
+#endif
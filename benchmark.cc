@@ -0,0 +1,907 @@
+/*
+ * This file is part of the Electron Orbital Explorer. The Electron
+ * Orbital Explorer is distributed under the Simplified BSD License
+ * (also called the "BSD 2-Clause License"), in hopes that these
+ * rendering techniques might be used by other programmers in
+ * applications such as scientific visualization, video gaming, and so
+ * on. If you find value in this software and use its technologies for
+ * another purpose, I would love to hear back from you at bjthinks (at)
+ * gmail (dot) com. If you improve this software and agree to release
+ * your modifications under the below license, I encourage you to fork
+ * the development tree on github and push your modifications. The
+ * Electron Orbital Explorer's development URL is:
+ * https://github.com/bjthinks/orbital-explorer
+ * (This paragraph is not part of the software license and may be
+ * removed.)
+ *
+ * Copyright (c) 2013, Brian W. Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * + Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * + Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Timing benchmarks for the non-graphical parts of the program. Run
+// with no arguments to run everything, or with the names of specific
+// benchmarks to run just those.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <complex>
+#include <algorithm>
+#include <unistd.h>
+
+#include "config.hh"
+#include "util.hh"
+#include "vector.hh"
+#include "function.hh"
+#include "wavefunction.hh"
+#include "tabulated_orbital.hh"
+#include "tetrahedralize.hh"
+#include "mesh_cache.hh"
+#include "axial_subdivision.hh"
+#include "workerpool.hh"
+
+using namespace std;
+
+// Random points in the cube of side 2 * radius centered at the origin,
+// stored as separate coordinate arrays
+struct PointSet
+{
+  PointSet(unsigned count, double radius);
+  vector<double> x, y, z;
+};
+
+PointSet::PointSet(unsigned count, double radius) :
+  x(count), y(count), z(count)
+{
+  for (unsigned i = 0; i < count; ++i) {
+    x[i] = radius * (2.0 * double(rand()) / double(RAND_MAX) - 1.0);
+    y[i] = radius * (2.0 * double(rand()) / double(RAND_MAX) - 1.0);
+    z[i] = radius * (2.0 * double(rand()) / double(RAND_MAX) - 1.0);
+  }
+}
+
+// Results that are computed only to be timed are stored here, so that
+// the compiler can't discard the work
+static volatile double benchmark_sink;
+
+// A few orbitals of increasing complexity
+static const int benchmark_orbitals[][4] = {
+  // Z, N, L, M
+  { 1,  2, 1,  1 },
+  { 1,  5, 2, -1 },
+  { 1, 10, 4,  3 },
+  { 1, 16, 8,  5 },
+  { 1, 16, 0,  0 },
+  { 1, 16, 15, 15 }
+};
+static const int num_benchmark_orbitals =
+  sizeof(benchmark_orbitals) / sizeof(benchmark_orbitals[0]);
+
+static Orbital benchmark_orbital(int i, bool real = false,
+                                 Orbital::Method method = Orbital::SPECIALIZED)
+{
+  const int *q = benchmark_orbitals[i];
+  return Orbital(q[0], q[1], q[2], q[3], real, false, false, method);
+}
+
+static const char *orbital_name(const Orbital &orbital)
+{
+  static char name[32];
+  snprintf(name, sizeof(name), "(%d,%d,%d,%d)", orbital.Z, orbital.N,
+           orbital.L, orbital.M);
+  return name;
+}
+
+// Seconds to subdivide space for f, run on the calling thread
+static double time_subdivision(const Function<3,complex<double> > &f,
+                               double radius, unsigned vertices,
+                               bool single_precision = false)
+{
+  double start = now();
+  TetrahedralSubdivision ts(f, radius, single_precision);
+  ts.work(vertices);
+  return now() - start;
+}
+
+// Evaluation of an orbital one point at a time, through the virtual
+// Function interface, versus the batch interface
+static void benchmark_batch()
+{
+  printf("Scalar vs. batch orbital evaluation (points/second)\n");
+  printf("%-16s %12s %12s %8s\n", "orbital", "scalar", "batch", "speedup");
+
+  const unsigned num_points = 200000;
+  for (int i = 0; i < num_benchmark_orbitals; ++i) {
+    Orbital orbital = benchmark_orbital(i);
+    const Function<3,complex<double> > &f = orbital;
+    PointSet points(num_points, orbital.radius());
+
+    double checksum = 0.0;
+    double start = now();
+    Vector<3> p;
+    for (unsigned k = 0; k < num_points; ++k) {
+      p[0] = points.x[k];
+      p[1] = points.y[k];
+      p[2] = points.z[k];
+      checksum += abs(f(p));
+    }
+    double scalar_time = now() - start;
+
+    vector<double> re(num_points), im(num_points), mag(num_points);
+    start = now();
+    orbital.evaluate(&points.x[0], &points.y[0], &points.z[0], num_points,
+                     &re[0], &im[0], &mag[0]);
+    double batch_time = now() - start;
+    for (unsigned k = 0; k < num_points; ++k)
+      checksum -= mag[k];
+
+    printf("%-16s %12.0f %12.0f %7.2fx", orbital_name(orbital),
+           num_points / scalar_time,
+           num_points / batch_time, scalar_time / batch_time);
+    printf("   (checksum %g)\n", checksum);
+  }
+  printf("\n");
+}
+
+// Compile-time specialized polynomial kernels versus the generic
+// CompiledPolynomial path, both per evaluation and in subdivision
+static void benchmark_kernels()
+{
+  printf("Generic vs. specialized kernels\n");
+  printf("%-16s %12s %12s %8s %10s %10s %8s\n", "orbital",
+         "generic/s", "special/s", "speedup",
+         "gen subdiv", "spec subdiv", "speedup");
+
+  const unsigned num_points = 200000;
+  const unsigned vertices = 3000;
+  for (int i = 0; i < num_benchmark_orbitals; ++i) {
+    Orbital generic = benchmark_orbital(i, false, Orbital::GENERIC);
+    Orbital specialized = benchmark_orbital(i, false, Orbital::SPECIALIZED);
+    PointSet points(num_points, generic.radius());
+    vector<double> re(num_points), im(num_points), mag(num_points);
+
+    double start = now();
+    generic.evaluate(&points.x[0], &points.y[0], &points.z[0], num_points,
+                     &re[0], &im[0], &mag[0]);
+    double generic_time = now() - start;
+    start = now();
+    specialized.evaluate(&points.x[0], &points.y[0], &points.z[0],
+                         num_points, &re[0], &im[0], &mag[0]);
+    double specialized_time = now() - start;
+
+    double generic_subdivision =
+      time_subdivision(generic, generic.radius(), vertices);
+    double specialized_subdivision =
+      time_subdivision(specialized, specialized.radius(), vertices);
+
+    printf("%-16s %12.0f %12.0f %7.2fx %9.3fs %9.3fs %7.2fx\n",
+           orbital_name(generic), num_points / generic_time,
+           num_points / specialized_time, generic_time / specialized_time,
+           generic_subdivision, specialized_subdivision,
+           generic_subdivision / specialized_subdivision);
+  }
+  printf("\n");
+}
+
+// Three-term recurrences versus expanded polynomials, per evaluation
+// and in the time to construct every orbital up to MAX_ENERGY_LEVEL
+static void benchmark_recurrence()
+{
+  static const Orbital::Method methods[] = {
+    Orbital::GENERIC, Orbital::SPECIALIZED, Orbital::RECURRENCE
+  };
+  static const char *method_names[] = {
+    "generic", "specialized", "recurrence"
+  };
+  const int num_methods = sizeof(methods) / sizeof(methods[0]);
+
+  printf("Recurrence vs. polynomial evaluation (points/second)\n");
+  printf("%-16s", "orbital");
+  for (int m = 0; m < num_methods; ++m)
+    printf(" %12s", method_names[m]);
+  printf("\n");
+
+  const unsigned num_points = 200000;
+  for (int i = 0; i < num_benchmark_orbitals; ++i) {
+    PointSet points(num_points, benchmark_orbital(i).radius());
+    vector<double> re(num_points), im(num_points), mag(num_points);
+    printf("%-16s", orbital_name(benchmark_orbital(i)));
+    for (int m = 0; m < num_methods; ++m) {
+      Orbital orbital = benchmark_orbital(i, false, methods[m]);
+      double start = now();
+      orbital.evaluate(&points.x[0], &points.y[0], &points.z[0], num_points,
+                       &re[0], &im[0], &mag[0]);
+      printf(" %12.0f", num_points / (now() - start));
+    }
+    printf("\n");
+  }
+
+  printf("Construction of all orbitals with N <= %d (seconds)\n",
+         MAX_ENERGY_LEVEL);
+  for (int m = 0; m < num_methods; ++m) {
+    double start = now();
+    for (int N = 1; N <= MAX_ENERGY_LEVEL; ++N)
+      for (int L = 0; L < N; ++L)
+        for (int M = -L; M <= L; ++M)
+          Orbital(1, N, L, M, false, false, false, methods[m]);
+    printf("%-16s %12.4f\n", method_names[m], now() - start);
+  }
+  printf("\n");
+}
+
+// Tabulated orbitals at a few estimated errors: table size and build
+// time, evaluation rate against the orbital itself, worst observed
+// error, which can exceed the estimate, and subdivision time
+static void benchmark_tabulated()
+{
+  printf("Tabulated vs. direct orbital evaluation\n");
+  printf("%-16s %8s %7s %7s %8s %11s %11s %9s %9s %9s\n", "orbital",
+         "tol", "radial", "theta", "build", "direct/s", "table/s",
+         "max err", "subdiv", "tab subdiv");
+
+  static const double tolerances[] = { 1e-4, 1e-7 };
+  const unsigned num_points = 200000;
+  const unsigned vertices = 3000;
+  for (int i = 0; i < num_benchmark_orbitals; ++i) {
+    Orbital orbital = benchmark_orbital(i);
+    const Function<3,complex<double> > &f = orbital;
+    PointSet points(num_points, orbital.radius());
+    double direct_subdivision =
+      time_subdivision(orbital, orbital.radius(), vertices);
+
+    for (unsigned t = 0; t < sizeof(tolerances) / sizeof(tolerances[0]);
+         ++t) {
+      double start = now();
+      TabulatedOrbital tabulated(orbital, tolerances[t]);
+      double build_time = now() - start;
+      const Function<3,complex<double> > &g = tabulated;
+
+      vector<complex<double> > direct(num_points), table(num_points);
+      Vector<3> p;
+      start = now();
+      for (unsigned k = 0; k < num_points; ++k) {
+        p[0] = points.x[k];
+        p[1] = points.y[k];
+        p[2] = points.z[k];
+        direct[k] = f(p);
+      }
+      double direct_time = now() - start;
+      start = now();
+      for (unsigned k = 0; k < num_points; ++k) {
+        p[0] = points.x[k];
+        p[1] = points.y[k];
+        p[2] = points.z[k];
+        table[k] = g(p);
+      }
+      double table_time = now() - start;
+
+      double max_error = 0.0;
+      for (unsigned k = 0; k < num_points; ++k)
+        max_error = max(max_error, abs(table[k] - direct[k]));
+
+      double tabulated_subdivision =
+        time_subdivision(tabulated, orbital.radius(), vertices);
+
+      printf("%-16s %8.0e %7u %7u %7.4fs %11.0f %11.0f %9.2e %8.3fs %8.3fs\n",
+             orbital_name(orbital), tolerances[t],
+             tabulated.radialIntervals(), tabulated.angularIntervals(),
+             build_time, num_points / direct_time, num_points / table_time,
+             max_error, direct_subdivision, tabulated_subdivision);
+    }
+  }
+  printf("\n");
+}
+
+// e^(iM phi) from atan2, cos and sin versus from powers of
+// (x + iy) / r_xy, through both the scalar and the batch interfaces
+static void benchmark_phase()
+{
+  printf("Trigonometric vs. algebraic phase (points/second)\n");
+  printf("%-16s %5s %11s %11s %8s %11s %11s %8s\n", "orbital", "real",
+         "trig", "algebraic", "speedup", "trig batch", "alg batch",
+         "speedup");
+
+  const unsigned num_points = 200000;
+  for (int i = 0; i < num_benchmark_orbitals; ++i)
+    for (int real = 0; real < 2; ++real) {
+      const int *q = benchmark_orbitals[i];
+      if (real && q[3] <= 0)
+        continue;
+      Orbital trig(q[0], q[1], q[2], q[3], real, false, false,
+                   Orbital::SPECIALIZED, Orbital::TRIGONOMETRIC);
+      Orbital algebraic(q[0], q[1], q[2], q[3], real, false, false,
+                        Orbital::SPECIALIZED, Orbital::ALGEBRAIC);
+      PointSet points(num_points, trig.radius());
+      vector<double> re(num_points), im(num_points), mag(num_points);
+
+      double times[4];
+      for (int k = 0; k < 2; ++k) {
+        const Orbital &orbital = k ? algebraic : trig;
+        const Function<3,complex<double> > &f = orbital;
+        double checksum = 0.0;
+        Vector<3> p;
+        double start = now();
+        for (unsigned j = 0; j < num_points; ++j) {
+          p[0] = points.x[j];
+          p[1] = points.y[j];
+          p[2] = points.z[j];
+          checksum += f(p).real();
+        }
+        times[k] = now() - start;
+        start = now();
+        orbital.evaluate(&points.x[0], &points.y[0], &points.z[0],
+                         num_points, &re[0], &im[0], &mag[0]);
+        times[k + 2] = now() - start;
+        benchmark_sink = checksum;
+      }
+
+      printf("%-16s %5s %11.0f %11.0f %7.2fx %11.0f %11.0f %7.2fx\n",
+             orbital_name(trig), real ? "yes" : "no",
+             num_points / times[0], num_points / times[1],
+             times[0] / times[1], num_points / times[2],
+             num_points / times[3], times[2] / times[3]);
+    }
+  printf("\n");
+}
+
+// Single precision test point sampling: evaluation rate, subdivision
+// time, and how often the worst test point of a tetrahedron changes
+// from the one double precision picks, over the tetrahedra of a mesh
+static void benchmark_single()
+{
+  printf("Double vs. single precision sampling\n");
+  printf("%-16s %11s %11s %8s %9s %9s %9s %9s\n", "orbital", "double/s",
+         "single/s", "speedup", "subdiv", "single", "changed", "err diff");
+
+  const unsigned num_points = 200000;
+  const unsigned vertices = 3000;
+  for (int i = 0; i < num_benchmark_orbitals; ++i) {
+    Orbital orbital = benchmark_orbital(i);
+    PointSet points(num_points, orbital.radius());
+    vector<float> fx(points.x.begin(), points.x.end());
+    vector<float> fy(points.y.begin(), points.y.end());
+    vector<float> fz(points.z.begin(), points.z.end());
+
+    vector<double> re(num_points), im(num_points), mag(num_points);
+    double start = now();
+    orbital.evaluate(&points.x[0], &points.y[0], &points.z[0], num_points,
+                     &re[0], &im[0], &mag[0]);
+    double double_time = now() - start;
+    vector<float> fre(num_points), fim(num_points), fmag(num_points);
+    start = now();
+    orbital.evaluate(&fx[0], &fy[0], &fz[0], num_points,
+                     &fre[0], &fim[0], &fmag[0]);
+    double single_time = now() - start;
+
+    double double_subdivision =
+      time_subdivision(orbital, orbital.radius(), vertices);
+    double single_subdivision =
+      time_subdivision(orbital, orbital.radius(), vertices, true);
+
+    TetrahedralSubdivision ts(orbital, orbital.radius());
+    ts.work(vertices);
+    vector<Vector<3> > positions = ts.vertexPositions();
+    vector<unsigned> indices = ts.tetrahedronVertexIndices();
+    unsigned num_tetrahedra = indices.size() / 4;
+    unsigned changed = 0;
+    double max_error_difference = 0.0;
+    for (unsigned t = 0; t < num_tetrahedra; ++t) {
+      Vector<3> vertex[4];
+      for (unsigned k = 0; k < 4; ++k)
+        vertex[k] = positions[indices[4 * t + k]];
+      pair<Vector<3>,double> d = worstTestPoint(orbital, vertex, false);
+      pair<Vector<3>,double> s = worstTestPoint(orbital, vertex, true);
+      if (d.first != s.first)
+        ++changed;
+      if (d.second > 0.0)
+        max_error_difference = max(max_error_difference,
+                                   fabs(s.second - d.second) / d.second);
+    }
+
+    printf("%-16s %11.0f %11.0f %7.2fx %8.3fs %8.3fs %8.2f%% %9.2e\n",
+           orbital_name(orbital), num_points / double_time,
+           num_points / single_time, double_time / single_time,
+           double_subdivision, single_subdivision,
+           100.0 * changed / num_tetrahedra, max_error_difference);
+  }
+  printf("\n");
+}
+
+// Analytic gradient and Hessian versus central differences, which
+// take 6 and 24 extra evaluations as in RealFunction
+static void benchmark_derivatives()
+{
+  printf("Analytic vs. finite difference derivatives (points/second)\n");
+  printf("%-16s %11s %11s %8s\n", "orbital", "analytic", "finite diff",
+         "speedup");
+
+  const unsigned num_points = 20000;
+  for (int i = 0; i < num_benchmark_orbitals; ++i) {
+    Orbital orbital = benchmark_orbital(i);
+    PointSet points(num_points, orbital.radius());
+    const double h = 1e-4 * orbital.radius();
+
+    complex<double> checksum = 0.0;
+    double start = now();
+    for (unsigned k = 0; k < num_points; ++k) {
+      Vector<3> x = Vector3(points.x[k], points.y[k], points.z[k]);
+      complex<double> value;
+      CVector<3> grad;
+      CMatrix<3,3> hess;
+      orbital.derivatives(x, value, grad, hess);
+      checksum += value + grad[0] + hess(0,0);
+    }
+    double analytic_time = now() - start;
+
+    start = now();
+    for (unsigned k = 0; k < num_points; ++k) {
+      Vector<3> x = Vector3(points.x[k], points.y[k], points.z[k]);
+      complex<double> value = orbital(x);
+      CVector<3> grad;
+      CMatrix<3,3> hess;
+      Vector<3> d1(0.0), d2(0.0);
+      for (unsigned a = 0; a < 3; ++a) {
+        d1[a] = h;
+        grad[a] = (orbital(x + d1) - orbital(x - d1)) / (2.0 * h);
+        for (unsigned b = a; b < 3; ++b) {
+          d2[b] = h;
+          hess(a,b) = hess(b,a) =
+            (orbital(x + d1 + d2) - orbital(x + d1 - d2) -
+             orbital(x - d1 + d2) + orbital(x - d1 - d2)) / (4.0 * h * h);
+          d2[b] = 0.0;
+        }
+        d1[a] = 0.0;
+      }
+      checksum -= value + grad[0] + hess(0,0);
+    }
+    double difference_time = now() - start;
+    benchmark_sink = abs(checksum);
+
+    printf("%-16s %11.0f %11.0f %7.2fx\n", orbital_name(orbital),
+           num_points / analytic_time, num_points / difference_time,
+           difference_time / analytic_time);
+  }
+  printf("\n");
+}
+
+// Passes evaluations through to another function, counting points
+class CountingFunction : public Function<3,complex<double> >
+{
+public:
+  explicit CountingFunction(const Function<3,complex<double> > &f_) :
+    f(f_), count(0)
+  {}
+  complex<double> operator()(const Vector<3> &x) const
+  {
+    ++count;
+    return f(x);
+  }
+  void evaluate(const double *const coords[3], size_t n,
+                complex<double> *values) const
+  {
+    count += n;
+    f.evaluate(coords, n, values);
+  }
+  void evaluate(const float *const coords[3], size_t n,
+                complex<float> *values) const
+  {
+    count += n;
+    f.evaluate(coords, n, values);
+  }
+  const Function<3,complex<double> > &f;
+  mutable unsigned long count;
+};
+
+// How well a finished mesh approximates f, judged by the lattice
+// estimator on each tetrahedron: the largest error at any test point,
+// and the sum of squared worst errors times volume, which is what
+// subdivision tries to minimize
+static void mesh_error(const Function<3,complex<double> > &f,
+                       const vector<Vector<3> > &positions,
+                       const vector<unsigned> &indices,
+                       double &max_error, double &total_error)
+{
+  max_error = 0.0;
+  total_error = 0.0;
+  for (unsigned t = 0; t + 3 < indices.size(); t += 4) {
+    Vector<3> vertex[4];
+    for (unsigned k = 0; k < 4; ++k)
+      vertex[k] = positions[indices[t + k]];
+    double error = worstTestPoint(f, vertex).second;
+    double volume = fabs(dot_product(vertex[1] - vertex[0],
+                                     cross_product(vertex[2] - vertex[0],
+                                                   vertex[3] - vertex[0])));
+    max_error = max(max_error, error);
+    total_error += error * error * volume;
+  }
+}
+
+static void mesh_error(const Function<3,complex<double> > &f,
+                       TetrahedralSubdivision &ts,
+                       double &max_error, double &total_error)
+{
+  mesh_error(f, ts.vertexPositions(), ts.tetrahedronVertexIndices(),
+             max_error, total_error);
+}
+
+// The insertion point estimators compared at the same detail level:
+// total evaluations and evaluations per inserted vertex, time, and the
+// error of the final mesh
+static void benchmark_estimator()
+{
+  struct Configuration
+  {
+    const char *name;
+    TetrahedralSubdivision::Estimator estimator;
+    unsigned budget;
+  };
+  static const Configuration configurations[] = {
+    { "lattice", TetrahedralSubdivision::LATTICE, 0 },
+    { "quadratic", TetrahedralSubdivision::QUADRATIC, 0 },
+    { "adaptive32", TetrahedralSubdivision::ADAPTIVE, 32 },
+    { "adaptive64", TetrahedralSubdivision::ADAPTIVE, 64 }
+  };
+  const int num_configurations =
+    sizeof(configurations) / sizeof(configurations[0]);
+
+  printf("Insertion point estimators\n");
+  printf("%-16s %-10s %11s %10s %9s %11s %11s\n", "orbital", "estimator",
+         "evals", "evals/vtx", "time", "max error", "total error");
+
+  const unsigned vertices = 3000;
+  for (int i = 0; i < num_benchmark_orbitals; ++i) {
+    Orbital orbital = benchmark_orbital(i);
+    for (int c = 0; c < num_configurations; ++c) {
+      CountingFunction counter(orbital);
+      double start = now();
+      TetrahedralSubdivision ts(counter, orbital.radius(), false,
+                                configurations[c].estimator,
+                                configurations[c].budget);
+      ts.work(vertices);
+      double elapsed = now() - start;
+      double max_error, total_error;
+      mesh_error(orbital, ts, max_error, total_error);
+      printf("%-16s %-10s %11lu %10.1f %8.3fs %11.3e %11.3e\n",
+             orbital_name(orbital), configurations[c].name, counter.count,
+             double(counter.count) / ts.numVertices(), elapsed,
+             max_error, total_error);
+    }
+  }
+  printf("\n");
+}
+
+// Subdivision with the lattice estimator, with and without sharing
+// samples on faces and edges between tetrahedra: evaluations per
+// inserted vertex, time, and how often the cache had the samples
+static void benchmark_cache()
+{
+  printf("Sample cache\n");
+  printf("%-16s %10s %9s %10s %9s %8s %9s\n", "orbital", "evals/vtx",
+         "time", "cached", "time", "hits", "held");
+
+  const unsigned vertices = 3000;
+  for (int i = 0; i < num_benchmark_orbitals; ++i) {
+    Orbital orbital = benchmark_orbital(i);
+    CountingFunction uncached_counter(orbital);
+    double start = now();
+    TetrahedralSubdivision uncached(uncached_counter, orbital.radius());
+    uncached.work(vertices);
+    double uncached_time = now() - start;
+
+    CountingFunction cached_counter(orbital);
+    start = now();
+    TetrahedralSubdivision cached(cached_counter, orbital.radius());
+    cached.setSampleCache(true);
+    cached.work(vertices);
+    double cached_time = now() - start;
+
+    const SampleCache *cache = cached.sampleCache();
+    double hit_rate = double(cache->hits()) /
+      double(cache->hits() + cache->misses());
+    printf("%-16s %10.1f %8.3fs %10.1f %8.3fs %7.1f%% %9lu\n",
+           orbital_name(orbital),
+           double(uncached_counter.count) / uncached.numVertices(),
+           uncached_time,
+           double(cached_counter.count) / cached.numVertices(), cached_time,
+           100.0 * hit_rate, (unsigned long)cache->size());
+  }
+  printf("\n");
+}
+
+// Subdivision with every new tetrahedron searched for its worst point
+// right away, against searching only those whose estimated error
+// brings them to the top of the heap: evaluations per inserted vertex,
+// time, full searches, searches avoided, and the final mesh's error
+static void benchmark_lazy()
+{
+  printf("Lazy error evaluation\n");
+  printf("%-16s %-6s %10s %9s %9s %9s %11s %11s\n", "orbital", "mode",
+         "evals/vtx", "time", "probes", "avoided", "max error",
+         "total error");
+
+  const unsigned vertices = 3000;
+  for (int i = 0; i < num_benchmark_orbitals; ++i) {
+    Orbital orbital = benchmark_orbital(i);
+    for (int lazy = 0; lazy <= 1; ++lazy) {
+      CountingFunction counter(orbital);
+      double start = now();
+      TetrahedralSubdivision ts(counter, orbital.radius());
+      ts.setLazyEvaluation(lazy);
+      ts.work(vertices);
+      double elapsed = now() - start;
+      TetrahedralSubdivision::Stats stats = ts.stats();
+      double max_error, total_error;
+      mesh_error(orbital, ts, max_error, total_error);
+      printf("%-16s %-6s %10.1f %8.3fs %9lu %9lu %11.3e %11.3e\n",
+             orbital_name(orbital), lazy ? "lazy" : "eager",
+             double(counter.count) / ts.numVertices(), elapsed,
+             stats.probes, stats.probesAvoided(), max_error, total_error);
+    }
+  }
+  printf("\n");
+}
+
+// The heap of tetrahedra waiting to be split: the most items it held,
+// and how many were popped, for a subdivision to the given number of
+// vertices
+static void benchmark_heap()
+{
+  printf("Subdivision heap\n");
+  printf("%-16s %8s %9s %10s %9s\n", "orbital", "vertices", "time",
+         "peak size", "pops");
+
+  const unsigned vertices[] = { 3000, 20000 };
+  for (int i = 0; i < num_benchmark_orbitals; ++i) {
+    Orbital orbital = benchmark_orbital(i);
+    for (int v = 0; v < 2; ++v) {
+      double start = now();
+      TetrahedralSubdivision ts(orbital, orbital.radius());
+      ts.setLazyEvaluation(true);
+      ts.work(vertices[v]);
+      double elapsed = now() - start;
+      TetrahedralSubdivision::Stats stats = ts.stats();
+      printf("%-16s %8u %8.3fs %10lu %9lu\n", orbital_name(orbital),
+             vertices[v], elapsed, stats.peak_heap_size, stats.pops);
+    }
+  }
+  printf("\n");
+}
+
+// Subdivision time against the number of threads evaluating new
+// tetrahedra, from 1 up to at least 4 or the number of hardware
+// threads, whichever is more
+static void benchmark_threads()
+{
+  unsigned max_threads = max(4u, WorkerPool::hardwareThreads());
+  printf("Subdivision scaling with threads (%u hardware threads)\n",
+         WorkerPool::hardwareThreads());
+  printf("%-16s", "orbital");
+  for (unsigned t = 1; t <= max_threads; ++t)
+    printf(" %6u", t);
+  printf("\n");
+
+  const unsigned vertices = 3000;
+  for (int i = 0; i < num_benchmark_orbitals; ++i) {
+    Orbital orbital = benchmark_orbital(i);
+    printf("%-16s", orbital_name(orbital));
+    double serial_time = 0.0;
+    for (unsigned t = 1; t <= max_threads; ++t) {
+      double start = now();
+      TetrahedralSubdivision ts(orbital, orbital.radius());
+      ts.setThreads(t);
+      ts.work(vertices);
+      double elapsed = now() - start;
+      if (t == 1)
+        serial_time = elapsed;
+      printf(" %5.2fx", serial_time / elapsed);
+    }
+    printf("\n");
+  }
+  printf("\n");
+}
+
+// A mesh of the whole cube against ones of its octant with an eighth
+// and a fifth of the vertices, the latter as the viewer draws with
+// octant symmetry: evaluations, time, and the error of the mesh, the octant's
+// scaled up to the whole cube
+static void benchmark_symmetry()
+{
+  printf("Octant symmetry\n");
+  printf("%-16s %-6s %8s %11s %9s %11s %11s\n", "orbital", "domain",
+         "vertices", "evals", "time", "max error", "total error");
+
+  const unsigned vertices = 8000;
+  // The whole cube, then the octant with vertices / share
+  static const unsigned shares[] = { 1, 8, 5 };
+  for (int i = 0; i < num_benchmark_orbitals; ++i) {
+    Orbital orbital = benchmark_orbital(i);
+    for (unsigned s = 0; s < 3; ++s) {
+      bool octant = shares[s] > 1;
+      CountingFunction counter(orbital);
+      double start = now();
+      TetrahedralSubdivision ts(counter, orbital.radius(), false,
+                                TetrahedralSubdivision::LATTICE, 64,
+                                octant ? TetrahedralSubdivision::OCTANT :
+                                TetrahedralSubdivision::WHOLE_SPACE);
+      ts.work(vertices / shares[s]);
+      double elapsed = now() - start;
+      double max_error, total_error;
+      mesh_error(orbital, ts, max_error, total_error);
+      if (octant)
+        total_error *= 8.0;
+      char domain[8];
+      snprintf(domain, sizeof(domain), octant ? "1/%u" : "whole", shares[s]);
+      printf("%-16s %-6s %8d %11lu %8.3fs %11.3e %11.3e\n",
+             orbital_name(orbital), domain, ts.numVertices(), counter.count,
+             elapsed, max_error, total_error);
+    }
+  }
+  printf("\n");
+}
+
+// An octant of a complex orbital subdivided in 3D, against the quarter
+// plane subdivided and swept around the axis, at several sizes
+static void benchmark_axial()
+{
+  printf("Axisymmetric meshes\n");
+  printf("%-16s %-8s %8s %8s %11s %9s %11s %11s\n", "orbital", "mesh",
+         "plane", "vertices", "evals", "time", "max error", "total error");
+
+  for (int i = 0; i < num_benchmark_orbitals; ++i) {
+    Orbital orbital = benchmark_orbital(i);
+    double max_error, total_error;
+
+    CountingFunction counter(orbital);
+    double start = now();
+    TetrahedralSubdivision ts(counter, orbital.radius(), false,
+                              TetrahedralSubdivision::LATTICE, 64,
+                              TetrahedralSubdivision::OCTANT);
+    ts.work(1000);
+    double elapsed = now() - start;
+    mesh_error(orbital, ts, max_error, total_error);
+    printf("%-16s %-8s %8s %8d %11lu %8.3fs %11.3e %11.3e\n",
+           orbital_name(orbital), "octant", "", ts.numVertices(),
+           counter.count, elapsed, max_error, total_error);
+
+    static const unsigned plane_vertices[] = { 100, 200, 400 };
+    for (unsigned p = 0; p < 3; ++p) {
+      CountingFunction axial_counter(orbital);
+      start = now();
+      AxialSubdivision axial(axial_counter, orbital.M, orbital.radius());
+      axial.work(plane_vertices[p]);
+      elapsed = now() - start;
+      vector<Vector<3> > positions = axial.vertexPositions();
+      mesh_error(orbital, positions, axial.tetrahedronVertexIndices(),
+                 max_error, total_error);
+      printf("%-16s %-8s %8u %8u %11lu %8.3fs %11.3e %11.3e\n",
+             orbital_name(orbital), "axial", axial.numPlaneVertices(),
+             unsigned(positions.size()), axial_counter.count, elapsed,
+             max_error, total_error);
+    }
+  }
+  printf("\n");
+}
+
+// Time to make a mesh and save it, against loading it from the mesh
+// cache and getting the subdivision back ready to carry on
+static void benchmark_meshcache()
+{
+  printf("Mesh cache\n");
+  printf("%-16s %8s %9s %9s %9s\n", "orbital", "vertices", "cold",
+         "warm", "file");
+
+  char directory[] = "/tmp/mesh_cache_benchmark.XXXXXX";
+  if (!mkdtemp(directory)) {
+    printf("Can't make a temporary directory\n\n");
+    return;
+  }
+  MeshCache cache(directory);
+  const unsigned vertices = 8900;
+  for (int i = 0; i < num_benchmark_orbitals; ++i) {
+    Orbital orbital = benchmark_orbital(i);
+    MeshCacheKey key(orbital, 6, TetrahedralSubdivision::LATTICE);
+
+    double start = now();
+    TetrahedralSubdivision cold(orbital, orbital.radius());
+    cold.setThreads(WorkerPool::hardwareThreads());
+    cold.work(vertices);
+    cache.save(key, cold);
+    double cold_time = now() - start;
+
+    start = now();
+    MappedMesh *mesh = cache.load(key);
+    if (!mesh) {
+      printf("%-16s not saved\n", orbital_name(orbital));
+      continue;
+    }
+    TetrahedralSubdivision warm(orbital, *mesh);
+    double warm_time = now() - start;
+    unsigned long size = mesh->header().file_size;
+    delete mesh;
+
+    printf("%-16s %8u %8.3fs %8.3fs %8luK\n", orbital_name(orbital),
+           vertices, cold_time, warm_time, size / 1024);
+    unlink((string(directory) + "/" + key.fileName()).c_str());
+  }
+  rmdir(directory);
+  printf("\n");
+}
+
+struct Benchmark
+{
+  const char *name;
+  void (*run)();
+};
+
+static const Benchmark benchmarks[] = {
+  { "batch", benchmark_batch },
+  { "kernels", benchmark_kernels },
+  { "recurrence", benchmark_recurrence },
+  { "tabulated", benchmark_tabulated },
+  { "phase", benchmark_phase },
+  { "single", benchmark_single },
+  { "derivatives", benchmark_derivatives },
+  { "estimator", benchmark_estimator },
+  { "cache", benchmark_cache },
+  { "lazy", benchmark_lazy },
+  { "heap", benchmark_heap },
+  { "threads", benchmark_threads },
+  { "symmetry", benchmark_symmetry },
+  { "axial", benchmark_axial },
+  { "meshcache", benchmark_meshcache }
+};
+static const int num_benchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+int main(int argc, char *argv[])
+{
+  srand(0);
+
+  if (argc == 1) {
+    for (int i = 0; i < num_benchmarks; ++i)
+      benchmarks[i].run();
+    return 0;
+  }
+
+  for (int a = 1; a < argc; ++a) {
+    int i;
+    for (i = 0; i < num_benchmarks; ++i)
+      if (strcmp(argv[a], benchmarks[i].name) == 0)
+        break;
+    if (i == num_benchmarks) {
+      fprintf(stderr, "Unknown benchmark: %s\nAvailable:", argv[a]);
+      for (i = 0; i < num_benchmarks; ++i)
+        fprintf(stderr, " %s", benchmarks[i].name);
+      fprintf(stderr, "\n");
+      return 1;
+    }
+    benchmarks[i].run();
+  }
+
+  return 0;
+}
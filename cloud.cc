@@ -43,12 +43,15 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <complex>
 #include <vector>
 #include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 
 #include "oopengl.hh"
 #include "cloud.hh"
+#include "transform.hh"
 #include "shaders.hh"
 #include "util.hh"
 
@@ -80,43 +83,193 @@ Cloud::Cloud(Texture *solidDepthTex_, Texture *cloudDensityTex)
   // Camera should not actually start at this location
   old_camera_position = Vector<4>(0.);
 
-  primitives_changed = false;
+  position_scale = 1.0;
+  needs_sort = true;
+  setTransform(1.0, 1.0, false);
+  setOctantSymmetry(NULL);
+  vertex_capacity = 0;
+  clear();
 }
 
-Cloud::StrippedTetra Cloud::strip_sort_key(const Tetra &t)
+void Cloud::setTransform(double position_scale_, double value_scale_,
+                         bool conjugate_)
 {
-  StrippedTetra s;
+  // The sort keys depend on where the camera is relative to the mesh
+  if (position_scale_ != position_scale)
+    needs_sort = true;
+  position_scale = position_scale_;
+  value_scale = value_scale_;
+  conjugate = conjugate_;
+}
 
-  for (int i = 0; i < 4; ++i)
-    s.vertex[i] = t.vertex[i];
+void Cloud::setOctantSymmetry(const Orbital::Reflection *reflections)
+{
+  copies.resize(reflections ? 8 : 1);
+  for (unsigned c = 0; c < copies.size(); ++c) {
+    copies[c].sign = 1.0;
+    copies[c].conjugate = false;
+    for (unsigned axis = 0; axis < 3; ++axis)
+      if (c & (1 << axis)) {
+        copies[c].sign *= reflections[axis].sign;
+        copies[c].conjugate ^= reflections[axis].conjugate;
+      }
+    copies[c].order.resize(slots.size());
+    for (unsigned slot = 0; slot < slots.size(); ++slot) {
+      copies[c].order[slot].sort_key = 0.0;
+      copies[c].order[slot].slot = slot;
+    }
+  }
+  primitives_changed = true;
+}
 
-  return s;
+unsigned Cloud::numDrawnVertices() const
+{
+  if (copies.size() == 1)
+    return positions.size();
+  // A vertex on k of the planes is its own reflection in them, so it
+  // has 8 >> k distinct copies
+  unsigned drawn = 0;
+  for (unsigned i = 0; i < positions.size(); ++i) {
+    unsigned on_planes = 0;
+    for (unsigned axis = 0; axis < 3; ++axis)
+      if (positions[i][axis] == 0.0)
+        ++on_planes;
+    drawn += copies.size() >> on_planes;
+  }
+  return drawn;
 }
 
-void Cloud::setPrimitives(const std::vector<Vector<3> > &pos,
-                          const std::vector<unsigned> &ind,
-                          const Orbital *orb)
+// Marks a slot with no tetrahedron in it
+static const unsigned free_slot = ~0u;
+
+void Cloud::clear()
 {
-  positions = pos;
+  mesh_version = 0;
+  positions.clear();
+  values.clear();
+  uploaded_vertices = 0;
+  slots.clear();
+  free_slots.clear();
+  slot_of_simplex.clear();
+  for (unsigned c = 0; c < copies.size(); ++c)
+    copies[c].order.clear();
+  primitives_changed = true;
+}
 
-  int num_tetrahedra = ind.size() / 4;
-  indices.resize(num_tetrahedra);
-  for (int i = 0; i < num_tetrahedra; ++i) {
-    indices[i].sort_key = 0.0;
+void Cloud::addSlotToOrders(unsigned slot)
+{
+  Tetra t;
+  t.sort_key = 0.0;
+  t.slot = slot;
+  for (unsigned c = 0; c < copies.size(); ++c)
+    copies[c].order.push_back(t);
+}
+
+void Cloud::applyDelta(const MeshDelta &delta)
+{
+  if (delta.first_vertex > positions.size()) {
+    fprintf(stderr, "Cloud::applyDelta(): delta from vertex %u, "
+            "but only %u vertices are loaded\n", delta.first_vertex,
+            unsigned(positions.size()));
+    exit(1);
+  }
+  // Vertices past first_vertex were rolled back
+  positions.resize(delta.first_vertex);
+  values.resize(delta.first_vertex);
+  uploaded_vertices = std::min(uploaded_vertices, delta.first_vertex);
+  positions.insert(positions.end(), delta.positions.begin(),
+                   delta.positions.end());
+  values.insert(values.end(), delta.values.begin(), delta.values.end());
+
+  for (unsigned i = 0; i < delta.removed.size(); ++i) {
+    std::unordered_map<unsigned, unsigned>::iterator s =
+      slot_of_simplex.find(delta.removed[i]);
+    if (s == slot_of_simplex.end())
+      continue;
+    slots[s->second].vertex[0] = free_slot;
+    free_slots.push_back(s->second);
+    slot_of_simplex.erase(s);
+  }
+
+  for (unsigned i = 0; i < delta.added.size(); ++i) {
+    unsigned slot;
+    if (free_slots.empty()) {
+      slot = slots.size();
+      slots.push_back(StrippedTetra());
+      addSlotToOrders(slot);
+    } else {
+      slot = free_slots.back();
+      free_slots.pop_back();
+    }
     for (int j = 0; j < 4; ++j)
-      indices[i].vertex[j] = ind[4 * i + j];
+      slots[slot].vertex[j] = delta.added_indices[4 * i + j];
+    slot_of_simplex[delta.added[i]] = slot;
   }
-  orbital = orb;
+
+  mesh_version = delta.version;
   primitives_changed = true;
 }
 
+void Cloud::loadMesh(const MappedMesh &mesh, unsigned version)
+{
+  clear();
+  const MeshFileHeader &header = mesh.header();
+  positions.resize(header.num_points);
+  values.resize(header.num_points);
+  for (unsigned p = 0; p < header.num_points; ++p) {
+    for (unsigned i = 0; i < 3; ++i)
+      positions[p][i] = mesh.points()[3 * p + i];
+    values[p] = std::complex<double>(mesh.values()[2 * p],
+                                     mesh.values()[2 * p + 1]);
+  }
+
+  slots.resize(header.num_tetrahedra);
+  for (unsigned t = 0; t < header.num_tetrahedra; ++t) {
+    for (int j = 0; j < 4; ++j)
+      slots[t].vertex[j] = mesh.indices()[4 * t + j];
+    slot_of_simplex[mesh.tetrahedronIndices()[t]] = t;
+    addSlotToOrders(t);
+  }
+
+  // The file has the vertices just as uploadVertices would make them
+  static_assert(sizeof(Varying) == sizeof(MeshVertex),
+                "MeshVertex must match Varying");
+  vertex_capacity = std::max(header.num_points, 4096u);
+  bindVertexBuffer();
+  cloudVAO->subBuffer(GL_ARRAY_BUFFER, 0, mesh.vertices(),
+                      sizeof(Varying) * header.num_points);
+  uploaded_vertices = header.num_points;
+  GetGLError();
+
+  mesh_version = version;
+}
+
+// Where the camera is relative to copy c of the mesh
+static Vector<4> mesh_camera_position(const Vector<4> &camera_position,
+                                      double position_scale, unsigned c)
+{
+  Vector<4> position = camera_position;
+  for (unsigned axis = 0; axis < 3; ++axis) {
+    position[axis] /= position_scale;
+    if (c & (1 << axis))
+      position[axis] = -position[axis];
+  }
+  return position;
+}
+
 void Cloud::depthSortClouds(const Vector<4> &camera_position)
 {
-  // Set up tetrahedra for depth sort
-  for (int i = 0; i < int(indices.size()); ++i) {
+  // Each tetrahedron's sort key is linear in the camera position, so
+  // find the linear form once, and apply it to where the camera is
+  // relative to each copy
+  std::vector<Vector<4> > key_form(slots.size());
+  for (int slot = 0; slot < int(slots.size()); ++slot) {
+    const StrippedTetra &tetra = slots[slot];
+    if (tetra.vertex[0] == free_slot)
+      continue;
     Matrix<4,4> vertexMatrix;
     for (int col = 0; col < 4; ++col) {
-      Vector<3> vert = positions[indices[i].vertex[col]];
+      Vector<3> vert = positions[tetra.vertex[col]];
       vertexMatrix(0, col) = vert[0];
       vertexMatrix(1, col) = vert[1];
       vertexMatrix(2, col) = vert[2];
@@ -124,44 +277,78 @@ void Cloud::depthSortClouds(const Vector<4> &camera_position)
     }
     Vector<4> vert_norm_sqr;
     for (int col = 0; col < 4; ++col)
-      vert_norm_sqr[col] = norm_squared(positions[indices[i].vertex[col]]);
-    indices[i].sort_key =
-      dot_product(vert_norm_sqr, inverse(vertexMatrix) * camera_position);
+      vert_norm_sqr[col] = norm_squared(positions[tetra.vertex[col]]);
+    key_form[slot] = transpose(inverse(vertexMatrix)) * vert_norm_sqr;
   }
 
-  std::sort(indices.begin(), indices.end());
+  for (unsigned c = 0; c < copies.size(); ++c) {
+    Vector<4> camera =
+      mesh_camera_position(camera_position, position_scale, c);
+    std::vector<Tetra> &order = copies[c].order;
+    for (unsigned i = 0; i < order.size(); ++i) {
+      unsigned slot = order[i].slot;
+      if (slots[slot].vertex[0] == free_slot)
+        order[i].sort_key = HUGE_VAL;
+      else
+        order[i].sort_key = dot_product(key_form[slot], camera);
+    }
+    std::sort(order.begin(), order.end());
+  }
 }
 
-void Cloud::uploadVertices()
+// A new, empty vertex buffer with room for vertex_capacity vertices
+void Cloud::bindVertexBuffer()
 {
-  // Vertex varying data
-  int num_points = positions.size();
-  std::vector<Varying> varyings(num_points);
-  for (int p = 0; p < num_points; ++p) {
-    varyings[p].pos = FVector<3>(positions[p]);
-    std::complex<double> density = (*orbital)(positions[p]);
-    varyings[p].rim = FVector3(density.real(), density.imag(),
-                               abs(density));
-  }
-
   cloudVAO->bind();
-  cloudVAO->buffer(GL_ARRAY_BUFFER, varyings);
+  cloudVAO->buffer(GL_ARRAY_BUFFER, NULL,
+                   vertex_capacity * sizeof(Varying), GL_DYNAMIC_DRAW);
   glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(varyings[0]),
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Varying),
                         reinterpret_cast<void *>(myoffsetof(Varying, pos)));
   glEnableVertexAttribArray(1);
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(varyings[0]),
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Varying),
                         reinterpret_cast<void *>(myoffsetof(Varying, rim)));
+}
+
+void Cloud::uploadVertices()
+{
+  unsigned num_points = positions.size();
+  if (num_points > vertex_capacity) {
+    // Grow geometrically, so that appending is amortized constant time,
+    // and upload everything again into the new buffer
+    vertex_capacity = std::max(std::max(2 * vertex_capacity, num_points),
+                               4096u);
+    uploaded_vertices = 0;
+    bindVertexBuffer();
+  }
+  if (uploaded_vertices == num_points)
+    return;
+
+  // Vertex varying data for the new vertices only
+  std::vector<Varying> varyings(num_points - uploaded_vertices);
+  for (unsigned p = uploaded_vertices; p < num_points; ++p) {
+    Varying &v = varyings[p - uploaded_vertices];
+    v.pos = FVector<3>(positions[p]);
+    v.rim = FVector3(values[p].real(), values[p].imag(), abs(values[p]));
+  }
+
+  cloudVAO->subBuffer(GL_ARRAY_BUFFER, uploaded_vertices * sizeof(Varying),
+                      varyings);
+  uploaded_vertices = num_points;
   GetGLError();
 }
 
 void Cloud::uploadPrimitives()
 {
-  int num_tetrahedra = indices.size();
+  // The depth sort has put the free slots last. The copies' orders go
+  // one after another.
+  int num_tetrahedra = numTetrahedra();
 
-  std::vector<StrippedTetra> upload_indices(num_tetrahedra);
-  for (int i = 0; i < num_tetrahedra; ++i)
-    upload_indices[i] = strip_sort_key(indices[i]);
+  std::vector<StrippedTetra> upload_indices(copies.size() * num_tetrahedra);
+  for (unsigned c = 0; c < copies.size(); ++c)
+    for (int i = 0; i < num_tetrahedra; ++i)
+      upload_indices[c * num_tetrahedra + i] =
+        slots[copies[c].order[i].slot];
 
   cloudVAO->bind();
   cloudVAO->buffer(GL_ELEMENT_ARRAY_BUFFER, upload_indices);
@@ -173,24 +360,24 @@ void Cloud::draw(const Matrix<4,4> &mvpm, int width, int height,
                  const Vector<4> &camera_position,
                  float brightness)
 {
-  int num_tetrahedra = indices.size();
+  int num_tetrahedra = numTetrahedra();
 
   if (primitives_changed) {
     uploadVertices();
   }
 
   // Don't do this until shaders support in-order rendering
-  depthSortClouds(camera_position);
-
-  if (primitives_changed || camera_position != old_camera_position) {
+  if (primitives_changed || needs_sort ||
+      camera_position != old_camera_position) {
+    depthSortClouds(camera_position);
     uploadPrimitives();
   }
 
   primitives_changed = false;
+  needs_sort = false;
   old_camera_position = camera_position;
 
   cloudProg->use();
-  cloudProg->uniform<Matrix<4,4> >("modelViewProjMatrix") = mvpm;
   cloudProg->uniform<Vector<2> >("nearfar") = Vector2(near, far);
   cloudProg->uniform<int>("solidDepth") = 0;
   cloudProg->uniform<float>("brightness") = brightness;
@@ -205,7 +392,34 @@ void Cloud::draw(const Matrix<4,4> &mvpm, int width, int height,
                       GL_ONE,       GL_ONE_MINUS_SRC_ALPHA);
   cloudVAO->bind();
   glViewport(0, 0, width, height);
-  glDrawElements(GL_LINES_ADJACENCY, 4 * num_tetrahedra, GL_UNSIGNED_INT, 0);
+
+  // The planes between the octants split space like a BSP tree: draw
+  // the half beyond the x = 0 plane first, and in each half, the half
+  // beyond y = 0 first, and so on. Bit i of far_bits is set if the
+  // octant is on the other side of plane i from the camera.
+  unsigned camera_octant = 0;
+  for (unsigned axis = 0; axis < 3; ++axis)
+    if (camera_position[axis] < 0.0)
+      camera_octant |= 1 << axis;
+  for (int k = 7; k >= 0; --k) {
+    unsigned far_bits = ((k >> 2) & 1) | (k & 2) | ((k & 1) << 2);
+    unsigned c = far_bits ^ camera_octant;
+    if (c >= copies.size())
+      continue;
+
+    Matrix<4,4> model = transformScale(position_scale);
+    for (unsigned axis = 0; axis < 3; ++axis)
+      if (c & (1 << axis))
+        model(axis, axis) = -model(axis, axis);
+    double sign = value_scale * copies[c].sign;
+    bool conj = conjugate != copies[c].conjugate;
+    cloudProg->uniform<Matrix<4,4> >("modelViewProjMatrix") = mvpm * model;
+    cloudProg->uniform<Vector<3> >("rimScale") =
+      Vector3(sign, conj ? -sign : sign, fabs(sign));
+    glDrawElements(GL_LINES_ADJACENCY, 4 * num_tetrahedra, GL_UNSIGNED_INT,
+                   reinterpret_cast<void *>(sizeof(StrippedTetra) *
+                                            c * num_tetrahedra));
+  }
 
   GetGLError();
 }
@@ -47,16 +47,50 @@
 #define CLOUD_HH
 
 #include "oopengl.hh"
+#include <complex>
+#include <unordered_map>
+
 #include "matrix.hh"
 #include "wavefunction.hh"
+#include "tetrahedralize.hh"
+#include "mesh_cache.hh"
 
 class Cloud
 {
 public:
   Cloud(Texture *solidDepthTex, Texture *cloudDensityTex);
-  void setPrimitives(const std::vector<Vector<3> > &positions,
-                     const std::vector<unsigned> &indices,
-                     const Orbital *orbital);
+  // Forget the mesh, to start again from version 0
+  void clear();
+  // Bring the mesh up to delta.version. The values are the orbital's
+  // values at the positions, as computed by the subdivision; nothing
+  // is evaluated here. New vertices are written over rolled back ones
+  // or appended to the vertex buffer, and new tetrahedra take the
+  // slots of removed ones, so the work here is in proportion to the
+  // changes.
+  void applyDelta(const MeshDelta &delta);
+  // Replace the mesh with a saved one, which is at the given version.
+  // The vertices go straight from the file to the GPU.
+  void loadMesh(const MappedMesh &mesh, unsigned version);
+  unsigned version() const { return mesh_version; }
+  unsigned numVertices() const { return positions.size(); }
+  unsigned numTetrahedra() const { return slots.size() - free_slots.size(); }
+  // The vertices and tetrahedra drawn, counting every reflected copy,
+  // but a vertex on a symmetry plane only once
+  unsigned numDrawnVertices() const;
+  unsigned numDrawnTetrahedra() const
+  {
+    return copies.size() * numTetrahedra();
+  }
+  // Draw the mesh scaled by position_scale about the origin, with its
+  // values multiplied by value_scale, and conjugated if asked; see
+  // Orbital::canonical
+  void setTransform(double position_scale, double value_scale,
+                    bool conjugate);
+  // Draw a mesh of the octant x, y, z >= 0 (see
+  // TetrahedralSubdivision::OCTANT) in all eight octants, reflected,
+  // with values changed as reflections[axis] says for each plane it's
+  // reflected in; or with NULL, just the mesh as it is
+  void setOctantSymmetry(const Orbital::Reflection *reflections);
   void draw(const Matrix<4,4> &mvpm, int width, int height,
             double near, double far,
             const Vector<4> &camera_position,
@@ -66,7 +100,7 @@ private:
   struct Tetra
   {
     double sort_key;
-    unsigned vertex[4];
+    unsigned slot;
     bool operator<(const struct Tetra &rhs) const
     {
       return sort_key < rhs.sort_key;
@@ -84,20 +118,44 @@ private:
     FVector<3> rim;
   };
 
+  void bindVertexBuffer();
   void uploadVertices();
   void uploadPrimitives();
-  StrippedTetra strip_sort_key(const Tetra &t);
   void depthSortClouds(const Vector<4> &camera_position);
+  void addSlotToOrders(unsigned slot);
 
   Program *cloudProg;
   Texture *solidDepthTex;
   GLuint cloudFBO;
   VertexArrayObject *cloudVAO;
   Vector<4> old_camera_position;
+  double position_scale;
+  double value_scale;
+  bool conjugate;
+  unsigned mesh_version;
   std::vector<Vector<3> > positions;
-  std::vector<Tetra> indices;
-  const Orbital *orbital;
+  std::vector<std::complex<double> > values;
+  // Vertices in the vertex buffer, and how many it has room for
+  unsigned uploaded_vertices, vertex_capacity;
+  // Tetrahedra by slot, with free slots marked by free_slot
+  std::vector<StrippedTetra> slots;
+  std::vector<unsigned> free_slots;
+  std::unordered_map<unsigned, unsigned> slot_of_simplex;
+  // The mesh is drawn once, or with octant symmetry, once in each
+  // octant: copy c is reflected in the planes normal to the axes whose
+  // bits are set in c, and has its own order
+  struct Copy
+  {
+    double sign;
+    bool conjugate;
+    // Every slot, back to front once sorted, with free slots last
+    std::vector<Tetra> order;
+  };
+  std::vector<Copy> copies;
   bool primitives_changed;
+  // Set when the mesh moves relative to the camera without the camera
+  // moving, as when position_scale changes
+  bool needs_sort;
 };
 
 #endif
@@ -46,6 +46,7 @@
 #version 150
 
 uniform mat4 modelViewProjMatrix;
+uniform vec3 rimScale;
 
 in vec4 position;
 in vec3 rim;
@@ -78,7 +79,7 @@ void calculate_position()
 // coordinates that are sensible to integrate.
 void calculate_color()
 {
-  integrand = rim;
+  integrand = rim * rimScale;
 }
 
 void main(void)
@@ -262,6 +262,9 @@ static void TW_CALL getCombo(void *data, void *)
 static int fps = 0;
 static int vertices = 0;
 static int tetrahedra = 0;
+static int cacheHits = 0;
+static int cacheMisses = 0;
+static int cacheMegabytes = 0;
 
 void initControls(Viewport &viewport)
 {
@@ -415,6 +418,22 @@ void initControls(Viewport &viewport)
              " group=`Rendering`"
              );
 
+  TwAddVarRO(graphics, "Cache hits", TW_TYPE_INT32, &cacheHits,
+             "help=`Orbitals shown from meshes kept in memory, or made"
+             " in advance`"
+             " group=`Mesh cache`"
+             );
+
+  TwAddVarRO(graphics, "Cache misses", TW_TYPE_INT32, &cacheMisses,
+             "help=`Orbitals whose meshes weren't in memory`"
+             " group=`Mesh cache`"
+             );
+
+  TwAddVarRO(graphics, "Cache memory (MB)", TW_TYPE_INT32, &cacheMegabytes,
+             "help=`Memory taken by the meshes kept`"
+             " group=`Mesh cache`"
+             );
+
   // GPU & driver info
 
   static const string gpu(reinterpret_cast<const char *>
@@ -471,6 +490,13 @@ void setVerticesTetrahedra(int v, int t)
   tetrahedra = t;
 }
 
+void setMeshCacheStats(int hits, int misses, int megabytes)
+{
+  cacheHits = hits;
+  cacheMisses = misses;
+  cacheMegabytes = megabytes;
+}
+
 Orbital getOrbital()
 {
   int m = basisReal ? absM : M;
@@ -478,6 +504,37 @@ Orbital getOrbital()
   return Orbital(Z, N, L, m, basisReal, comboDiff, orbital);
 }
 
+// The orbital like o but with these quantum numbers, each brought into
+// range given the ones before it, as changeN, changeL, changeM and
+// changeAbsM would
+static Orbital orbitalInRange(const Orbital &o, int n, int l, int m)
+{
+  n = max(minN, min(maxN, n));
+  l = max(minL, min(n - 1, l));
+  // A real orbital's M is |M|
+  m = max(o.real ? minAbsM : -l, min(l, m));
+  return Orbital(o.Z, n, l, m, o.real, o.diff, o.square);
+}
+
+vector<Orbital> getNeighboringOrbitals(const Orbital &current)
+{
+  vector<Orbital> neighbors;
+  for (int step = 0; step < 6; ++step) {
+    int delta = step % 2 == 0 ? 1 : -1;
+    int n = current.N, l = current.L, m = current.M;
+    if (step < 2)
+      n += delta;
+    else if (step < 4)
+      l += delta;
+    else
+      m += delta;
+    Orbital neighbor = orbitalInRange(current, n, l, m);
+    if (neighbor != current)
+      neighbors.push_back(neighbor);
+  }
+  return neighbors;
+}
+
 double getBrightness()
 {
   return brightness;
@@ -46,6 +46,7 @@
 #ifndef CONTROLS_HH
 #define CONTROLS_HH
 
+#include <vector>
 #include <SDL.h>
 
 #include "viewport.hh"
@@ -55,7 +56,11 @@ void initControls(Viewport &viewport);
 int handleControls(SDL_Event &event);
 void drawControls();
 void setVerticesTetrahedra(int vertices, int tetrahedra);
+void setMeshCacheStats(int hits, int misses, int megabytes);
 Orbital getOrbital();
+// The orbitals one step of N, L or M (|M| for real orbitals) away from
+// current, with the others brought into range as the controls would
+std::vector<Orbital> getNeighboringOrbitals(const Orbital &current);
 double getBrightness();
 int getDetail();
 bool getColorPhase();
@@ -216,25 +216,62 @@ inline unsigned Simplex<n>::connectAcrossFace(const Face<n> &face,
   return old_connection;
 }
 
-template <unsigned n>
+// An empty per-point payload, for triangulations that don't need one
+struct NoPayload {};
+
+// Each point carries a payload of type P, such as the value of a
+// function there. It is given when the point is added and never
+// changes afterwards.
+template <unsigned n, typename P = NoPayload>
 class Delaunay
 {
 public:
-  Delaunay() {} // needed for unit tests
-  Delaunay(const Array<n + 1, Vector<n> > &);
+  Delaunay() : max_simplex(0), keep_undo(false) {} // needed for unit tests
+  Delaunay(const Array<n + 1, Vector<n> > &,
+           const Array<n + 1, P> & = Array<n + 1, P>(P()));
+  // Rebuild a triangulation saved earlier, from its points and their
+  // payloads, and its simplices: their numbers, in increasing order,
+  // forming points and adjacencies. Only points added after this can
+  // be removed.
+  Delaunay(const std::vector<Vector<n> > &, const std::vector<P> &,
+           const std::vector<unsigned> &simplex_indices,
+           const std::vector<Array<n + 1, unsigned> > &forming_points,
+           const std::vector<Array<n + 1, unsigned> > &adjacencies,
+           unsigned max_simplex);
 
   unsigned numPoints() const;
   const Vector<n> &getPoint(unsigned) const;
+  const P &getPayload(unsigned) const;
   unsigned maxSimplex() const;
   bool hasSimplex(unsigned) const;
   const Simplex<n> &getSimplex(unsigned) const;
 
-  void inefficientAddPoint(const Vector<n> &);
-  void addPoint(const Vector<n> &, unsigned);
+  void inefficientAddPoint(const Vector<n> &, const P & = P());
+  void addPoint(const Vector<n> &, unsigned, const P & = P());
+  // The simplices addPoint would delete for a point, given one of them
+  std::set<unsigned> findDeletedSimplices(const Vector<n> &, unsigned) const;
+  // Undo the most recent addPoint that hasn't been undone, putting back
+  // the simplices it deleted under their old numbers. This takes time
+  // in proportion to the simplices involved. Only points added while
+  // keepUndo is on can be removed.
+  void removeLastPoint();
+  // Keep what removeLastPoint needs for each point added from now on:
+  // every simplex its addition deletes, which about doubles the memory
+  // taken. Off by default; turning it off forgets what was kept.
+  void keepUndo(bool enabled);
+  // The simplices that the most recent addPoint or removeLastPoint
+  // deleted
+  const std::vector<Simplex<n> > &lastDeletedSimplices() const;
+  // And their simplex numbers, in the same order
+  const std::vector<unsigned> &lastDeletedSimplexIndices() const;
+  // The numbers of the simplices it added
+  const std::vector<unsigned> &lastAddedSimplexIndices() const;
+  // Roughly the bytes allocated, counting each map node as its value
+  // and four pointers
+  size_t memoryUsage() const;
 
 private:
   unsigned findOneDeletedSimplex(const Vector<n> &) const;
-  std::set<unsigned> findDeletedSimplices(const Vector<n> &, unsigned) const;
   typedef std::map<Face<n>, unsigned> Hole;
   Hole deleteSimplices(const std::set<unsigned> &);
   void deleteSimplex(Hole &, unsigned);
@@ -242,15 +279,34 @@ private:
   void addSimplex(Hole &, Simplex<n> &);
 
   std::vector<Vector<n> > points;
+  std::vector<P> payloads;
   unsigned max_simplex;
   std::map<unsigned, Simplex<n> > simplex_map;
+  std::vector<Simplex<n> > last_deleted;
+  std::vector<unsigned> last_deleted_indices;
+  std::vector<unsigned> last_added_indices;
+  // For removeLastPoint: every simplex deleted by addPoint, with its
+  // number, and for each point added, where its deletions start and
+  // what max_simplex was before
+  std::vector<Simplex<n> > undo_simplices;
+  std::vector<unsigned> undo_indices;
+  struct UndoMark
+  {
+    unsigned simplices;
+    unsigned max_simplex;
+  };
+  std::vector<UndoMark> undo_marks;
+  bool keep_undo;
 };
 
-template <unsigned n>
-inline Delaunay<n>::Delaunay(const Array<n + 1, Vector<n> > &vs)
+template <unsigned n, typename P>
+inline Delaunay<n, P>::Delaunay(const Array<n + 1, Vector<n> > &vs,
+                                const Array<n + 1, P> &ps)
   : points(vs.toVector()),
+    payloads(ps.toVector()),
     max_simplex(1),
-    simplex_map()
+    simplex_map(),
+    keep_undo(false)
 {
   Array<n + 1, unsigned> ind;
   for (unsigned i = 0; i < n + 1; ++i)
@@ -258,34 +314,76 @@ inline Delaunay<n>::Delaunay(const Array<n + 1, Vector<n> > &vs)
   simplex_map = singleton<unsigned, Simplex<n> >(1, Simplex<n>(points, ind));
 }
 
-template <unsigned n>
-inline unsigned Delaunay<n>::numPoints() const
+template <unsigned n, typename P>
+inline Delaunay<n, P>::Delaunay(
+  const std::vector<Vector<n> > &points_,
+  const std::vector<P> &payloads_,
+  const std::vector<unsigned> &simplex_indices,
+  const std::vector<Array<n + 1, unsigned> > &forming_points,
+  const std::vector<Array<n + 1, unsigned> > &adjacencies,
+  unsigned max_simplex_)
+  : points(points_),
+    payloads(payloads_),
+    max_simplex(max_simplex_),
+    simplex_map(),
+    keep_undo(false)
+{
+  if (payloads.size() != points.size() ||
+      forming_points.size() != simplex_indices.size() ||
+      adjacencies.size() != simplex_indices.size())
+    throw std::logic_error("Delaunay: saved triangulation doesn't add up");
+  for (unsigned i = 0; i < simplex_indices.size(); ++i) {
+    if (simplex_indices[i] > max_simplex ||
+        (i > 0 && simplex_indices[i] <= simplex_indices[i - 1]))
+      throw std::logic_error("Delaunay: saved simplices out of order");
+    for (unsigned j = 0; j < n + 1; ++j)
+      if (forming_points[i][j] >= points.size())
+        throw std::logic_error("Delaunay: saved simplex has no point");
+    Simplex<n> s(points, forming_points[i]);
+    for (unsigned j = 0; j < n + 1; ++j)
+      s.adjacency(j) = adjacencies[i][j];
+    // In increasing order, each goes at the end
+    simplex_map.insert(simplex_map.end(),
+                       std::make_pair(simplex_indices[i], s));
+  }
+}
+
+template <unsigned n, typename P>
+inline unsigned Delaunay<n, P>::numPoints() const
 {
   return points.size();
 }
 
-template <unsigned n>
-inline const Vector<n> &Delaunay<n>::getPoint(unsigned i) const
+template <unsigned n, typename P>
+inline const Vector<n> &Delaunay<n, P>::getPoint(unsigned i) const
 {
   if (i >= points.size())
     throw std::range_error("Tried to get an out-of-range point");
   return points[i];
 }
 
-template <unsigned n>
-inline unsigned Delaunay<n>::maxSimplex() const
+template <unsigned n, typename P>
+inline const P &Delaunay<n, P>::getPayload(unsigned i) const
+{
+  if (i >= payloads.size())
+    throw std::range_error("Tried to get an out-of-range payload");
+  return payloads[i];
+}
+
+template <unsigned n, typename P>
+inline unsigned Delaunay<n, P>::maxSimplex() const
 {
   return max_simplex;
 }
 
-template <unsigned n>
-inline bool Delaunay<n>::hasSimplex(unsigned i) const
+template <unsigned n, typename P>
+inline bool Delaunay<n, P>::hasSimplex(unsigned i) const
 {
   return simplex_map.find(i) != simplex_map.end();
 }
 
-template <unsigned n>
-inline const Simplex<n> &Delaunay<n>::getSimplex(unsigned i) const
+template <unsigned n, typename P>
+inline const Simplex<n> &Delaunay<n, P>::getSimplex(unsigned i) const
 {
   typename std::map<unsigned, Simplex<n> >::const_iterator s;
   s = simplex_map.find(i);
@@ -294,14 +392,16 @@ inline const Simplex<n> &Delaunay<n>::getSimplex(unsigned i) const
   return s->second;
 }
 
-template <unsigned n>
-inline void Delaunay<n>::inefficientAddPoint(const Vector<n> &v)
+template <unsigned n, typename P>
+inline void Delaunay<n, P>::inefficientAddPoint(const Vector<n> &v,
+                                                const P &payload)
 {
-  addPoint(v, findOneDeletedSimplex(v));
+  addPoint(v, findOneDeletedSimplex(v), payload);
 }
 
-template <unsigned n>
-inline unsigned Delaunay<n>::findOneDeletedSimplex(const Vector<n> &v) const
+template <unsigned n, typename P>
+inline unsigned
+Delaunay<n, P>::findOneDeletedSimplex(const Vector<n> &v) const
 {
   for (unsigned i = 0; i <= max_simplex; ++i)
     if (hasSimplex(i) && getSimplex(i).isInsideCircumsphere(v))
@@ -310,12 +410,21 @@ inline unsigned Delaunay<n>::findOneDeletedSimplex(const Vector<n> &v) const
   throw std::logic_error("Couldn\'t find a simplex circumscribing the point");
 }
 
-template <unsigned n>
-inline void Delaunay<n>::addPoint(const Vector<n> &new_point,
-                                  unsigned in_simplex)
+template <unsigned n, typename P>
+inline void Delaunay<n, P>::addPoint(const Vector<n> &new_point,
+                                     unsigned in_simplex,
+                                     const P &payload)
 {
   unsigned new_point_index = points.size();
   points.push_back(new_point);
+  payloads.push_back(payload);
+  last_deleted.clear();
+  last_deleted_indices.clear();
+  last_added_indices.clear();
+  if (keep_undo) {
+    UndoMark mark = { unsigned(undo_simplices.size()), max_simplex };
+    undo_marks.push_back(mark);
+  }
 
   // Find all simplices whose circumspheres enclose the new point
   std::set<unsigned> deleted_set = findDeletedSimplices(new_point, in_simplex);
@@ -327,9 +436,105 @@ inline void Delaunay<n>::addPoint(const Vector<n> &new_point,
   addSimplices(new_point_index, hole);
 }
 
-template <unsigned n>
+template <unsigned n, typename P>
+inline const std::vector<Simplex<n> > &
+Delaunay<n, P>::lastDeletedSimplices() const
+{
+  return last_deleted;
+}
+
+template <unsigned n, typename P>
+inline const std::vector<unsigned> &
+Delaunay<n, P>::lastDeletedSimplexIndices() const
+{
+  return last_deleted_indices;
+}
+
+template <unsigned n, typename P>
+inline const std::vector<unsigned> &
+Delaunay<n, P>::lastAddedSimplexIndices() const
+{
+  return last_added_indices;
+}
+
+template <unsigned n, typename P>
+inline size_t Delaunay<n, P>::memoryUsage() const
+{
+  typedef typename std::map<unsigned, Simplex<n> >::value_type Node;
+  return points.capacity() * sizeof(Vector<n>) +
+    payloads.capacity() * sizeof(P) +
+    simplex_map.size() * (sizeof(Node) + 4 * sizeof(void *)) +
+    last_deleted.capacity() * sizeof(Simplex<n>) +
+    (last_deleted_indices.capacity() + last_added_indices.capacity() +
+     undo_indices.capacity()) * sizeof(unsigned) +
+    undo_simplices.capacity() * sizeof(Simplex<n>) +
+    undo_marks.capacity() * sizeof(UndoMark);
+}
+
+template <unsigned n, typename P>
+inline void Delaunay<n, P>::keepUndo(bool enabled)
+{
+  keep_undo = enabled;
+  if (!enabled) {
+    std::vector<Simplex<n> >().swap(undo_simplices);
+    std::vector<unsigned>().swap(undo_indices);
+    std::vector<UndoMark>().swap(undo_marks);
+  }
+}
+
+template <unsigned n, typename P>
+inline void Delaunay<n, P>::removeLastPoint()
+{
+  if (undo_marks.empty())
+    throw std::logic_error("removeLastPoint: no added point to remove");
+  UndoMark mark = undo_marks.back();
+  undo_marks.pop_back();
+  last_deleted.clear();
+  last_deleted_indices.clear();
+  last_added_indices.clear();
+
+  // Every later point has been removed already, so the simplices the
+  // point made are exactly those numbered after mark.max_simplex
+  for (unsigned s = mark.max_simplex + 1; s <= max_simplex; ++s) {
+    typename std::map<unsigned, Simplex<n> >::iterator i =
+      simplex_map.find(s);
+    if (i == simplex_map.end())
+      throw std::logic_error("removeLastPoint: a new simplex is missing");
+    last_deleted.push_back(i->second);
+    last_deleted_indices.push_back(s);
+    simplex_map.erase(i);
+  }
+
+  // Put back the simplices it deleted. Their neighbours, restored or
+  // not, are as they were when the point was added, so connecting
+  // every neighbour back across the shared face mends the hole.
+  for (unsigned k = mark.simplices; k < undo_simplices.size(); ++k) {
+    simplex_map[undo_indices[k]] = undo_simplices[k];
+    last_added_indices.push_back(undo_indices[k]);
+  }
+  for (unsigned k = mark.simplices; k < undo_simplices.size(); ++k) {
+    const Simplex<n> &restored = undo_simplices[k];
+    Array<n + 1, Face<n> > faces = restored.faces();
+    for (unsigned j = 0; j < n + 1; ++j) {
+      unsigned a = restored.adjacency(j);
+      if (!a)
+        continue;
+      if (!hasSimplex(a))
+        throw std::logic_error("removeLastPoint: a neighbour is missing");
+      simplex_map[a].connectAcrossFace(faces[j], undo_indices[k]);
+    }
+  }
+
+  undo_simplices.resize(mark.simplices);
+  undo_indices.resize(mark.simplices);
+  max_simplex = mark.max_simplex;
+  points.pop_back();
+  payloads.pop_back();
+}
+
+template <unsigned n, typename P>
 inline std::set<unsigned>
-Delaunay<n>::findDeletedSimplices(const Vector<n> &v, unsigned start) const
+Delaunay<n, P>::findDeletedSimplices(const Vector<n> &v, unsigned start) const
 {
   std::set<unsigned> deleted_set;
   std::vector<unsigned> frontier;
@@ -356,9 +561,9 @@ Delaunay<n>::findDeletedSimplices(const Vector<n> &v, unsigned start) const
   return deleted_set;
 }
 
-template <unsigned n>
-inline typename Delaunay<n>::Hole
-Delaunay<n>::deleteSimplices(const std::set<unsigned> &deleted_set)
+template <unsigned n, typename P>
+inline typename Delaunay<n, P>::Hole
+Delaunay<n, P>::deleteSimplices(const std::set<unsigned> &deleted_set)
 {
   Hole hole;
   for (std::set<unsigned>::iterator i = deleted_set.begin();
@@ -367,8 +572,9 @@ Delaunay<n>::deleteSimplices(const std::set<unsigned> &deleted_set)
   return hole;
 }
 
-template <unsigned n>
-inline void Delaunay<n>::deleteSimplex(Hole &hole, unsigned delete_me_index)
+template <unsigned n, typename P>
+inline void Delaunay<n, P>::deleteSimplex(Hole &hole,
+                                          unsigned delete_me_index)
 {
   const Simplex<n> &delete_me = getSimplex(delete_me_index);
   Array<n + 1, Face<n> > faces = delete_me.faces();
@@ -378,11 +584,17 @@ inline void Delaunay<n>::deleteSimplex(Hole &hole, unsigned delete_me_index)
     else
       hole.erase(faces[j]);
 
+  last_deleted.push_back(delete_me);
+  last_deleted_indices.push_back(delete_me_index);
+  if (keep_undo) {
+    undo_simplices.push_back(delete_me);
+    undo_indices.push_back(delete_me_index);
+  }
   simplex_map.erase(delete_me_index);
 }
 
-template <unsigned n>
-inline void Delaunay<n>::addSimplices(unsigned new_point_index, Hole &hole)
+template <unsigned n, typename P>
+inline void Delaunay<n, P>::addSimplices(unsigned new_point_index, Hole &hole)
 {
   std::vector<Simplex<n> > simplex_list;
   bool success = false;
@@ -414,11 +626,12 @@ inline void Delaunay<n>::addSimplices(unsigned new_point_index, Hole &hole)
     throw std::logic_error("Combinatorial error in adding new simplices");
 }
 
-template <unsigned n>
-inline void Delaunay<n>::addSimplex(Hole &hole,
-                                    Simplex<n> &new_simplex)
+template <unsigned n, typename P>
+inline void Delaunay<n, P>::addSimplex(Hole &hole,
+                                       Simplex<n> &new_simplex)
 {
   unsigned new_simplex_index = ++max_simplex;
+  last_added_indices.push_back(new_simplex_index);
   Array<n + 1, Face<n> > faces = new_simplex.faces();
   for (unsigned j = 0; j < n + 1; ++j) {
     typename Hole::const_iterator find_face = hole.find(faces[j]);
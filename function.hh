@@ -46,16 +46,73 @@
 #ifndef FUNCTION_HH
 #define FUNCTION_HH
 
+#include <cstddef>
+#include <complex>
+#include <vector>
+
 #include "matrix.hh"
 
+// The single precision counterpart of a value type
+template <typename T> struct SinglePrecision;
+template <> struct SinglePrecision<double> { typedef float type; };
+template <> struct SinglePrecision<std::complex<double> >
+{
+  typedef std::complex<float> type;
+};
+
 template <unsigned n, typename T>
 class Function
 {
 public:
+  typedef typename SinglePrecision<T>::type SingleT;
+
   virtual T operator()(const Vector<n> &) const = 0;
+  // Evaluate at count points, given as n separate coordinate arrays:
+  // point k is (coords[0][k], ..., coords[n-1][k]). The default just
+  // calls operator() once per point; subclasses that can do better in
+  // bulk should override it.
+  virtual void evaluate(const double *const coords[n], size_t count,
+                        T *values) const;
+  // The same in single precision, for callers that can tolerate it.
+  // The default widens the coordinates and narrows the results of the
+  // double precision version, so it's only worth calling when a
+  // subclass overrides it.
+  virtual void evaluate(const float *const coords[n], size_t count,
+                        SingleT *values) const;
   virtual ~Function() {}
 };
 
+template <unsigned n, typename T>
+inline void Function<n,T>::evaluate(const double *const coords[n],
+                                    size_t count, T *values) const
+{
+  const Function<n,T> &f = *this;
+  Vector<n> x;
+
+  for (size_t k = 0; k < count; ++k) {
+    for (unsigned i = 0; i < n; ++i)
+      x[i] = coords[i][k];
+    values[k] = f(x);
+  }
+}
+
+template <unsigned n, typename T>
+inline void Function<n,T>::evaluate(const float *const coords[n],
+                                    size_t count, SingleT *values) const
+{
+  std::vector<double> wide(n * count);
+  const double *wide_coords[n];
+  for (unsigned i = 0; i < n; ++i) {
+    for (size_t k = 0; k < count; ++k)
+      wide[i * count + k] = coords[i][k];
+    wide_coords[i] = &wide[i * count];
+  }
+  std::vector<T> wide_values(count);
+  evaluate(wide_coords, count, count ? &wide_values[0] : NULL);
+  for (size_t k = 0; k < count; ++k)
+    values[k] = SingleT(wide_values[k]);
+}
+
 
 // There isn't any mathematical problem with computing numerical
 // gradients and hessians of a T-valued function; the problem is
@@ -0,0 +1,206 @@
+/*
+ * This file is part of the Electron Orbital Explorer. The Electron
+ * Orbital Explorer is distributed under the Simplified BSD License
+ * (also called the "BSD 2-Clause License"), in hopes that these
+ * rendering techniques might be used by other programmers in
+ * applications such as scientific visualization, video gaming, and so
+ * on. If you find value in this software and use its technologies for
+ * another purpose, I would love to hear back from you at bjthinks (at)
+ * gmail (dot) com. If you improve this software and agree to release
+ * your modifications under the below license, I encourage you to fork
+ * the development tree on github and push your modifications. The
+ * Electron Orbital Explorer's development URL is:
+ * https://github.com/bjthinks/orbital-explorer
+ * (This paragraph is not part of the software license and may be
+ * removed.)
+ *
+ * Copyright (c) 2013, Brian W. Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * + Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * + Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INDEXED_HEAP_HH
+#define INDEXED_HEAP_HH
+
+#include <stdexcept>
+#include <vector>
+
+// A maximum priority queue of items, each with a distinct id, that can
+// also remove an item by its id. Ids index an array, so they should be
+// reasonably dense, like the simplex numbers of a Delaunay
+// triangulation. Items are compared with operator<. It is a 4-ary
+// heap: shallower than a binary heap, and a node's children share a
+// cache line or two.
+template <typename T>
+class IndexedHeap
+{
+public:
+  IndexedHeap() {}
+
+  bool empty() const { return heap.empty(); }
+  unsigned size() const { return heap.size(); }
+  bool contains(unsigned id) const
+  {
+    return id < position.size() && position[id] != absent;
+  }
+  const T &top() const;
+  unsigned topId() const;
+  // The item with this id, which must be there
+  const T &get(unsigned id) const;
+  // Every item, in no particular order, for i < size()
+  const T &item(unsigned i) const { return heap[i].item; }
+  // Bytes allocated
+  size_t memoryUsage() const
+  {
+    return heap.capacity() * sizeof(Node) +
+      position.capacity() * sizeof(unsigned);
+  }
+
+  void push(unsigned id, const T &item);
+  void pop();
+  // Remove the item with this id, if there is one
+  void remove(unsigned id);
+
+private:
+  enum { arity = 4, absent = ~0u };
+  struct Node
+  {
+    Node(unsigned id_, const T &item_) : id(id_), item(item_) {}
+    unsigned id;
+    T item;
+  };
+  void place(unsigned i, const Node &node);
+  // By value, since the node may be one of those being moved
+  void siftUp(unsigned i, Node node);
+  void siftDown(unsigned i, Node node);
+
+  std::vector<Node> heap;
+  // Where each id is in heap, or absent
+  std::vector<unsigned> position;
+};
+
+template <typename T>
+inline const T &IndexedHeap<T>::top() const
+{
+  if (heap.empty())
+    throw std::logic_error("top() called on an empty IndexedHeap");
+  return heap[0].item;
+}
+
+template <typename T>
+inline unsigned IndexedHeap<T>::topId() const
+{
+  if (heap.empty())
+    throw std::logic_error("topId() called on an empty IndexedHeap");
+  return heap[0].id;
+}
+
+template <typename T>
+inline const T &IndexedHeap<T>::get(unsigned id) const
+{
+  if (!contains(id))
+    throw std::logic_error("get() called for an id not in the IndexedHeap");
+  return heap[position[id]].item;
+}
+
+template <typename T>
+inline void IndexedHeap<T>::place(unsigned i, const Node &node)
+{
+  heap[i] = node;
+  position[node.id] = i;
+}
+
+template <typename T>
+inline void IndexedHeap<T>::siftUp(unsigned i, Node node)
+{
+  while (i > 0) {
+    unsigned parent = (i - 1) / arity;
+    if (!(heap[parent].item < node.item))
+      break;
+    place(i, heap[parent]);
+    i = parent;
+  }
+  place(i, node);
+}
+
+template <typename T>
+inline void IndexedHeap<T>::siftDown(unsigned i, Node node)
+{
+  unsigned n = heap.size();
+  for (;;) {
+    unsigned first = arity * i + 1;
+    if (first >= n)
+      break;
+    unsigned last = first + arity < n ? first + arity : n;
+    unsigned largest = first;
+    for (unsigned c = first + 1; c < last; ++c)
+      if (heap[largest].item < heap[c].item)
+        largest = c;
+    if (!(node.item < heap[largest].item))
+      break;
+    place(i, heap[largest]);
+    i = largest;
+  }
+  place(i, node);
+}
+
+template <typename T>
+inline void IndexedHeap<T>::push(unsigned id, const T &item)
+{
+  if (contains(id))
+    throw std::logic_error("IndexedHeap: pushed an id twice");
+  if (id >= position.size())
+    position.resize(id + 1, absent);
+  heap.push_back(Node(id, item));
+  siftUp(heap.size() - 1, heap.back());
+}
+
+template <typename T>
+inline void IndexedHeap<T>::pop()
+{
+  remove(topId());
+}
+
+template <typename T>
+inline void IndexedHeap<T>::remove(unsigned id)
+{
+  if (!contains(id))
+    return;
+  unsigned i = position[id];
+  position[id] = absent;
+  Node last = heap.back();
+  heap.pop_back();
+  if (i == heap.size())
+    return;
+  // The last item fills the hole, and moves whichever way it must
+  if (i > 0 && heap[(i - 1) / arity].item < last.item)
+    siftUp(i, last);
+  else
+    siftDown(i, last);
+}
+
+#endif
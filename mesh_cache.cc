@@ -0,0 +1,461 @@
+/*
+ * This file is part of the Electron Orbital Explorer. The Electron
+ * Orbital Explorer is distributed under the Simplified BSD License
+ * (also called the "BSD 2-Clause License"), in hopes that these
+ * rendering techniques might be used by other programmers in
+ * applications such as scientific visualization, video gaming, and so
+ * on. If you find value in this software and use its technologies for
+ * another purpose, I would love to hear back from you at bjthinks (at)
+ * gmail (dot) com. If you improve this software and agree to release
+ * your modifications under the below license, I encourage you to fork
+ * the development tree on github and push your modifications. The
+ * Electron Orbital Explorer's development URL is:
+ * https://github.com/bjthinks/orbital-explorer
+ * (This paragraph is not part of the software license and may be
+ * removed.)
+ *
+ * Copyright (c) 2013, Brian W. Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * + Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * + Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "wavefunction.hh"
+#include "tetrahedralize.hh"
+#include "mesh_cache.hh"
+
+using namespace std;
+
+static const char mesh_magic[8] = { 'E', 'O', 'E', 'M', 'E', 'S', 'H', 0 };
+static const uint32_t mesh_format_version = 2;
+// Parts start on boundaries of this many bytes, which is a multiple of
+// the page size on every machine we know of
+static const uint64_t page = 4096;
+
+MeshCacheKey::MeshCacheKey(const Orbital &orbital, int detail_,
+                           unsigned estimator_, unsigned domain_)
+  : Z(orbital.Z), N(orbital.N), L(orbital.L), M(orbital.M),
+    real(orbital.real), diff(orbital.diff), square(orbital.square),
+    detail(detail_), estimator(estimator_), domain(domain_),
+    algorithm_version(TetrahedralSubdivision::algorithm_version)
+{
+}
+
+bool MeshCacheKey::operator==(const MeshCacheKey &rhs) const
+{
+  return Z == rhs.Z && N == rhs.N && L == rhs.L && M == rhs.M &&
+    real == rhs.real && diff == rhs.diff && square == rhs.square &&
+    detail == rhs.detail && estimator == rhs.estimator &&
+    domain == rhs.domain && algorithm_version == rhs.algorithm_version;
+}
+
+string MeshCacheKey::fileName() const
+{
+  ostringstream name;
+  name << "mesh-" << Z << "-" << N << "-" << L << "-" << M << "-"
+       << real << diff << square << "-" << detail << "-" << estimator
+       << "-" << domain << "v" << algorithm_version << ".bin";
+  return name.str();
+}
+
+static uint64_t round_up_to_page(uint64_t x)
+{
+  return (x + page - 1) / page * page;
+}
+
+// Whether simplex s is among the n in simplices, which are in
+// increasing order
+static bool has_simplex(const MeshSimplex *simplices, uint32_t n,
+                        uint32_t s)
+{
+  uint32_t low = 0, high = n;
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    if (simplices[mid].index < s)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low < n && simplices[low].index == s;
+}
+
+// Whether every index in the parts of a mesh file is of something in
+// it, so that a damaged file is a miss rather than a crash
+static bool indices_valid(const char *base, const MeshFileHeader &h)
+{
+  const uint32_t *indices =
+    reinterpret_cast<const uint32_t *>(base + h.offset[1]);
+  for (uint64_t i = 0; i < 4 * uint64_t(h.num_tetrahedra); ++i)
+    if (indices[i] >= h.num_points)
+      return false;
+
+  const MeshSimplex *simplices =
+    reinterpret_cast<const MeshSimplex *>(base + h.offset[5]);
+  for (uint32_t s = 0; s < h.num_simplices; ++s) {
+    const MeshSimplex &simplex = simplices[s];
+    if (simplex.index == 0 || simplex.index > h.max_simplex ||
+        (s > 0 && simplex.index <= simplices[s - 1].index))
+      return false;
+    for (unsigned i = 0; i < 4; ++i)
+      if (simplex.forming_point[i] >= h.num_points)
+        return false;
+  }
+  // 0 is no neighbour
+  for (uint32_t s = 0; s < h.num_simplices; ++s)
+    for (unsigned i = 0; i < 4; ++i) {
+      uint32_t a = simplices[s].adjacency[i];
+      if (a != 0 && !has_simplex(simplices, h.num_simplices, a))
+        return false;
+    }
+
+  const uint32_t *tetrahedron_indices =
+    reinterpret_cast<const uint32_t *>(base + h.offset[2]);
+  for (uint32_t t = 0; t < h.num_tetrahedra; ++t)
+    if (!has_simplex(simplices, h.num_simplices, tetrahedron_indices[t]))
+      return false;
+
+  const MeshHeapItem *heap =
+    reinterpret_cast<const MeshHeapItem *>(base + h.offset[6]);
+  vector<uint32_t> heap_tetrahedra(h.num_heap_items);
+  for (uint32_t i = 0; i < h.num_heap_items; ++i) {
+    if (!has_simplex(simplices, h.num_simplices, heap[i].tetra))
+      return false;
+    heap_tetrahedra[i] = heap[i].tetra;
+  }
+  // The heap can hold each tetrahedron only once
+  sort(heap_tetrahedra.begin(), heap_tetrahedra.end());
+  return adjacent_find(heap_tetrahedra.begin(), heap_tetrahedra.end()) ==
+    heap_tetrahedra.end();
+}
+
+MappedMesh::MappedMesh(const string &path, const MeshCacheKey &key)
+  : data(MAP_FAILED), size(0), header_(NULL)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size >= off_t(sizeof(MeshFileHeader))) {
+    size = st.st_size;
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED)
+    return;
+
+  // Check everything the accessors rely on
+  const MeshFileHeader *h = static_cast<const MeshFileHeader *>(data);
+  if (memcmp(h->magic, mesh_magic, sizeof(mesh_magic)) != 0 ||
+      h->format_version != mesh_format_version || !(h->key == key) ||
+      h->file_size != size)
+    return;
+  const uint64_t part_size[MeshFileHeader::NUM_PARTS] = {
+    sizeof(MeshVertex) * uint64_t(h->num_points),
+    sizeof(uint32_t) * 4 * uint64_t(h->num_tetrahedra),
+    sizeof(uint32_t) * uint64_t(h->num_tetrahedra),
+    sizeof(double) * 3 * uint64_t(h->num_points),
+    sizeof(double) * 2 * uint64_t(h->num_points),
+    sizeof(MeshSimplex) * uint64_t(h->num_simplices),
+    sizeof(MeshHeapItem) * uint64_t(h->num_heap_items)
+  };
+  for (unsigned i = 0; i < MeshFileHeader::NUM_PARTS; ++i)
+    if (h->offset[i] % page != 0 || h->offset[i] > size ||
+        part_size[i] > size - h->offset[i])
+      return;
+  if (!indices_valid(static_cast<const char *>(data), *h))
+    return;
+  header_ = h;
+}
+
+MappedMesh::~MappedMesh()
+{
+  if (data != MAP_FAILED)
+    munmap(data, size);
+}
+
+const void *MappedMesh::part(unsigned i) const
+{
+  return static_cast<const char *>(data) + header_->offset[i];
+}
+
+const MeshVertex *MappedMesh::vertices() const
+{
+  return static_cast<const MeshVertex *>(part(0));
+}
+
+const uint32_t *MappedMesh::indices() const
+{
+  return static_cast<const uint32_t *>(part(1));
+}
+
+const uint32_t *MappedMesh::tetrahedronIndices() const
+{
+  return static_cast<const uint32_t *>(part(2));
+}
+
+const double *MappedMesh::points() const
+{
+  return static_cast<const double *>(part(3));
+}
+
+const double *MappedMesh::values() const
+{
+  return static_cast<const double *>(part(4));
+}
+
+const MeshSimplex *MappedMesh::simplices() const
+{
+  return static_cast<const MeshSimplex *>(part(5));
+}
+
+const MeshHeapItem *MappedMesh::heap() const
+{
+  return static_cast<const MeshHeapItem *>(part(6));
+}
+
+MeshCache::MeshCache(const string &directory_, uint64_t max_bytes_)
+  : directory(directory_), max_bytes(max_bytes_)
+{
+  if (directory.empty())
+    return;
+  // Make each missing directory on the way
+  for (size_t slash = directory.find('/', 1); ;
+       slash = directory.find('/', slash + 1)) {
+    string d = directory.substr(0, slash);
+    if (mkdir(d.c_str(), 0755) != 0 && errno != EEXIST) {
+      fprintf(stderr, "Can't make mesh cache directory %s\n", d.c_str());
+      directory.clear();
+      return;
+    }
+    if (slash == string::npos)
+      break;
+  }
+}
+
+string MeshCache::defaultDirectory()
+{
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  if (xdg && xdg[0] == '/')
+    return string(xdg) + "/orbital-explorer";
+  const char *home = getenv("HOME");
+  if (home && home[0] == '/')
+    return string(home) + "/.cache/orbital-explorer";
+  return "";
+}
+
+MappedMesh *MeshCache::load(const MeshCacheKey &key) const
+{
+  if (directory.empty())
+    return NULL;
+  string path = directory + "/" + key.fileName();
+  MappedMesh *mesh = new MappedMesh(path, key);
+  if (!mesh->valid()) {
+    delete mesh;
+    return NULL;
+  }
+  // Its modification time says when it was last used; see evict
+  utimes(path.c_str(), NULL);
+  return mesh;
+}
+
+void MeshCache::remove(const MeshCacheKey &key) const
+{
+  if (!directory.empty())
+    unlink((directory + "/" + key.fileName()).c_str());
+}
+
+bool MeshCache::has(const MeshCacheKey &key) const
+{
+  MappedMesh *mesh = load(key);
+  delete mesh;
+  return mesh != NULL;
+}
+
+bool MeshCache::save(const MeshCacheKey &key, TetrahedralSubdivision &ts,
+                     const atomic<bool> *cancel) const
+{
+  if (directory.empty())
+    return false;
+  MeshFileContents contents;
+  ts.saveState(contents);
+  return save(key, contents, cancel);
+}
+
+// Write size bytes, then zeros up to the next page boundary
+static bool write_part(FILE *file, const void *data, uint64_t size)
+{
+  static const char zeros[page] = { 0 };
+  if (size > 0 && fwrite(data, size, 1, file) != 1)
+    return false;
+  uint64_t padding = round_up_to_page(size) - size;
+  return padding == 0 || fwrite(zeros, padding, 1, file) == 1;
+}
+
+template <typename T>
+static bool write_part(FILE *file, const vector<T> &part)
+{
+  return write_part(file, part.empty() ? NULL : &part[0],
+                    sizeof(T) * part.size());
+}
+
+static bool cancelled(const atomic<bool> *cancel)
+{
+  return cancel && *cancel;
+}
+
+bool MeshCache::save(const MeshCacheKey &key,
+                     const MeshFileContents &contents,
+                     const atomic<bool> *cancel) const
+{
+  if (directory.empty())
+    return false;
+
+  // Zeroed, padding and all
+  MeshFileHeader h = MeshFileHeader();
+  memcpy(h.magic, mesh_magic, sizeof(mesh_magic));
+  h.format_version = mesh_format_version;
+  h.key = key;
+  h.num_points = contents.vertices.size();
+  h.num_tetrahedra = contents.tetrahedron_indices.size();
+  h.num_simplices = contents.simplices.size();
+  h.max_simplex = contents.max_simplex;
+  h.num_heap_items = contents.heap.size();
+  const uint64_t part_size[MeshFileHeader::NUM_PARTS] = {
+    sizeof(MeshVertex) * contents.vertices.size(),
+    sizeof(uint32_t) * contents.indices.size(),
+    sizeof(uint32_t) * contents.tetrahedron_indices.size(),
+    sizeof(double) * contents.points.size(),
+    sizeof(double) * contents.values.size(),
+    sizeof(MeshSimplex) * contents.simplices.size(),
+    sizeof(MeshHeapItem) * contents.heap.size()
+  };
+  uint64_t offset = page;
+  for (unsigned i = 0; i < MeshFileHeader::NUM_PARTS; ++i) {
+    h.offset[i] = offset;
+    offset += round_up_to_page(part_size[i]);
+  }
+  h.file_size = offset;
+
+  // Write to a temporary file and rename it, so that a reader never
+  // sees half a file. Each writer has its own, in case another program
+  // saves the same mesh to the same directory at once.
+  string path = directory + "/" + key.fileName();
+  vector<char> temporary(path.begin(), path.end());
+  const char suffix[] = ".XXXXXX";
+  temporary.insert(temporary.end(), suffix, suffix + sizeof(suffix));
+  int fd = mkstemp(&temporary[0]);
+  if (fd < 0)
+    return false;
+  FILE *file = fdopen(fd, "wb");
+  if (!file) {
+    close(fd);
+    ::remove(&temporary[0]);
+    return false;
+  }
+  bool ok =
+    write_part(file, &h, sizeof(h)) && !cancelled(cancel) &&
+    write_part(file, contents.vertices) && !cancelled(cancel) &&
+    write_part(file, contents.indices) && !cancelled(cancel) &&
+    write_part(file, contents.tetrahedron_indices) && !cancelled(cancel) &&
+    write_part(file, contents.points) && !cancelled(cancel) &&
+    write_part(file, contents.values) && !cancelled(cancel) &&
+    write_part(file, contents.simplices) && !cancelled(cancel) &&
+    write_part(file, contents.heap) && !cancelled(cancel);
+  if (fclose(file) != 0)
+    ok = false;
+  if (ok)
+    ok = rename(&temporary[0], path.c_str()) == 0;
+  if (!ok)
+    ::remove(&temporary[0]);
+  else
+    evict(key.fileName());
+  return ok;
+}
+
+// In seconds, to the nanosecond where the file system keeps that
+static double modification_time(const struct stat &st)
+{
+#if defined(__APPLE__)
+  return st.st_mtimespec.tv_sec + 1e-9 * st.st_mtimespec.tv_nsec;
+#else
+  return st.st_mtim.tv_sec + 1e-9 * st.st_mtim.tv_nsec;
+#endif
+}
+
+namespace {
+  struct CacheFile
+  {
+    string name;
+    double used;
+    uint64_t size;
+    bool operator<(const CacheFile &rhs) const
+    {
+      return used < rhs.used || (used == rhs.used && name < rhs.name);
+    }
+  };
+}
+
+void MeshCache::evict(const string &keep) const
+{
+  lock_guard<mutex> lock(eviction);
+  DIR *dir = opendir(directory.c_str());
+  if (!dir)
+    return;
+  vector<CacheFile> files;
+  uint64_t total = 0;
+  while (struct dirent *entry = readdir(dir)) {
+    string name = entry->d_name;
+    if (name.compare(0, 5, "mesh-") != 0 || name.size() < 4 ||
+        name.compare(name.size() - 4, 4, ".bin") != 0)
+      continue;
+    struct stat st;
+    if (stat((directory + "/" + name).c_str(), &st) != 0)
+      continue;
+    CacheFile file = { name, modification_time(st), uint64_t(st.st_size) };
+    files.push_back(file);
+    total += file.size;
+  }
+  closedir(dir);
+
+  sort(files.begin(), files.end());
+  for (unsigned i = 0; i < files.size() && total > max_bytes; ++i)
+    if (files[i].name != keep &&
+        unlink((directory + "/" + files[i].name).c_str()) == 0)
+      total -= files[i].size;
+}
@@ -0,0 +1,218 @@
+/*
+ * This file is part of the Electron Orbital Explorer. The Electron
+ * Orbital Explorer is distributed under the Simplified BSD License
+ * (also called the "BSD 2-Clause License"), in hopes that these
+ * rendering techniques might be used by other programmers in
+ * applications such as scientific visualization, video gaming, and so
+ * on. If you find value in this software and use its technologies for
+ * another purpose, I would love to hear back from you at bjthinks (at)
+ * gmail (dot) com. If you improve this software and agree to release
+ * your modifications under the below license, I encourage you to fork
+ * the development tree on github and push your modifications. The
+ * Electron Orbital Explorer's development URL is:
+ * https://github.com/bjthinks/orbital-explorer
+ * (This paragraph is not part of the software license and may be
+ * removed.)
+ *
+ * Copyright (c) 2013, Brian W. Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * + Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * + Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef MESH_CACHE_HH
+#define MESH_CACHE_HH
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Orbital;
+class TetrahedralSubdivision;
+
+// Subdivisions saved to disk, so that an orbital seen before comes up
+// at once. A file holds the mesh in the form Cloud uploads it, and
+// everything TetrahedralSubdivision needs to carry on refining it.
+// Each part starts on a page boundary, and the file is memory mapped
+// to read it, so nothing is parsed or copied on the way to the GPU.
+// Files are in the byte order of the machine that wrote them; a file
+// from a machine of the other order is just a miss.
+
+// What determines a mesh
+struct MeshCacheKey
+{
+  MeshCacheKey()
+    : Z(0), N(0), L(0), M(0), real(0), diff(0), square(0), detail(0),
+      estimator(0), domain(0), algorithm_version(0) {}
+  // estimator and domain are a TetrahedralSubdivision::Estimator and
+  // Domain
+  MeshCacheKey(const Orbital &orbital, int detail, unsigned estimator,
+               unsigned domain = 0);
+  int32_t Z, N, L, M;
+  uint32_t real, diff, square;
+  int32_t detail;
+  uint32_t estimator;
+  uint32_t domain;
+  // TetrahedralSubdivision::algorithm_version
+  uint32_t algorithm_version;
+  bool operator==(const MeshCacheKey &rhs) const;
+  std::string fileName() const;
+};
+
+// A vertex as Cloud uploads it: position, then real part, imaginary
+// part and magnitude of the value there
+struct MeshVertex
+{
+  float pos[3];
+  float rim[3];
+};
+
+struct MeshSimplex
+{
+  uint32_t index;
+  uint32_t forming_point[4];
+  uint32_t adjacency[4];
+};
+
+struct MeshHeapItem
+{
+  double error;
+  double point[3];
+  uint32_t tetra;
+  uint32_t estimated;
+};
+
+struct MeshFileHeader
+{
+  char magic[8];
+  uint32_t format_version;
+  MeshCacheKey key;
+  uint32_t num_points;
+  // Tetrahedra inside the bounding tetrahedron, which are drawn
+  uint32_t num_tetrahedra;
+  // All simplices, including those touching the bounding tetrahedron
+  uint32_t num_simplices;
+  uint32_t max_simplex;
+  uint32_t num_heap_items;
+  // Byte offsets of the parts from the start of the file, in order:
+  // MeshVertex vertices[num_points]
+  // uint32_t indices[4 * num_tetrahedra]
+  // uint32_t tetrahedron_indices[num_tetrahedra], their simplex numbers
+  // double points[3 * num_points]
+  // double values[2 * num_points]
+  // MeshSimplex simplices[num_simplices], in increasing order
+  // MeshHeapItem heap[num_heap_items]
+  enum { NUM_PARTS = 7 };
+  uint64_t offset[NUM_PARTS];
+  uint64_t file_size;
+};
+
+// Everything in a mesh file but the header; see
+// TetrahedralSubdivision::saveState
+struct MeshFileContents
+{
+  std::vector<MeshVertex> vertices;
+  std::vector<uint32_t> indices;
+  std::vector<uint32_t> tetrahedron_indices;
+  std::vector<double> points;
+  std::vector<double> values;
+  std::vector<MeshSimplex> simplices;
+  std::vector<MeshHeapItem> heap;
+  uint32_t max_simplex;
+};
+
+// A mesh file mapped into memory, read only
+class MappedMesh
+{
+public:
+  // Map the file, and check that it is whole, saved under key, and
+  // has no index of anything it doesn't hold. If not, valid() is
+  // false.
+  MappedMesh(const std::string &path, const MeshCacheKey &key);
+  ~MappedMesh();
+  bool valid() const { return header_ != NULL; }
+  const MeshFileHeader &header() const { return *header_; }
+  const MeshVertex *vertices() const;
+  const uint32_t *indices() const;
+  const uint32_t *tetrahedronIndices() const;
+  const double *points() const;
+  const double *values() const;
+  const MeshSimplex *simplices() const;
+  const MeshHeapItem *heap() const;
+
+private:
+  MappedMesh(const MappedMesh &);
+  MappedMesh &operator=(const MappedMesh &);
+  const void *part(unsigned i) const;
+  void *data;
+  size_t size;
+  const MeshFileHeader *header_;
+};
+
+class MeshCache
+{
+public:
+  // Files go in directory, which is made if need be. With an empty
+  // directory nothing is ever found or saved. Once the files come to
+  // more than max_bytes, those least recently saved or loaded are
+  // deleted.
+  explicit MeshCache(const std::string &directory,
+                     uint64_t max_bytes = default_max_bytes);
+  enum { default_max_bytes = 256 << 20 };
+  // $XDG_CACHE_HOME/orbital-explorer, or ~/.cache/orbital-explorer,
+  // or empty if neither can be found
+  static std::string defaultDirectory();
+  // The mesh saved under key, or NULL if there is none. Delete it when
+  // done.
+  MappedMesh *load(const MeshCacheKey &key) const;
+  // Whether load would find key
+  bool has(const MeshCacheKey &key) const;
+  // Delete any mesh saved under key
+  void remove(const MeshCacheKey &key) const;
+  // Save the subdivision under key, replacing any saved before, from
+  // any thread. The subdivision must not be adding points; its worker
+  // calls this when it stops (see TetrahedralSubdivision::saveTo).
+  // Once *cancel is set, the save gives up between parts of the file,
+  // leaving whatever was saved before, and returns false.
+  bool save(const MeshCacheKey &key, TetrahedralSubdivision &ts,
+            const std::atomic<bool> *cancel = NULL) const;
+  // Save contents under key
+  bool save(const MeshCacheKey &key, const MeshFileContents &contents,
+            const std::atomic<bool> *cancel = NULL) const;
+
+private:
+  // Delete the least recently used files, other than keep, until they
+  // all fit in max_bytes
+  void evict(const std::string &keep) const;
+  std::string directory;
+  uint64_t max_bytes;
+  // Held while evicting, so that two savers don't both count the files
+  mutable std::mutex eviction;
+};
+
+#endif
@@ -149,6 +149,13 @@ void Uniform<Vector<2> >::operator=(const Vector<2> &x)
   glUniform2f(location, x[0], x[1]);
 }
 
+template <>
+void Uniform<Vector<3> >::operator=(const Vector<3> &x)
+{
+  verify_used();
+  glUniform3f(location, x[0], x[1], x[2]);
+}
+
 template <>
 void Uniform<Vector<4> >::operator=(const Vector<4> &x)
 {
@@ -210,12 +217,13 @@ VertexArrayObject::VertexArrayObject() :
   glGenVertexArrays(1, &id);
 }
 
-void VertexArrayObject::buffer(GLenum target, const void *data, size_t size)
+void VertexArrayObject::buffer(GLenum target, const void *data, size_t size,
+                               GLenum usage)
 {
   bind();
   Buffer *b = new Buffer();
   b->bind(target);
-  glBufferData(target, size, data, GL_STATIC_DRAW);
+  glBufferData(target, size, data, usage);
 
   Buffer *old = NULL;
   switch (target) {
@@ -236,3 +244,28 @@ void VertexArrayObject::buffer(GLenum target, const void *data, size_t size)
   if (old != NULL)
     delete old;
 }
+
+void VertexArrayObject::subBuffer(GLenum target, size_t offset,
+                                  const void *data, size_t size)
+{
+  bind();
+  Buffer *b = NULL;
+  switch (target) {
+  case GL_ARRAY_BUFFER:
+    b = arrayBuffer;
+    break;
+  case GL_ELEMENT_ARRAY_BUFFER:
+    b = elementArrayBuffer;
+    break;
+  default:
+    fprintf(stderr, "Please add another case to the switch statement in "
+            "VertexArrayObject::subBuffer()\n");
+    exit(1);
+  }
+  if (b == NULL) {
+    fprintf(stderr, "VertexArrayObject::subBuffer() before buffer()\n");
+    exit(1);
+  }
+  b->bind(target);
+  glBufferSubData(target, offset, size, data);
+}
@@ -188,10 +188,17 @@ public:
   void bind()          { glBindVertexArray(id); }
   ~VertexArrayObject() { glDeleteVertexArrays(1, &id); }
 
-  void buffer(GLenum target, const void *data, size_t size);
+  void buffer(GLenum target, const void *data, size_t size,
+              GLenum usage = GL_STATIC_DRAW);
+  // Overwrite size bytes of the last buffer given for target, from
+  // offset bytes in
+  void subBuffer(GLenum target, size_t offset, const void *data, size_t size);
 
   template <typename T> void buffer(GLenum target, const std::vector<T> &vec)
   { buffer(target, &vec[0], sizeof(T) * vec.size()); }
+  template <typename T> void subBuffer(GLenum target, size_t offset,
+                                       const std::vector<T> &vec)
+  { subBuffer(target, offset, &vec[0], sizeof(T) * vec.size()); }
 
 private:
   GLuint id;
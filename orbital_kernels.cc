@@ -0,0 +1,222 @@
+/*
+ * This file is part of the Electron Orbital Explorer. The Electron
+ * Orbital Explorer is distributed under the Simplified BSD License
+ * (also called the "BSD 2-Clause License"), in hopes that these
+ * rendering techniques might be used by other programmers in
+ * applications such as scientific visualization, video gaming, and so
+ * on. If you find value in this software and use its technologies for
+ * another purpose, I would love to hear back from you at bjthinks (at)
+ * gmail (dot) com. If you improve this software and agree to release
+ * your modifications under the below license, I encourage you to fork
+ * the development tree on github and push your modifications. The
+ * Electron Orbital Explorer's development URL is:
+ * https://github.com/bjthinks/orbital-explorer
+ * (This paragraph is not part of the software license and may be
+ * removed.)
+ *
+ * Copyright (c) 2013, Brian W. Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * + Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * + Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.hh"
+#include "orbital_kernels.hh"
+
+// Everything here is computed by the compiler. The coefficient
+// formulas are the same as the ones Orbital's constructor uses to
+// build its polynomials symbolically.
+
+static constexpr double kernel_factorial(int n)
+{
+  return n <= 1 ? 1.0 : double(n) * kernel_factorial(n - 1);
+}
+
+// Coefficient of rho^k in L_(N-L-1)^(2L+1)(rho), which is
+//   (-1)^k choose(N+L, N-L-1-k) / k!
+template <int N, int L>
+struct LaguerreCoefficients
+{
+  static constexpr int degree = N - L - 1;
+  static constexpr double at(int k)
+  {
+    return ((k & 1) ? -1.0 : 1.0) * kernel_factorial(N + L) /
+      (kernel_factorial(N - L - 1 - k) * kernel_factorial(2 * L + 1 + k) *
+       kernel_factorial(k));
+  }
+};
+
+// (x^2-1)^L = sum over i of choose(L,i) (-1)^(L-i) x^(2i), so its
+// (L+|M|)th derivative has coefficient
+//   choose(L,i) (-1)^(L-i) (2i)! / j!
+// on x^j, where 2i = j + L + |M|. Only every other power of x appears,
+// so the polynomial is x^parity Q(x^2); these are the coefficients of Q.
+template <int L, int AM>
+struct LegendreCoefficients
+{
+  static constexpr int parity = (L - AM) & 1;
+  static constexpr int degree = (L - AM) / 2;
+  static constexpr double at(int k)
+  {
+    return (((L - (2 * k + parity + L + AM) / 2) & 1) ? -1.0 : 1.0) *
+      kernel_factorial(L) /
+      (kernel_factorial((2 * k + parity + L + AM) / 2) *
+       kernel_factorial(L - (2 * k + parity + L + AM) / 2)) *
+      kernel_factorial(2 * k + parity + L + AM) /
+      kernel_factorial(2 * k + parity);
+  }
+};
+
+// Horner's rule, unrolled, with compile-time coefficients
+template <class Coefficients, int k, int degree>
+struct Horner
+{
+  static constexpr double coefficient = Coefficients::at(k);
+  static double eval(double x)
+  {
+    return coefficient + x * Horner<Coefficients, k + 1, degree>::eval(x);
+  }
+};
+
+template <class Coefficients, int degree>
+struct Horner<Coefficients, degree, degree>
+{
+  static constexpr double coefficient = Coefficients::at(degree);
+  static double eval(double) { return coefficient; }
+};
+
+// x^n by repeated squaring, unrolled
+template <int n>
+struct Power
+{
+  static double of(double x)
+  {
+    double h = Power<n / 2>::of(x);
+    return (n & 1) ? h * h * x : h * h;
+  }
+};
+
+template <>
+struct Power<0>
+{
+  static double of(double) { return 1.0; }
+};
+
+template <int N, int L, int AM>
+static void orbital_kernel(const double *rho,
+                           const double *cos_theta,
+                           const double *sin_theta,
+                           size_t count, double *result)
+{
+  typedef LaguerreCoefficients<N, L> Laguerre;
+  typedef LegendreCoefficients<L, AM> Legendre;
+
+  for (size_t i = 0; i < count; ++i) {
+    double c = cos_theta[i];
+    result[i] = Power<L>::of(rho[i]) *
+      Horner<Laguerre, 0, Laguerre::degree>::eval(rho[i]) *
+      Power<Legendre::parity>::of(c) *
+      Horner<Legendre, 0, Legendre::degree>::eval(c * c) *
+      Power<AM>::of(sin_theta[i]);
+  }
+}
+
+// The dispatch table, indexed by [N-1][L][|M|]. It is filled in by
+// three nested compile-time loops, over |M| <= L, then L < N, then
+// N <= MAX_ENERGY_LEVEL.
+
+typedef OrbitalKernel KernelTable[MAX_ENERGY_LEVEL][MAX_ENERGY_LEVEL]
+                                 [MAX_ENERGY_LEVEL];
+
+template <int N, int L, int AM, bool done = (AM > L)>
+struct FillM
+{
+  static void fill(KernelTable &table)
+  {
+    table[N - 1][L][AM] = orbital_kernel<N, L, AM>;
+    FillM<N, L, AM + 1>::fill(table);
+  }
+};
+
+template <int N, int L, int AM>
+struct FillM<N, L, AM, true>
+{
+  static void fill(KernelTable &) {}
+};
+
+template <int N, int L, bool done = (L >= N)>
+struct FillL
+{
+  static void fill(KernelTable &table)
+  {
+    FillM<N, L, 0>::fill(table);
+    FillL<N, L + 1>::fill(table);
+  }
+};
+
+template <int N, int L>
+struct FillL<N, L, true>
+{
+  static void fill(KernelTable &) {}
+};
+
+template <int N, bool done = (N > MAX_ENERGY_LEVEL)>
+struct FillN
+{
+  static void fill(KernelTable &table)
+  {
+    FillL<N, 0>::fill(table);
+    FillN<N + 1>::fill(table);
+  }
+};
+
+template <int N>
+struct FillN<N, true>
+{
+  static void fill(KernelTable &) {}
+};
+
+// Filled on first use; function-local statics are initialized
+// thread-safely.
+struct KernelTableHolder
+{
+  KernelTableHolder() { FillN<1>::fill(table); }
+  KernelTable table;
+};
+
+static const KernelTable &kernel_table()
+{
+  static const KernelTableHolder holder;
+  return holder.table;
+}
+
+OrbitalKernel findOrbitalKernel(int N, int L, int abs_M)
+{
+  if (N < 1 || N > MAX_ENERGY_LEVEL || L < 0 || L >= N ||
+      abs_M < 0 || abs_M > L)
+    return NULL;
+  return kernel_table()[N - 1][L][abs_M];
+}
@@ -47,7 +47,9 @@
 #define POLYNOMIAL_HH
 
 #include <cmath>
+#include <cstddef>
 #include <map>
+#include <vector>
 
 #include "genericops.hh"
 
@@ -73,6 +75,29 @@ inline static double ipow(double x, unsigned y)
   return r;
 }
 
+// Elementwise result[i] = pow(x[i], y) over an array. This is plain
+// repeated multiplication, which vectorizes; the exponents we use are
+// small.
+inline static void ipow(const double *x, unsigned y, double *result,
+                        size_t count)
+{
+  for (size_t i = 0; i < count; ++i)
+    result[i] = 1.0;
+  for (unsigned k = 0; k < y; ++k)
+    for (size_t i = 0; i < count; ++i)
+      result[i] *= x[i];
+}
+
+inline static void ipow(const float *x, unsigned y, float *result,
+                        size_t count)
+{
+  for (size_t i = 0; i < count; ++i)
+    result[i] = 1.0f;
+  for (unsigned k = 0; k < y; ++k)
+    for (size_t i = 0; i < count; ++i)
+      result[i] *= x[i];
+}
+
 class Polynomial : public CommutativeAlgebra<double, Polynomial>
 {
 public:
@@ -86,6 +111,8 @@ public:
   const Polynomial &operator*=(double rhs);
   Polynomial operator*(const Polynomial &rhs) const;
   Polynomial derivative(unsigned n) const;
+  unsigned degree() const;
+  double coefficient(unsigned n) const;
 
 private:
   std::map<unsigned,double> coeffs;
@@ -180,4 +207,88 @@ inline Polynomial Polynomial::derivative(unsigned n = 1) const
   return df.derivative(n - 1);
 }
 
+inline unsigned Polynomial::degree() const
+{
+  if (coeffs.empty())
+    return 0;
+  return coeffs.rbegin()->first;
+}
+
+inline double Polynomial::coefficient(unsigned n) const
+{
+  std::map<unsigned,double>::const_iterator i = coeffs.find(n);
+  if (i == coeffs.end())
+    return 0.;
+  return i->second;
+}
+
+// A Polynomial flattened into a dense array of coefficients, for
+// evaluation in inner loops. Polynomial is convenient for building
+// things symbolically, but walks a std::map and calls ipow() for each
+// term; a CompiledPolynomial is built once from it and then only
+// evaluated.
+class CompiledPolynomial
+{
+public:
+  CompiledPolynomial() : coeffs(1, 0.) {}
+  explicit CompiledPolynomial(const Polynomial &p);
+  unsigned degree() const { return coeffs.size() - 1; }
+  double operator()(double x) const;
+  void evaluate(const double *x, double *result, size_t count) const;
+
+private:
+  // coeffs[n] is the coefficient of x^n; never empty
+  std::vector<double> coeffs;
+};
+
+inline CompiledPolynomial::CompiledPolynomial(const Polynomial &p)
+  : coeffs(p.degree() + 1)
+{
+  for (unsigned n = 0; n <= p.degree(); ++n)
+    coeffs[n] = p.coefficient(n);
+}
+
+inline double CompiledPolynomial::operator()(double x) const
+{
+  unsigned d = degree();
+  const double *c = &coeffs[0];
+
+  if (d < 4) {
+    // Horner's rule
+    double r = c[d];
+    for (unsigned n = d; n > 0; --n)
+      r = r * x + c[n - 1];
+    return r;
+  }
+
+  // Second order Estrin: p(x) = even(x^2) + x odd(x^2), with the two
+  // halves evaluated by Horner's rule. The two dependency chains are
+  // independent, and each is half as long.
+  double x2 = x * x;
+  unsigned top_even = d & ~1u;
+  unsigned top_odd = (d - 1) | 1u;
+  double even = c[top_even];
+  for (unsigned n = top_even; n > 0; n -= 2)
+    even = even * x2 + c[n - 2];
+  double odd = c[top_odd];
+  for (unsigned n = top_odd; n > 1; n -= 2)
+    odd = odd * x2 + c[n - 2];
+  return even + x * odd;
+}
+
+inline void CompiledPolynomial::evaluate(const double *x, double *result,
+                                         size_t count) const
+{
+  // Horner's rule, one coefficient at a time across the whole array,
+  // so the inner loop vectorizes across points
+  unsigned d = degree();
+  for (size_t i = 0; i < count; ++i)
+    result[i] = coeffs[d];
+  for (unsigned n = d; n > 0; --n) {
+    double c = coeffs[n - 1];
+    for (size_t i = 0; i < count; ++i)
+      result[i] = result[i] * x[i] + c;
+  }
+}
+
 #endif
@@ -44,9 +44,12 @@
  */
 
 #include <vector>
+#include <cstdio>
 #include <cstdlib>
 #include <cmath>
 #include <complex>
+#include <memory>
+#include <stdexcept>
 
 #include "glprocs.hh"
 #include "render.hh"
@@ -55,6 +58,7 @@
 #include "transform.hh"
 #include "wavefunction.hh"
 #include "tetrahedralize.hh"
+#include "workerpool.hh"
 #include "oopengl.hh"
 #include "viewport.hh"
 #include "camera.hh"
@@ -62,6 +66,9 @@
 #include "solid.hh"
 #include "cloud.hh"
 #include "final.hh"
+#include "mesh_cache.hh"
+#include "subdivision_cache.hh"
+#include "axial_subdivision.hh"
 
 using namespace std;
 
@@ -71,12 +78,56 @@ static Texture *solidRGBTex, *solidDepthTex, *cloudDensityTex;
 // This records the number of primitives, not the number of indices
 static unsigned num_tetrahedra;
 
-// The function to visualize
-static Orbital *orbital = NULL;
+// The canonical form of the function to visualize (see
+// Orbital::canonical), shared with any cancelled subdivisions still
+// reading it
+static shared_ptr<Orbital> orbital;
 
 // Subdivision of space into tetrahedra
 static TetrahedralSubdivision *ts = NULL;
 
+// Or for an orbital that looks the same all around the z axis, a
+// subdivision of a plane swept around it
+static AxialSubdivision *axial = NULL;
+
+// Finished subdivisions saved from earlier runs
+static MeshCache *mesh_cache = NULL;
+// What ts was restored from, if it came from mesh_cache
+static MeshCacheKey restored_key;
+
+// Finished subdivisions of orbitals shown recently, and subdivisions of
+// those one step from this one, made in advance
+static SubdivisionCache *recent_subdivisions = NULL;
+static const size_t recent_subdivisions_bytes = size_t(512) << 20;
+// Have those for this orbital and detail level been started?
+static bool speculated = false;
+
+// Cancelled subdivisions, with the orbitals they're still reading, left
+// to stop in their own time. Each frame deletes those that have. Each
+// corpse has either ts or axial.
+struct Corpse
+{
+  TetrahedralSubdivision *ts;
+  AxialSubdivision *axial;
+  shared_ptr<Orbital> orbital;
+};
+static vector<Corpse> graveyard;
+
+static void buryDeadSubdivisions()
+{
+  unsigned kept = 0;
+  for (unsigned i = 0; i < graveyard.size(); ++i)
+    if (graveyard[i].ts ? graveyard[i].ts->isRunning() :
+        graveyard[i].axial->isRunning()) {
+      graveyard[kept++] = graveyard[i];
+    } else {
+      delete graveyard[i].ts;
+      delete graveyard[i].axial;
+      graveyard[i].orbital.reset();
+    }
+  graveyard.resize(kept);
+}
+
 // Classes representing render stages
 static Solid *solid = NULL;
 static Cloud *cloud = NULL;
@@ -92,6 +143,9 @@ void initialize()
   cloud = new Cloud(solidDepthTex, cloudDensityTex);
   final = new Final(solidRGBTex, cloudDensityTex);
 
+  mesh_cache = new MeshCache(MeshCache::defaultDirectory());
+  recent_subdivisions = new SubdivisionCache(recent_subdivisions_bytes);
+
   glClearColor(0., 0., 0., 0.);
   glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 
@@ -111,6 +165,144 @@ void resizeTextures(const Viewport &viewport)
   GetGLError();
 }
 
+// Every orbital is symmetric under reflection in the coordinate planes
+// (see Orbital::reflection), so only the octant x, y, z >= 0 is
+// subdivided, and Cloud draws it in all eight. The symmetry planes cut
+// the octant's tetrahedra short, so an eighth of the vertices isn't
+// enough: against a mesh of all space with 8000, benchmark symmetry
+// finds the octant's total error, over all eight, 1.3 to 2.2 times as
+// much with an eighth, and 0.66 to 1.05 times as much with a fifth.
+static const unsigned octant_share = 5;
+
+// The number of vertices to subdivide the octant to at a detail level
+static unsigned detailVertices(int detail)
+{
+  // Golden ratio
+  const double phi = (1.0 + sqrt(5.0)) / 2.0;
+  // 500, 800, 1300, 2100, 3400, 5500, 8900, 14400, 23300, 37700 for
+  // a mesh of all space
+  return 100 * int(pow(phi, double(detail) + 4.0) / sqrt(5.0) + 0.5) /
+    octant_share;
+}
+
+// The number of vertices to subdivide the plane to for an
+// AxialSubdivision with this many steps. The error of a mesh of the
+// plane falls about as fast with its vertices as that of a mesh of
+// space does with the 2/3 power of its vertices, and this makes about
+// the same error as detailVertices, or better. But a large M takes
+// many steps, so keep the swept mesh within four times as many
+// vertices as the octant's, to keep drawing it quick.
+static unsigned axialVertices(int detail, unsigned segments)
+{
+  double vertices = detailVertices(detail);
+  return unsigned(max(50.0, min(4.0 * pow(vertices, 2.0 / 3.0),
+                                4.0 * vertices / double(segments + 1))));
+}
+
+// What the caches know the subdivision at this detail level by
+static MeshCacheKey meshKey(int detail)
+{
+  return MeshCacheKey(*orbital, detail, TetrahedralSubdivision::LATTICE,
+                      TetrahedralSubdivision::OCTANT);
+}
+
+// Ask any running thread to stop, but don't wait for it
+static void abandonSubdivision()
+{
+  if (ts) {
+    ts->cancelAsync();
+    Corpse corpse = { ts, NULL, orbital };
+    graveyard.push_back(corpse);
+    ts = NULL;
+  }
+  if (axial) {
+    axial->cancelAsync();
+    Corpse corpse = { NULL, axial, orbital };
+    graveyard.push_back(corpse);
+    axial = NULL;
+  }
+}
+
+// Keep the subdivision in memory, as the mesh for this detail level, if
+// it's done, and otherwise abandon it. Kept, it needn't roll back.
+static void keepSubdivision(int detail)
+{
+  if (ts && !ts->isRunning()) {
+    ts->setRollBack(false);
+    recent_subdivisions->put(meshKey(detail), orbital, ts);
+    ts = NULL;
+  }
+  abandonSubdivision();
+}
+
+// Draw the octant in all eight, reflected as the orbital says
+static void reflectOctant()
+{
+  Orbital::Reflection reflections[3];
+  for (unsigned axis = 0; axis < 3; ++axis)
+    reflections[axis] = orbital->reflection(axis);
+  cloud->setOctantSymmetry(reflections);
+}
+
+// Subdivide the plane and sweep it, which is quick enough not to need
+// the caches
+static void startAxialSubdivision(int detail)
+{
+  recent_subdivisions->cancelSpeculation();
+  speculated = false;
+  axial = new AxialSubdivision(*orbital, orbital->M, orbital->radius());
+  axial->runUntil(axialVertices(detail, axial->numSegments()));
+  cloud->clear();
+  reflectOctant();
+}
+
+// Replace the subdivision with one of orbital at this detail level,
+// taken from memory or the mesh cache if it's there
+static void startSubdivision(int detail)
+{
+  abandonSubdivision();
+  if (AxialSubdivision::applies(*orbital)) {
+    startAxialSubdivision(detail);
+    return;
+  }
+
+  MeshCacheKey key = meshKey(detail);
+  shared_ptr<Orbital> kept;
+  TetrahedralSubdivision *recent = recent_subdivisions->take(key, kept);
+  // Whatever else was made in advance isn't wanted now
+  recent_subdivisions->cancelSpeculation();
+  speculated = false;
+
+  MappedMesh *saved = recent ? NULL : mesh_cache->load(key);
+  if (saved) {
+    // The subdivision takes saved, and rebuilds its triangulation from
+    // it on the worker; display checks that that worked
+    ts = new TetrahedralSubdivision(*orbital, saved, false,
+                                    TetrahedralSubdivision::LATTICE, 64,
+                                    TetrahedralSubdivision::OCTANT);
+    cloud->loadMesh(*saved, ts->version());
+    restored_key = key;
+  }
+  if (recent) {
+    orbital = kept;
+    ts = recent;
+    ts->setBackground(false);
+    cloud->clear();
+  } else if (!ts) {
+    ts = new TetrahedralSubdivision(*orbital, orbital->radius(), false,
+                                    TetrahedralSubdivision::LATTICE, 64,
+                                    TetrahedralSubdivision::OCTANT);
+    cloud->clear();
+  }
+  ts->setThreads(WorkerPool::hardwareThreads());
+  // So that lowering the detail level takes away the newest vertices
+  ts->setRollBack(true);
+  // The worker saves the mesh once it's done, if it isn't saved already
+  ts->saveTo(mesh_cache, key, detailVertices(detail));
+  ts->runUntil(detailVertices(detail));
+  reflectOctant();
+}
+
 void display(const Viewport &viewport, const Camera &camera)
 {
   static bool need_full_redraw = true;
@@ -118,57 +310,111 @@ void display(const Viewport &viewport, const Camera &camera)
   int width = viewport.getWidth();
   int height = viewport.getHeight();
 
-  static int num_points = 0;
-  bool just_started = false;
+  static int saved_detail = 0;
+
+  // A mesh cache file that passed MappedMesh's checks but still couldn't
+  // be restored is as good as missing, and no use next time either
+  if (ts && ts->failed()) {
+    fprintf(stderr, "Discarding damaged mesh cache file %s\n",
+            restored_key.fileName().c_str());
+    mesh_cache->remove(restored_key);
+    startSubdivision(saved_detail);
+  }
 
-  // Are we just starting up, or did the wave function change?
-  Orbital newOrbital = getOrbital();
+  // Are we just starting up, or did the wave function change? Changes
+  // of Z, or of the sign of M, only change how the mesh is drawn.
+  Orbital shownOrbital = getOrbital();
+  Orbital newOrbital = shownOrbital.canonical();
   // Did the detail level change?
-  static int saved_detail = 0;
   int detail = getDetail();
-  if (!orbital || *orbital != newOrbital || saved_detail != detail) {
+  if (ts && *orbital == newOrbital && detail > saved_detail) {
+    // The finer mesh carries on from the coarser one
+    recent_subdivisions->cancelSpeculation();
+    speculated = false;
     saved_detail = detail;
-
-    // Stop any running thread
-    if (ts)
-      ts->kill();
-    // delete checks for NULL, so we don't have to
-    delete orbital;
-    delete ts;
-    orbital = new Orbital(newOrbital);
-    ts = new TetrahedralSubdivision(*orbital, orbital->radius());
-    num_points = 0;
-
-    // Golden ratio
-    const double phi = (1.0 + sqrt(5.0)) / 2.0;
-    // 500, 800, 1300, 2100, 3400, 5500, 8900, 14400, 23300, 37700
-    int v = 100 * int(pow(phi, double(detail) + 4.0) / sqrt(5.0) + 0.5);
-    ts->runUntil(v);
-    just_started = true;
+    ts->saveTo(mesh_cache, meshKey(detail), detailVertices(detail));
+    ts->runUntil(detailVertices(detail));
+  } else if (ts && *orbital == newOrbital && detail < saved_detail) {
+    // And the coarser mesh is the finer one without its newest vertices,
+    // which the worker takes away, unless those came from the mesh cache
+    recent_subdivisions->cancelSpeculation();
+    speculated = false;
+    saved_detail = detail;
+    ts->saveTo(mesh_cache, meshKey(detail), detailVertices(detail));
+    if (!ts->rollBackTo(detailVertices(detail)))
+      startSubdivision(detail);
+  } else if (!orbital || *orbital != newOrbital || saved_detail != detail) {
+    keepSubdivision(saved_detail);
+    saved_detail = detail;
+    orbital = make_shared<Orbital>(newOrbital);
+    startSubdivision(detail);
   }
 
-  // Only suck down new vertices and tetrahedra if at least 100 more
-  // have been calculated -- because locking the mutex for the time it
-  // takes to suck down primitives slows down subdivision substantially
-  if ((ts->isRunning() && ts->numVertices() > num_points + 100) ||
-      ts->isFinished() || just_started) {
-    // Must get indices first, because subdivision may be in progress
-    std::vector<unsigned> indices = ts->tetrahedronVertexIndices();
-    std::vector<Vector<3> > positions = ts->vertexPositions();
-    cloud->setPrimitives(positions, indices, orbital);
+  buryDeadSubdivisions();
+
+  // Once this mesh is done, give idle cores the orbitals the user might
+  // step to next
+  recent_subdivisions->poll();
+  if (!speculated && ts && !ts->isRunning()) {
+    vector<Orbital> neighbors = getNeighboringOrbitals(shownOrbital);
+    vector<Orbital> canonical;
+    for (unsigned i = 0; i < neighbors.size(); ++i)
+      if (!AxialSubdivision::applies(neighbors[i]))
+        canonical.push_back(neighbors[i].canonical());
+    recent_subdivisions->speculate(canonical, saved_detail,
+                                   detailVertices(saved_detail),
+                                   TetrahedralSubdivision::OCTANT);
+    speculated = true;
+  }
+  setMeshCacheStats(int(recent_subdivisions->hits()),
+                    int(recent_subdivisions->misses()),
+                    int(recent_subdivisions->memoryUsage() >> 20));
+
+  // Take whatever changed in the mesh, once at least 100 more vertices
+  // have been added or the subdivision has stopped. This costs time in
+  // proportion to the changes, here and in the subdivision thread.
+  // If the worker is busy with the mesh, don't wait for it; try again
+  // next frame.
+  unsigned latest = ts ? ts->version() : cloud->version();
+  MeshDelta delta;
+  if (latest != cloud->version() &&
+      (latest >= cloud->version() + 100 || !ts->isRunning()) &&
+      ts->tryChangesSince(cloud->version(), delta)) {
+    cloud->applyDelta(delta);
+    num_tetrahedra = cloud->numTetrahedra();
+    setVerticesTetrahedra(int(cloud->numDrawnVertices()),
+                          int(cloud->numDrawnTetrahedra()));
 
-    num_points = positions.size();
-    num_tetrahedra = indices.size() / 4;
-    setVerticesTetrahedra(int(num_points), int(num_tetrahedra));
+    need_full_redraw = true;
+  }
+  // A swept mesh comes all at once
+  if (axial && axial->isFinished()) {
+    cloud->applyDelta(axial->mesh());
+    num_tetrahedra = cloud->numTetrahedra();
+    setVerticesTetrahedra(int(cloud->numDrawnVertices()),
+                          int(cloud->numDrawnTetrahedra()));
+    need_full_redraw = true;
+  }
 
+  static double old_position_scale = 0.0, old_value_scale = 0.0;
+  static bool old_conjugate = false;
+  double position_scale = 1.0 / double(shownOrbital.Z);
+  double value_scale = shownOrbital.valueScale();
+  bool conjugate = shownOrbital.conjugatesCanonical();
+  if (position_scale != old_position_scale ||
+      value_scale != old_value_scale || conjugate != old_conjugate) {
+    cloud->setTransform(position_scale, value_scale, conjugate);
     need_full_redraw = true;
   }
+  old_position_scale = position_scale;
+  old_value_scale = value_scale;
+  old_conjugate = conjugate;
 
   GetGLError();
 
   double near = 1.0;
   double far =
-    camera.getRadius() + std::max(1.0, (orbital->radius())) * sqrt(3.0);
+    camera.getRadius() + std::max(1.0, (shownOrbital.radius())) * sqrt(3.0);
   Matrix<4,4> viewMatrix = camera.viewMatrix();
   Matrix<4,4> mvpm = viewport.projMatrix(near, far) * viewMatrix;
   Vector<4> camera_position = inverse(viewMatrix) * basisVector<4>(3);
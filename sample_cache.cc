@@ -0,0 +1,187 @@
+/*
+ * This file is part of the Electron Orbital Explorer. The Electron
+ * Orbital Explorer is distributed under the Simplified BSD License
+ * (also called the "BSD 2-Clause License"), in hopes that these
+ * rendering techniques might be used by other programmers in
+ * applications such as scientific visualization, video gaming, and so
+ * on. If you find value in this software and use its technologies for
+ * another purpose, I would love to hear back from you at bjthinks (at)
+ * gmail (dot) com. If you improve this software and agree to release
+ * your modifications under the below license, I encourage you to fork
+ * the development tree on github and push your modifications. The
+ * Electron Orbital Explorer's development URL is:
+ * https://github.com/bjthinks/orbital-explorer
+ * (This paragraph is not part of the software license and may be
+ * removed.)
+ *
+ * Copyright (c) 2013, Brian W. Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * + Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * + Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <set>
+
+#include "sample_cache.hh"
+
+using namespace std;
+
+SampleCache::SampleCache(unsigned denominator_, size_t capacity_) :
+  denominator(denominator_),
+  face_samples((denominator_ - 1) * (denominator_ - 2) / 2),
+  edge_samples(denominator_ - 1),
+  capacity(capacity_),
+  hit_count(0), miss_count(0)
+{
+}
+
+size_t SampleCache::size() const
+{
+  return faces.block.size() * face_samples +
+    edges.block.size() * edge_samples;
+}
+
+template <unsigned k>
+bool SampleCache::find(Blocks<k> &blocks, const Face<k> &key,
+                       complex<double> *values, unsigned count)
+{
+  mutex.lock();
+  typename unordered_map<Face<k>, unsigned, Hash<k> >::const_iterator i =
+    blocks.block.find(key);
+  bool found = i != blocks.block.end();
+  if (found) {
+    const complex<double> *start = &blocks.values[i->second * count];
+    copy(start, start + count, values);
+    hit_count += count;
+  } else {
+    miss_count += count;
+  }
+  mutex.unlock();
+  return found;
+}
+
+template <unsigned k>
+void SampleCache::put(Blocks<k> &blocks, const Face<k> &key,
+                      const complex<double> *values, unsigned count)
+{
+  mutex.lock();
+  if (blocks.block.find(key) == blocks.block.end() &&
+      size() + count <= capacity) {
+    unsigned b;
+    if (blocks.free_blocks.empty()) {
+      b = blocks.values.size() / count;
+      blocks.values.resize(blocks.values.size() + count);
+    } else {
+      b = blocks.free_blocks.back();
+      blocks.free_blocks.pop_back();
+    }
+    copy(values, values + count, &blocks.values[b * count]);
+    blocks.block[key] = b;
+  }
+  mutex.unlock();
+}
+
+template <unsigned k>
+void SampleCache::forget(Blocks<k> &blocks, const Face<k> &key)
+{
+  typename unordered_map<Face<k>, unsigned, Hash<k> >::iterator i =
+    blocks.block.find(key);
+  if (i == blocks.block.end())
+    return;
+  blocks.free_blocks.push_back(i->second);
+  blocks.block.erase(i);
+}
+
+bool SampleCache::lookup(const Face<3> &face, complex<double> *values)
+{
+  return find(faces, face, values, face_samples);
+}
+
+bool SampleCache::lookup(const Face<2> &edge, complex<double> *values)
+{
+  return find(edges, edge, values, edge_samples);
+}
+
+void SampleCache::store(const Face<3> &face, const complex<double> *values)
+{
+  put(faces, face, values, face_samples);
+}
+
+void SampleCache::store(const Face<2> &edge, const complex<double> *values)
+{
+  put(edges, edge, values, edge_samples);
+}
+
+static Face<2> make_edge(unsigned a, unsigned b)
+{
+  Face<2> edge;
+  edge.points[0] = min(a, b);
+  edge.points[1] = max(a, b);
+  return edge;
+}
+
+void SampleCache::removeTetrahedra(const vector<Simplex<3> > &removed)
+{
+  // Faces shared by two removed tetrahedra were inside the region they
+  // filled, and are gone; the others bound the region, and are still
+  // in the mesh
+  set<Face<3> > seen, boundary;
+  for (unsigned t = 0; t < removed.size(); ++t) {
+    unsigned v[4];
+    for (unsigned i = 0; i < 4; ++i)
+      v[i] = removed[t].formingPoint(i);
+    sort(v, v + 4);
+    for (unsigned skip = 0; skip < 4; ++skip) {
+      Face<3> face;
+      for (unsigned i = 0, j = 0; i < 4; ++i)
+        if (i != skip)
+          face.points[j++] = v[i];
+      if (seen.insert(face).second) {
+        boundary.insert(face);
+      } else {
+        boundary.erase(face);
+        forget(faces, face);
+      }
+    }
+  }
+
+  // Likewise, an edge survives only if it's on the boundary
+  set<Face<2> > boundary_edges;
+  for (set<Face<3> >::const_iterator f = boundary.begin();
+       f != boundary.end(); ++f)
+    for (unsigned i = 0; i < 3; ++i)
+      for (unsigned j = i + 1; j < 3; ++j)
+        boundary_edges.insert(make_edge(f->points[i], f->points[j]));
+  for (unsigned t = 0; t < removed.size(); ++t)
+    for (unsigned i = 0; i < 4; ++i)
+      for (unsigned j = i + 1; j < 4; ++j) {
+        Face<2> edge = make_edge(removed[t].formingPoint(i),
+                                 removed[t].formingPoint(j));
+        if (boundary_edges.find(edge) == boundary_edges.end())
+          forget(edges, edge);
+      }
+}
@@ -0,0 +1,148 @@
+/*
+ * This file is part of the Electron Orbital Explorer. The Electron
+ * Orbital Explorer is distributed under the Simplified BSD License
+ * (also called the "BSD 2-Clause License"), in hopes that these
+ * rendering techniques might be used by other programmers in
+ * applications such as scientific visualization, video gaming, and so
+ * on. If you find value in this software and use its technologies for
+ * another purpose, I would love to hear back from you at bjthinks (at)
+ * gmail (dot) com. If you improve this software and agree to release
+ * your modifications under the below license, I encourage you to fork
+ * the development tree on github and push your modifications. The
+ * Electron Orbital Explorer's development URL is:
+ * https://github.com/bjthinks/orbital-explorer
+ * (This paragraph is not part of the software license and may be
+ * removed.)
+ *
+ * Copyright (c) 2013, Brian W. Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * + Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * + Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SAMPLE_CACHE_HH
+#define SAMPLE_CACHE_HH
+
+#include <complex>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "delaunay.hh"
+
+// Values of a function at the test points on the faces and edges of a
+// tetrahedral mesh, so that tetrahedra sharing a face or an edge only
+// sample it once. Test points have barycentric coordinates that are
+// multiples of 1 / denominator; a point on a face or edge is named by
+// the face or edge, with its vertices in increasing order, and the
+// numerators of its weights in the same order. All the values for one
+// face or edge are stored or looked up together, and they are thrown
+// away when the face or edge leaves the mesh.
+//
+// Lookups and stores may come from several threads at once; removing
+// tetrahedra may not happen at the same time as either.
+class SampleCache
+{
+public:
+  // capacity is the most values to hold at once; beyond that, stores
+  // are ignored until removed tetrahedra make room
+  SampleCache(unsigned denominator, size_t capacity);
+
+  // Number of test points strictly inside a face or an edge
+  unsigned faceSamples() const { return face_samples; }
+  unsigned edgeSamples() const { return edge_samples; }
+  // Where the point with the given numerators (over the vertices in
+  // increasing order) goes among the values of its face or edge. The
+  // numerators are all positive and add up to the denominator.
+  unsigned faceSlot(unsigned a, unsigned b) const
+  {
+    // Rows of constant a, each one shorter than the last
+    return (a - 1) * (denominator - 1) - a * (a - 1) / 2 + (b - 1);
+  }
+  unsigned edgeSlot(unsigned a) const { return a - 1; }
+
+  // Copy the values of a face or an edge into values, if known
+  bool lookup(const Face<3> &face, std::complex<double> *values);
+  bool lookup(const Face<2> &edge, std::complex<double> *values);
+  void store(const Face<3> &face, const std::complex<double> *values);
+  void store(const Face<2> &edge, const std::complex<double> *values);
+
+  // Forget the faces and edges that went away when these tetrahedra
+  // were removed from the mesh to make room for a new point: all but
+  // those on the boundary of the region they filled.
+  void removeTetrahedra(const std::vector<Simplex<3> > &removed);
+
+  unsigned long hits() const { return hit_count; }
+  unsigned long misses() const { return miss_count; }
+  // Values currently held
+  size_t size() const;
+
+private:
+  SampleCache(const SampleCache &);
+  SampleCache &operator=(const SampleCache &);
+
+  template <unsigned k>
+  struct Hash
+  {
+    size_t operator()(const Face<k> &face) const
+    {
+      size_t h = 0;
+      for (unsigned i = 0; i < k; ++i)
+        h = h * 0x9e3779b97f4a7c15ull + face.points[i];
+      return h ^ (h >> 29);
+    }
+  };
+  // The values of every face (or every edge) live in one array, in
+  // blocks of faceSamples() (or edgeSamples()) values; the map gives
+  // the block of each face or edge.
+  template <unsigned k>
+  struct Blocks
+  {
+    std::unordered_map<Face<k>, unsigned, Hash<k> > block;
+    std::vector<std::complex<double> > values;
+    std::vector<unsigned> free_blocks;
+  };
+  template <unsigned k>
+  bool find(Blocks<k> &blocks, const Face<k> &key,
+            std::complex<double> *values, unsigned count);
+  template <unsigned k>
+  void put(Blocks<k> &blocks, const Face<k> &key,
+           const std::complex<double> *values, unsigned count);
+  template <unsigned k>
+  void forget(Blocks<k> &blocks, const Face<k> &key);
+
+  const unsigned denominator;
+  const unsigned face_samples;
+  const unsigned edge_samples;
+  const size_t capacity;
+  Blocks<3> faces;
+  Blocks<2> edges;
+  unsigned long hit_count;
+  unsigned long miss_count;
+  std::mutex mutex;
+};
+
+#endif
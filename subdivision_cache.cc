@@ -0,0 +1,187 @@
+/*
+ * This file is part of the Electron Orbital Explorer. The Electron
+ * Orbital Explorer is distributed under the Simplified BSD License
+ * (also called the "BSD 2-Clause License"), in hopes that these
+ * rendering techniques might be used by other programmers in
+ * applications such as scientific visualization, video gaming, and so
+ * on. If you find value in this software and use its technologies for
+ * another purpose, I would love to hear back from you at bjthinks (at)
+ * gmail (dot) com. If you improve this software and agree to release
+ * your modifications under the below license, I encourage you to fork
+ * the development tree on github and push your modifications. The
+ * Electron Orbital Explorer's development URL is:
+ * https://github.com/bjthinks/orbital-explorer
+ * (This paragraph is not part of the software license and may be
+ * removed.)
+ *
+ * Copyright (c) 2013, Brian W. Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * + Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * + Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "subdivision_cache.hh"
+
+using namespace std;
+
+SubdivisionCache::SubdivisionCache(size_t max_bytes_,
+                                   unsigned max_speculative_)
+  : max_bytes(max_bytes_), max_speculative(max_speculative_), bytes(0),
+    hit_count(0), miss_count(0)
+{
+}
+
+SubdivisionCache::~SubdivisionCache()
+{
+  cancelSpeculation();
+  for (unsigned i = 0; i < cancelled.size(); ++i)
+    cancelled[i].ts->wait();
+  for (unsigned i = 0; i < cancelled.size(); ++i)
+    destroy(cancelled[i]);
+  for (list<Entry>::iterator i = recent.begin(); i != recent.end(); ++i)
+    destroy(*i);
+}
+
+// The subdivision reads the orbital, so it goes first
+void SubdivisionCache::destroy(Entry &entry)
+{
+  delete entry.ts;
+  entry.ts = NULL;
+  entry.orbital.reset();
+}
+
+TetrahedralSubdivision *
+SubdivisionCache::take(const MeshCacheKey &key, shared_ptr<Orbital> &orbital)
+{
+  for (list<Entry>::iterator i = recent.begin(); i != recent.end(); ++i)
+    if (i->key == key) {
+      ++hit_count;
+      TetrahedralSubdivision *ts = i->ts;
+      orbital = i->orbital;
+      bytes -= i->bytes;
+      recent.erase(i);
+      return ts;
+    }
+
+  for (unsigned i = 0; i < speculative.size(); ++i)
+    if (speculative[i].key == key) {
+      ++hit_count;
+      TetrahedralSubdivision *ts = speculative[i].ts;
+      orbital = speculative[i].orbital;
+      speculative.erase(speculative.begin() + i);
+      // Only as long as it takes to finish the current point
+      ts->kill();
+      return ts;
+    }
+
+  ++miss_count;
+  return NULL;
+}
+
+void SubdivisionCache::put(const MeshCacheKey &key,
+                           shared_ptr<Orbital> orbital,
+                           TetrahedralSubdivision *ts)
+{
+  for (list<Entry>::iterator i = recent.begin(); i != recent.end(); ++i)
+    if (i->key == key) {
+      bytes -= i->bytes;
+      destroy(*i);
+      recent.erase(i);
+      break;
+    }
+
+  Entry entry = { key, orbital, ts, ts->memoryUsage() };
+  recent.push_front(entry);
+  bytes += entry.bytes;
+  evict();
+}
+
+void SubdivisionCache::evict()
+{
+  while (bytes > max_bytes && !recent.empty()) {
+    bytes -= recent.back().bytes;
+    destroy(recent.back());
+    recent.pop_back();
+  }
+}
+
+void SubdivisionCache::speculate(const vector<Orbital> &orbitals, int detail,
+                                 unsigned vertices,
+                                 TetrahedralSubdivision::Domain domain)
+{
+  for (unsigned i = 0;
+       i < orbitals.size() && speculative.size() < max_speculative; ++i) {
+    MeshCacheKey key(orbitals[i], detail, TetrahedralSubdivision::LATTICE,
+                     domain);
+    bool known = false;
+    for (list<Entry>::iterator j = recent.begin(); j != recent.end(); ++j)
+      if (j->key == key)
+        known = true;
+    for (unsigned j = 0; j < speculative.size(); ++j)
+      if (speculative[j].key == key)
+        known = true;
+    if (known)
+      continue;
+
+    shared_ptr<Orbital> orbital = make_shared<Orbital>(orbitals[i]);
+    TetrahedralSubdivision *ts =
+      new TetrahedralSubdivision(*orbital, orbital->radius(), false,
+                                 TetrahedralSubdivision::LATTICE, 64, domain,
+                                 true);
+    ts->setBackground(true);
+    ts->runUntil(vertices);
+    Entry entry = { key, orbital, ts, 0 };
+    speculative.push_back(entry);
+  }
+}
+
+void SubdivisionCache::cancelSpeculation()
+{
+  for (unsigned i = 0; i < speculative.size(); ++i) {
+    speculative[i].ts->cancelAsync();
+    cancelled.push_back(speculative[i]);
+  }
+  speculative.clear();
+}
+
+void SubdivisionCache::poll()
+{
+  unsigned kept = 0;
+  for (unsigned i = 0; i < speculative.size(); ++i)
+    if (speculative[i].ts->isRunning())
+      speculative[kept++] = speculative[i];
+    else
+      put(speculative[i].key, speculative[i].orbital, speculative[i].ts);
+  speculative.resize(kept);
+
+  kept = 0;
+  for (unsigned i = 0; i < cancelled.size(); ++i)
+    if (cancelled[i].ts->isRunning())
+      cancelled[kept++] = cancelled[i];
+    else
+      destroy(cancelled[i]);
+  cancelled.resize(kept);
+}
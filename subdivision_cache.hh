@@ -0,0 +1,128 @@
+/*
+ * This file is part of the Electron Orbital Explorer. The Electron
+ * Orbital Explorer is distributed under the Simplified BSD License
+ * (also called the "BSD 2-Clause License"), in hopes that these
+ * rendering techniques might be used by other programmers in
+ * applications such as scientific visualization, video gaming, and so
+ * on. If you find value in this software and use its technologies for
+ * another purpose, I would love to hear back from you at bjthinks (at)
+ * gmail (dot) com. If you improve this software and agree to release
+ * your modifications under the below license, I encourage you to fork
+ * the development tree on github and push your modifications. The
+ * Electron Orbital Explorer's development URL is:
+ * https://github.com/bjthinks/orbital-explorer
+ * (This paragraph is not part of the software license and may be
+ * removed.)
+ *
+ * Copyright (c) 2013, Brian W. Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * + Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * + Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SUBDIVISION_CACHE_HH
+#define SUBDIVISION_CACHE_HH
+
+#include <list>
+#include <memory>
+#include <vector>
+
+#include "wavefunction.hh"
+#include "tetrahedralize.hh"
+#include "mesh_cache.hh"
+
+// Finished subdivisions kept in memory, so that going back to an
+// orbital shows it at once, and subdivisions of the orbitals the user
+// might pick next, made on otherwise idle cores. The least recently
+// used are deleted to keep the memory they take under a limit.
+// Each subdivision comes with the orbital it reads, which the cache
+// shares with whoever takes it.
+class SubdivisionCache
+{
+public:
+  // At most max_speculative_ subdivisions are made in advance at once,
+  // by default leaving a core for the rest of the program
+  explicit SubdivisionCache(size_t max_bytes_,
+                            unsigned max_speculative_ =
+                            WorkerPool::hardwareThreads() - 1);
+  ~SubdivisionCache();
+
+  // The subdivision for key, taken out of the cache, with its orbital;
+  // or NULL if there's none. One made in advance may be unfinished, and
+  // is stopped, so that runUntil carries it on.
+  TetrahedralSubdivision *take(const MeshCacheKey &key,
+                               std::shared_ptr<Orbital> &orbital);
+  // Keep a subdivision that isn't working, replacing any under the
+  // same key, and make room for it
+  void put(const MeshCacheKey &key, std::shared_ptr<Orbital> orbital,
+           TetrahedralSubdivision *ts);
+  // Start subdividing each of these orbitals to the given number of
+  // vertices at low priority, unless the cache has it already, in
+  // order until max_speculative_ are working. Each starts from nothing
+  // on its own thread, so this takes no time.
+  void speculate(const std::vector<Orbital> &orbitals, int detail,
+                 unsigned vertices,
+                 TetrahedralSubdivision::Domain domain =
+                 TetrahedralSubdivision::WHOLE_SPACE);
+  // Cancel every speculative subdivision still working, without
+  // waiting for them to stop
+  void cancelSpeculation();
+  // Call now and then: keeps the speculative subdivisions that have
+  // finished, and deletes the cancelled ones that have stopped
+  void poll();
+
+  unsigned long hits() const { return hit_count; }
+  unsigned long misses() const { return miss_count; }
+  // Bytes taken by the finished subdivisions kept
+  size_t memoryUsage() const { return bytes; }
+  unsigned size() const { return recent.size(); }
+
+private:
+  SubdivisionCache(const SubdivisionCache &);
+  SubdivisionCache &operator=(const SubdivisionCache &);
+
+  struct Entry
+  {
+    MeshCacheKey key;
+    std::shared_ptr<Orbital> orbital;
+    TetrahedralSubdivision *ts;
+    size_t bytes;
+  };
+  static void destroy(Entry &entry);
+  void evict();
+
+  const size_t max_bytes;
+  const unsigned max_speculative;
+  // Most recently used first
+  std::list<Entry> recent;
+  size_t bytes;
+  std::vector<Entry> speculative;
+  std::vector<Entry> cancelled;
+  unsigned long hit_count;
+  unsigned long miss_count;
+};
+
+#endif
@@ -0,0 +1,268 @@
+/*
+ * This file is part of the Electron Orbital Explorer. The Electron
+ * Orbital Explorer is distributed under the Simplified BSD License
+ * (also called the "BSD 2-Clause License"), in hopes that these
+ * rendering techniques might be used by other programmers in
+ * applications such as scientific visualization, video gaming, and so
+ * on. If you find value in this software and use its technologies for
+ * another purpose, I would love to hear back from you at bjthinks (at)
+ * gmail (dot) com. If you improve this software and agree to release
+ * your modifications under the below license, I encourage you to fork
+ * the development tree on github and push your modifications. The
+ * Electron Orbital Explorer's development URL is:
+ * https://github.com/bjthinks/orbital-explorer
+ * (This paragraph is not part of the software license and may be
+ * removed.)
+ *
+ * Copyright (c) 2013, Brian W. Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * + Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * + Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstdlib>
+#include <cmath>
+#include <complex>
+#include <vector>
+#include <algorithm>
+
+#include "util.hh"
+#include "vector.hh"
+#include "polynomial.hh"
+#include "tabulated_orbital.hh"
+
+using namespace std;
+
+static double call(const Function<1,double> &f, double x)
+{
+  Vector<1> v;
+  v[0] = x;
+  return f(v);
+}
+
+// Five point central difference
+static double derivative(const Function<1,double> &f, double x, double h)
+{
+  return (call(f, x - 2.0 * h) - 8.0 * call(f, x - h) +
+          8.0 * call(f, x + h) - call(f, x + 2.0 * h)) / (12.0 * h);
+}
+
+// The cubic Hermite interpolant on [0, 1] of values f0, f1 and
+// derivatives d0, d1 (already scaled by the interval width)
+static void hermite(double f0, double d0, double f1, double d1, double c[4])
+{
+  c[0] = f0;
+  c[1] = d0;
+  c[2] = 3.0 * (f1 - f0) - 2.0 * d0 - d1;
+  c[3] = 2.0 * (f0 - f1) + d0 + d1;
+}
+
+static double cubic(const double c[4], double t)
+{
+  return ((c[3] * t + c[2]) * t + c[1]) * t + c[0];
+}
+
+CubicSpline::CubicSpline(const Function<1,double> &f, double a, double b,
+                         double estimated_error)
+{
+  double step = 1e-5 * (b - a);
+  double min_width = 1e-12 * (b - a);
+  knots.push_back(a);
+  bisect(f, a, call(f, a), derivative(f, a, step),
+         b, call(f, b), derivative(f, b, step), estimated_error, step,
+         min_width);
+
+  unsigned n = intervals();
+  bucket_scale = double(n) / (b - a);
+  bucket_start.resize(n);
+  unsigned i = 0;
+  for (unsigned k = 0; k < n; ++k) {
+    double edge = a + double(k) / bucket_scale;
+    while (i + 1 < n && knots[i + 1] <= edge)
+      ++i;
+    bucket_start[k] = i;
+  }
+}
+
+void CubicSpline::bisect(const Function<1,double> &f,
+                         double a, double fa, double da,
+                         double b, double fb, double db,
+                         double estimated_error,
+                         double step, double min_width)
+{
+  double h = b - a;
+  double c[4];
+  hermite(fa, da * h, fb, db * h, c);
+
+  bool good = true;
+  if (h > min_width) {
+    static const double tests[] = { 0.125, 0.25, 0.5, 0.75, 0.875 };
+    for (unsigned k = 0; k < sizeof(tests) / sizeof(tests[0]); ++k)
+      if (fabs(cubic(c, tests[k]) - call(f, a + tests[k] * h)) >
+          estimated_error) {
+        good = false;
+        break;
+      }
+  }
+
+  if (good) {
+    knots.push_back(b);
+    coefficients.insert(coefficients.end(), c, c + 4);
+    inverse_widths.push_back(1.0 / h);
+    return;
+  }
+
+  double m = a + 0.5 * h;
+  double fm = call(f, m);
+  double dm = derivative(f, m, step);
+  bisect(f, a, fa, da, m, fm, dm, estimated_error, step, min_width);
+  bisect(f, m, fm, dm, b, fb, db, estimated_error, step, min_width);
+}
+
+double CubicSpline::operator()(double x) const
+{
+  unsigned n = intervals();
+  double u = (x - knots[0]) * bucket_scale;
+  unsigned i;
+  if (u <= 0.0)
+    i = 0;
+  else if (u >= double(n))
+    i = n - 1;
+  else {
+    i = bucket_start[unsigned(u)];
+    while (i + 1 < n && knots[i + 1] <= x)
+      ++i;
+  }
+  double t = (x - knots[i]) * inverse_widths[i];
+  return cubic(&coefficients[4 * i], t);
+}
+
+namespace {
+
+  class RadialPart : public Function<1,double>
+  {
+  public:
+    explicit RadialPart(const Orbital &o) : orbital(o) {}
+    double operator()(const Vector<1> &x) const
+    {
+      return orbital.radial_part(x[0]);
+    }
+  private:
+    const Orbital &orbital;
+  };
+
+  // The theta part without its factor of sin(theta)^|M|, as a function
+  // of cos(theta); this is a polynomial.
+  class ThetaPart : public Function<1,double>
+  {
+  public:
+    explicit ThetaPart(const Orbital &o) : orbital(o) {}
+    double operator()(const Vector<1> &x) const
+    {
+      return orbital.theta_part(1.0, x[0]);
+    }
+  private:
+    const Orbital &orbital;
+  };
+
+  double sampled_maximum(const Function<1,double> &f, double a, double b)
+  {
+    const int samples = 4096;
+    double largest = 0.0;
+    for (int i = 0; i <= samples; ++i)
+      largest = max(largest,
+                    fabs(call(f, a + (b - a) * double(i) / samples)));
+    // Allow for the peak falling between samples; a guess, so the error
+    // of a TabulatedOrbital is only an estimate
+    return 1.05 * largest;
+  }
+
+}
+
+TabulatedOrbital::TabulatedOrbital(const Orbital &orbital_,
+                                   double estimated_error) :
+  orbital(orbital_), abs_M(abs(orbital_.M))
+{
+  RadialPart radial_part(orbital);
+  ThetaPart theta_part(orbital);
+  double outer = orbital.radius();
+  double radial_max = sampled_maximum(radial_part, 0.0, outer);
+  double theta_max = sampled_maximum(theta_part, -1.0, 1.0);
+
+  // Largest error allowed in val = radial part * theta part, such that
+  // the error after Orbital::combine() is at most estimated_error. Taking
+  // real parts can amplify errors by up to sqrt(2), and squaring by
+  // up to 2 * sqrt(2)^2 * |val|.
+  double scaled = estimated_error * orbital.radialIntegral();
+  double val_error;
+  if (orbital.square)
+    val_error = min(scaled / (8.0 * radial_max * theta_max),
+                    0.5 * sqrt(scaled));
+  else
+    val_error = scaled / sqrt(2.0);
+
+  // Beyond the table the value is zero, so the table must extend far
+  // enough that the radial part is negligible past its end.
+  for (int k = 0; k < 64; ++k) {
+    double tail = 0.0;
+    for (int j = 0; j < 4; ++j)
+      tail = max(tail, fabs(orbital.radial_part(outer * (1.0 + 0.25 * j))));
+    if (tail * theta_max <= val_error)
+      break;
+    outer *= 1.25;
+  }
+
+  // Split the error budget between the two tables, leaving some room
+  // for the product of their errors
+  radial = CubicSpline(radial_part, 0.0, outer,
+                       val_error / (3.0 * theta_max));
+  angular = CubicSpline(theta_part, -1.0, 1.0,
+                        val_error / (3.0 * radial_max));
+}
+
+complex<double> TabulatedOrbital::operator()(const Vector<3> &x) const
+{
+  double x2y2 = x[0] * x[0] + x[1] * x[1];
+
+  double r_xy = sqrt(x2y2);
+  double r = sqrt(x2y2 + x[2] * x[2]);
+  if (r > radial.upper())
+    return 0.0;
+
+  double sin_theta, cos_theta;
+  if (r > 0.0) {
+    sin_theta = r_xy / r;
+    cos_theta = x[2] / r;
+  } else {
+    sin_theta = 0.0;
+    cos_theta = 1.0;
+  }
+
+  double val = radial(r) * angular(cos_theta) * ipow(sin_theta, abs_M);
+  double cos_angle, sin_angle;
+  orbital.phase(x[0], x[1], cos_angle, sin_angle);
+  return orbital.combine(val, cos_angle, sin_angle);
+}
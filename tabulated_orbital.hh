@@ -0,0 +1,114 @@
+/*
+ * This file is part of the Electron Orbital Explorer. The Electron
+ * Orbital Explorer is distributed under the Simplified BSD License
+ * (also called the "BSD 2-Clause License"), in hopes that these
+ * rendering techniques might be used by other programmers in
+ * applications such as scientific visualization, video gaming, and so
+ * on. If you find value in this software and use its technologies for
+ * another purpose, I would love to hear back from you at bjthinks (at)
+ * gmail (dot) com. If you improve this software and agree to release
+ * your modifications under the below license, I encourage you to fork
+ * the development tree on github and push your modifications. The
+ * Electron Orbital Explorer's development URL is:
+ * https://github.com/bjthinks/orbital-explorer
+ * (This paragraph is not part of the software license and may be
+ * removed.)
+ *
+ * Copyright (c) 2013, Brian W. Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * + Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * + Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TABULATED_ORBITAL_HH
+#define TABULATED_ORBITAL_HH
+
+#include <vector>
+
+#include "function.hh"
+#include "wavefunction.hh"
+
+// A piecewise cubic Hermite interpolant of a real function of one
+// variable. Intervals are bisected until the interpolant agrees with
+// the function to within estimated_error at several test points in
+// each one, so the knots are dense only where the function needs
+// them. Between test points the error is estimated, not bounded: a
+// sharp enough peak can hide between them.
+class CubicSpline
+{
+public:
+  CubicSpline() {}
+  CubicSpline(const Function<1,double> &f, double a, double b,
+              double estimated_error);
+  // Outside of [lower(), upper()] this extrapolates the end intervals.
+  double operator()(double x) const;
+  double lower() const { return knots.front(); }
+  double upper() const { return knots.back(); }
+  unsigned intervals() const { return knots.size() - 1; }
+
+private:
+  void bisect(const Function<1,double> &f, double a, double fa, double da,
+              double b, double fb, double db, double estimated_error,
+              double step, double min_width);
+
+  std::vector<double> knots;
+  // Four coefficients per interval of the cubic in t = (x - x_i) / h_i
+  std::vector<double> coefficients;
+  std::vector<double> inverse_widths;
+  // The first interval overlapping each of intervals() equal buckets
+  // of [lower(), upper()], so that lookup takes constant time on
+  // average.
+  std::vector<unsigned> bucket_start;
+  double bucket_scale;
+};
+
+// An orbital evaluated from precomputed tables: a cubic spline of the
+// radial part, and a cubic spline of the theta part as a function of
+// cos(theta), which is multiplied by sin(theta)^|M|. Each sample costs
+// two table lookups and the complex phase. The tables are sized so
+// that the result is estimated to differ from the orbital's by at most
+// estimated_error everywhere. This is an estimate, not a guarantee:
+// the maxima of the two parts are found by sampling, and each spline
+// is only checked at test points, so near a sharp radial peak the
+// actual error can be larger.
+class TabulatedOrbital : public Function<3,std::complex<double> >
+{
+public:
+  TabulatedOrbital(const Orbital &orbital, double estimated_error);
+  std::complex<double> operator()(const Vector<3> &x) const;
+  // Beyond this radius the value is taken to be zero
+  double radius() const { return radial.upper(); }
+  unsigned radialIntervals() const { return radial.intervals(); }
+  unsigned angularIntervals() const { return angular.intervals(); }
+
+private:
+  Orbital orbital;
+  int abs_M;
+  CubicSpline radial;
+  CubicSpline angular;
+};
+
+#endif
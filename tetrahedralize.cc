@@ -47,12 +47,22 @@
 #include <algorithm>
 #include <cmath>
 #include <complex>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 #include "array.hh"
 #include "vector.hh"
 #include "function.hh"
 #include "delaunay.hh"
+#include "sample_cache.hh"
 #include "tetrahedralize.hh"
+#include "mesh_cache.hh"
 
 using namespace std;
 
@@ -77,72 +87,472 @@ static Vector<3> to_color_space(complex<double> x)
   return r;
 }
 
-pair<Vector<3>,double>
-TetrahedralSubdivision::find_worst_point(unsigned tetra)
-{
-  const Simplex<3> &simplex = subdivision.getSimplex(tetra);
-
-  // Worst point so far, and its absolute error
-  Vector<3> worst_point;
-  double worst_point_absolute_error = 0.0;
-
-  // Values of the function at the simplex's vertices
-  vector<Vector<3> > vertex_value(4);
-  for (unsigned i = 0; i < 4; ++i) {
-    const Vector<3> &v = subdivision.getPoint(simplex.formingPoint(i));
-    vertex_value[i] = to_color_space(f(v));
-  }
+// Test points have barycentric coordinates that are multiples of 1/n,
+// excluding the vertices themselves. The coordinates are stored as
+// integer numerators, in the order find_worst_point examines them.
+static const unsigned lattice_denominator = 11;
 
-  // Test points have barycentric coordinates that are multiples of 1/n
-  const unsigned n = 11;
-  unsigned bary[4];
-  Vector<3> p0, p1, test_point(0.0);
-  for (bary[0] = 0; bary[0] < n; ++bary[0]) {
-    p0 = (double(bary[0]) / double(n))
-      * subdivision.getPoint(simplex.formingPoint(0));
+static vector<Array<4,unsigned> > make_barycentric_lattice()
+{
+  const unsigned n = lattice_denominator;
+  vector<Array<4,unsigned> > lattice;
+  Array<4,unsigned> bary;
+  for (bary[0] = 0; bary[0] < n; ++bary[0])
     for (bary[1] = 0; bary[1] <= n - bary[0]; ++bary[1]) {
       if (bary[1] == n)
         continue;
-      p1 = p0 + (double(bary[1]) / double(n))
-        * subdivision.getPoint(simplex.formingPoint(1));
-      for (bary[2] = 0; bary[2] <= n - bary[0] - bary[1];
-           ++bary[2]) {
+      for (bary[2] = 0; bary[2] <= n - bary[0] - bary[1]; ++bary[2]) {
         if (bary[2] == n)
           continue;
-
         bary[3] = n - bary[0] - bary[1] - bary[2];
         if (bary[3] == n)
           continue;
+        lattice.push_back(bary);
+      }
+    }
+  return lattice;
+}
 
-        // Calculate the location of this test point
-        test_point = p1;
-        for (unsigned i = 2; i < 4; ++i) {
-          double c = double(bary[i]) / double(n);
-          const Vector<3> &v = subdivision.getPoint(simplex.formingPoint(i));
-          test_point += c * v;
-        }
+static const vector<Array<4,unsigned> > barycentric_lattice =
+  make_barycentric_lattice();
 
-        // Is it worse than the worst so far?
-        Vector<3> actual_value = to_color_space(f(test_point));
-        Vector<3> interpolated_value;
-        interpolated_value = 0.0;
-        for (unsigned i = 0; i < 4; ++i) {
-          double c = double(bary[i]) / double(n);
-          interpolated_value += c * vertex_value[i];
-        }
-        double test_point_absolute_error =
-          norm(actual_value - interpolated_value);
-        if (test_point_absolute_error > worst_point_absolute_error) {
-          worst_point_absolute_error = test_point_absolute_error;
-          worst_point = test_point;
+// f at a single point, through the same batch interface as the test
+// points, so the vertex values match what the estimators would compute
+static complex<double> evaluate_at(const Function<3,complex<double> > &f,
+                                   const Vector<3> &x)
+{
+  double xs[1] = { x[0] }, ys[1] = { x[1] }, zs[1] = { x[2] };
+  const double *coords[3] = { xs, ys, zs };
+  complex<double> value;
+  f.evaluate(coords, 1, &value);
+  return value;
+}
+
+// f at the vertices of a tetrahedron, unless they are already known
+static void vertex_values(const Function<3,complex<double> > &f,
+                          const Vector<3> vertex[4],
+                          const complex<double> *known,
+                          complex<double> values[4])
+{
+  if (known) {
+    for (unsigned i = 0; i < 4; ++i)
+      values[i] = known[i];
+    return;
+  }
+  double xs[4], ys[4], zs[4];
+  for (unsigned i = 0; i < 4; ++i) {
+    xs[i] = vertex[i][0];
+    ys[i] = vertex[i][1];
+    zs[i] = vertex[i][2];
+  }
+  const double *coords[3] = { xs, ys, zs };
+  f.evaluate(coords, 4, values);
+}
+
+static const unsigned tetrahedron_edges[6][2] = {
+  { 0, 1 }, { 0, 2 }, { 0, 3 }, { 1, 2 }, { 1, 3 }, { 2, 3 }
+};
+
+// Which face (0 to 3, named by the vertex not on it) or edge (4 plus
+// its index in tetrahedron_edges) each test point is on, or -1 for
+// test points inside the tetrahedron
+static vector<int> make_lattice_supports()
+{
+  vector<int> supports;
+  for (unsigned t = 0; t < barycentric_lattice.size(); ++t) {
+    const Array<4,unsigned> &bary = barycentric_lattice[t];
+    unsigned zeros = 0, zero = 0;
+    for (unsigned i = 0; i < 4; ++i)
+      if (bary[i] == 0) {
+        ++zeros;
+        zero = i;
+      }
+    if (zeros == 0) {
+      supports.push_back(-1);
+    } else if (zeros == 1) {
+      supports.push_back(zero);
+    } else {
+      unsigned e;
+      for (e = 0; e < 6; ++e)
+        if (bary[tetrahedron_edges[e][0]] != 0 &&
+            bary[tetrahedron_edges[e][1]] != 0)
+          break;
+      supports.push_back(4 + e);
+    }
+  }
+  return supports;
+}
+
+static const vector<int> lattice_supports = make_lattice_supports();
+
+pair<Vector<3>,double>
+worstTestPoint(const Function<3,complex<double> > &f,
+               const Vector<3> vertex[4], bool single_precision,
+               const complex<double> *known_vertex_values,
+               const unsigned *vertex_ids, SampleCache *cache)
+{
+  const unsigned n = lattice_denominator;
+  const unsigned num_tests = barycentric_lattice.size();
+  if (!vertex_ids)
+    cache = NULL;
+  if (cache && cache->edgeSamples() != n - 1)
+    throw logic_error("worstTestPoint: sample cache has the wrong lattice");
+
+  // With vertex numbers, add up the vertices in increasing order of
+  // vertex number, so that a point on a face or edge comes out the
+  // same in every tetrahedron containing it
+  unsigned order[4] = { 0, 1, 2, 3 };
+  if (vertex_ids)
+    for (unsigned i = 1; i < 4; ++i)
+      for (unsigned j = i; j > 0 && vertex_ids[order[j]] <
+             vertex_ids[order[j - 1]]; --j)
+        swap(order[j], order[j - 1]);
+
+  vector<double> xs(num_tests), ys(num_tests), zs(num_tests);
+  for (unsigned t = 0; t < num_tests; ++t) {
+    const Array<4,unsigned> &bary = barycentric_lattice[t];
+    Vector<3> test_point =
+      (double(bary[order[0]]) / double(n)) * vertex[order[0]];
+    for (unsigned k = 1; k < 4; ++k)
+      test_point += (double(bary[order[k]]) / double(n)) * vertex[order[k]];
+    xs[t] = test_point[0];
+    ys[t] = test_point[1];
+    zs[t] = test_point[2];
+  }
+
+  // Take what we can from the cache, and evaluate the rest in one batch
+  vector<complex<double> > values(num_tests);
+  vector<unsigned> needed;
+  // Samples on the faces, then the edges, in the cache's order
+  vector<complex<double> > boundary;
+  vector<unsigned> boundary_index;
+  unsigned base[10];
+  bool known[10];
+  Face<3> face[4];
+  Face<2> edge[6];
+  if (cache) {
+    unsigned fs = cache->faceSamples(), es = cache->edgeSamples();
+    boundary.resize(4 * fs + 6 * es);
+    boundary_index.resize(num_tests);
+    needed.reserve(num_tests);
+    // The vertices of each face and edge in the cache's order, which
+    // is the order of vertex number
+    unsigned face_vertex[4][3], edge_vertex[6][2];
+    for (unsigned skip = 0; skip < 4; ++skip) {
+      for (unsigned k = 0, j = 0; k < 4; ++k)
+        if (order[k] != skip) {
+          face_vertex[skip][j] = order[k];
+          face[skip].points[j++] = vertex_ids[order[k]];
         }
+      base[skip] = skip * fs;
+      known[skip] = cache->lookup(face[skip], &boundary[base[skip]]);
+    }
+    for (unsigned e = 0; e < 6; ++e) {
+      unsigned i = tetrahedron_edges[e][0], j = tetrahedron_edges[e][1];
+      if (vertex_ids[j] < vertex_ids[i])
+        swap(i, j);
+      edge_vertex[e][0] = i;
+      edge_vertex[e][1] = j;
+      edge[e].points[0] = vertex_ids[i];
+      edge[e].points[1] = vertex_ids[j];
+      base[4 + e] = 4 * fs + e * es;
+      known[4 + e] = cache->lookup(edge[e], &boundary[base[4 + e]]);
+    }
+    for (unsigned t = 0; t < num_tests; ++t) {
+      int s = lattice_supports[t];
+      if (s < 0) {
+        needed.push_back(t);
+        continue;
+      }
+      const Array<4,unsigned> &bary = barycentric_lattice[t];
+      unsigned slot = s < 4 ?
+        cache->faceSlot(bary[face_vertex[s][0]], bary[face_vertex[s][1]]) :
+        cache->edgeSlot(bary[edge_vertex[s - 4][0]]);
+      boundary_index[t] = base[s] + slot;
+      if (known[s])
+        values[t] = boundary[boundary_index[t]];
+      else
+        needed.push_back(t);
+    }
+  } else {
+    needed.resize(num_tests);
+    for (unsigned t = 0; t < num_tests; ++t)
+      needed[t] = t;
+  }
+
+  unsigned num_needed = needed.size();
+  if (single_precision && num_needed > 0) {
+    // The vertex values anchor the interpolation, so they stay in
+    // double precision; the test points only need to be ranked.
+    vector<float> fxs(num_needed), fys(num_needed), fzs(num_needed);
+    for (unsigned i = 0; i < num_needed; ++i) {
+      fxs[i] = xs[needed[i]];
+      fys[i] = ys[needed[i]];
+      fzs[i] = zs[needed[i]];
+    }
+    const float *fcoords[3] = { &fxs[0], &fys[0], &fzs[0] };
+    vector<complex<float> > fvalues(num_needed);
+    f.evaluate(fcoords, num_needed, &fvalues[0]);
+    for (unsigned i = 0; i < num_needed; ++i)
+      values[needed[i]] = complex<double>(fvalues[i]);
+  } else if (num_needed == num_tests) {
+    const double *coords[3] = { &xs[0], &ys[0], &zs[0] };
+    f.evaluate(coords, num_tests, &values[0]);
+  } else if (num_needed > 0) {
+    vector<double> nxs(num_needed), nys(num_needed), nzs(num_needed);
+    for (unsigned i = 0; i < num_needed; ++i) {
+      nxs[i] = xs[needed[i]];
+      nys[i] = ys[needed[i]];
+      nzs[i] = zs[needed[i]];
+    }
+    const double *coords[3] = { &nxs[0], &nys[0], &nzs[0] };
+    vector<complex<double> > nvalues(num_needed);
+    f.evaluate(coords, num_needed, &nvalues[0]);
+    for (unsigned i = 0; i < num_needed; ++i)
+      values[needed[i]] = nvalues[i];
+  }
+
+  // Remember the faces and edges that weren't in the cache
+  if (cache) {
+    for (unsigned t = 0; t < num_tests; ++t) {
+      int s = lattice_supports[t];
+      if (s >= 0 && !known[s])
+        boundary[boundary_index[t]] = values[t];
+    }
+    for (unsigned skip = 0; skip < 4; ++skip)
+      if (!known[skip])
+        cache->store(face[skip], &boundary[base[skip]]);
+    for (unsigned e = 0; e < 6; ++e)
+      if (!known[4 + e])
+        cache->store(edge[e], &boundary[base[4 + e]]);
+  }
+
+  complex<double> vvalues[4];
+  vertex_values(f, vertex, known_vertex_values, vvalues);
+
+  Vector<3> vertex_value[4];
+  for (unsigned i = 0; i < 4; ++i)
+    vertex_value[i] = to_color_space(vvalues[i]);
+
+  // Worst point so far, and its absolute error
+  unsigned worst_test = 0;
+  double worst_point_absolute_error = 0.0;
+
+  for (unsigned t = 0; t < num_tests; ++t) {
+    const Array<4,unsigned> &bary = barycentric_lattice[t];
+
+    // Is it worse than the worst so far?
+    Vector<3> actual_value = to_color_space(values[t]);
+    Vector<3> interpolated_value;
+    interpolated_value = 0.0;
+    for (unsigned i = 0; i < 4; ++i) {
+      double c = double(bary[i]) / double(n);
+      interpolated_value += c * vertex_value[i];
+    }
+    double test_point_absolute_error =
+      norm(actual_value - interpolated_value);
+    if (test_point_absolute_error > worst_point_absolute_error) {
+      worst_point_absolute_error = test_point_absolute_error;
+      worst_test = t;
+    }
+  }
+
+  Vector<3> worst_point;
+  worst_point[0] = xs[worst_test];
+  worst_point[1] = ys[worst_test];
+  worst_point[2] = zs[worst_test];
+
+  return make_pair(worst_point, worst_point_absolute_error);
+}
+
+pair<Vector<3>,double>
+quadraticWorstPoint(const Function<3,complex<double> > &f,
+                    const Vector<3> vertex[4],
+                    const complex<double> *known_vertex_values)
+{
+  const unsigned (*edges)[2] = tetrahedron_edges;
+
+  double xs[6], ys[6], zs[6];
+  for (unsigned e = 0; e < 6; ++e) {
+    Vector<3> midpoint = 0.5 * (vertex[edges[e][0]] + vertex[edges[e][1]]);
+    xs[e] = midpoint[0];
+    ys[e] = midpoint[1];
+    zs[e] = midpoint[2];
+  }
+  const double *coords[3] = { xs, ys, zs };
+  complex<double> values[6];
+  f.evaluate(coords, 6, values);
+  complex<double> vvalues[4];
+  vertex_values(f, vertex, known_vertex_values, vvalues);
+
+  Vector<3> vertex_value[4];
+  for (unsigned i = 0; i < 4; ++i)
+    vertex_value[i] = to_color_space(vvalues[i]);
+  Vector<3> second_difference[6];
+  for (unsigned e = 0; e < 6; ++e)
+    second_difference[e] = 4.0 * (to_color_space(values[e]) -
+                                  0.5 * (vertex_value[edges[e][0]] +
+                                         vertex_value[edges[e][1]]));
+
+  const unsigned n = lattice_denominator;
+  const unsigned num_tests = barycentric_lattice.size();
+  unsigned worst_test = 0;
+  double worst_point_absolute_error = 0.0;
+
+  for (unsigned t = 0; t < num_tests; ++t) {
+    const Array<4,unsigned> &bary = barycentric_lattice[t];
+    Vector<3> model_error;
+    model_error = 0.0;
+    for (unsigned e = 0; e < 6; ++e) {
+      double c = double(bary[edges[e][0]] * bary[edges[e][1]]) /
+        double(n * n);
+      model_error += c * second_difference[e];
+    }
+    double test_point_absolute_error = norm(model_error);
+    if (test_point_absolute_error > worst_point_absolute_error) {
+      worst_point_absolute_error = test_point_absolute_error;
+      worst_test = t;
+    }
+  }
+
+  const Array<4,unsigned> &bary = barycentric_lattice[worst_test];
+  Vector<3> worst_point = (double(bary[0]) / double(n)) * vertex[0];
+  for (unsigned i = 1; i < 4; ++i)
+    worst_point += (double(bary[i]) / double(n)) * vertex[i];
+
+  return make_pair(worst_point, worst_point_absolute_error);
+}
+
+pair<Vector<3>,double>
+adaptiveWorstPoint(const Function<3,complex<double> > &f,
+                   const Vector<3> vertex[4], unsigned budget,
+                   const complex<double> *known_vertex_values)
+{
+  // Candidates at the current level, as barycentric numerators over
+  // denominator
+  vector<Array<4,unsigned> > candidates;
+  unsigned denominator = 3;
+  Array<4,unsigned> bary;
+  for (bary[0] = 0; bary[0] <= 3; ++bary[0])
+    for (bary[1] = 0; bary[0] + bary[1] <= 3; ++bary[1])
+      for (bary[2] = 0; bary[0] + bary[1] + bary[2] <= 3; ++bary[2]) {
+        bary[3] = 3 - bary[0] - bary[1] - bary[2];
+        if (bary[0] != 3 && bary[1] != 3 && bary[2] != 3 && bary[3] != 3)
+          candidates.push_back(bary);
       }
+
+  // Vertex values
+  complex<double> vvalues[4];
+  vertex_values(f, vertex, known_vertex_values, vvalues);
+  Vector<3> vertex_value[4];
+  for (unsigned i = 0; i < 4; ++i)
+    vertex_value[i] = to_color_space(vvalues[i]);
+  unsigned spent = known_vertex_values ? 0 : 4;
+
+  Array<4,unsigned> worst_bary;
+  unsigned worst_denominator = 0;
+  double worst_point_absolute_error = 0.0;
+  vector<double> xs, ys, zs;
+  vector<complex<double> > values;
+
+  for (;;) {
+    // Evaluate this level's candidates in one batch
+    unsigned num = candidates.size();
+    xs.resize(num);
+    ys.resize(num);
+    zs.resize(num);
+    values.resize(num);
+    for (unsigned t = 0; t < num; ++t) {
+      Vector<3> p = (double(candidates[t][0]) / denominator) * vertex[0];
+      for (unsigned i = 1; i < 4; ++i)
+        p += (double(candidates[t][i]) / denominator) * vertex[i];
+      xs[t] = p[0];
+      ys[t] = p[1];
+      zs[t] = p[2];
     }
+    const double *coords[3] = { &xs[0], &ys[0], &zs[0] };
+    f.evaluate(coords, num, &values[0]);
+    spent += num;
+
+    double previous_worst = worst_point_absolute_error;
+    for (unsigned t = 0; t < num; ++t) {
+      Vector<3> interpolated_value;
+      interpolated_value = 0.0;
+      for (unsigned i = 0; i < 4; ++i)
+        interpolated_value +=
+          (double(candidates[t][i]) / denominator) * vertex_value[i];
+      double error = norm(to_color_space(values[t]) - interpolated_value);
+      if (error > worst_point_absolute_error) {
+        worst_point_absolute_error = error;
+        worst_bary = candidates[t];
+        worst_denominator = denominator;
+      }
+    }
+
+    // Stop once refining no longer finds anything noticeably worse
+    if (denominator > 3 &&
+        worst_point_absolute_error <= 1.05 * previous_worst)
+      break;
+    if (worst_denominator == 0)
+      break;
+
+    // The neighbors of the worst point on a lattice of half the
+    // spacing: move 1 / (2 * denominator) from one vertex to another
+    unsigned next = 2 * worst_denominator;
+    candidates.clear();
+    for (unsigned i = 0; i < 4; ++i)
+      for (unsigned j = 0; j < 4; ++j) {
+        if (i == j || worst_bary[j] == 0)
+          continue;
+        Array<4,unsigned> b;
+        for (unsigned k = 0; k < 4; ++k)
+          b[k] = 2 * worst_bary[k];
+        ++b[i];
+        --b[j];
+        if (b[i] == next)
+          continue;
+        candidates.push_back(b);
+      }
+    if (candidates.empty() || spent + candidates.size() > budget)
+      break;
+    denominator = next;
+  }
+
+  Vector<3> worst_point;
+  if (worst_denominator == 0) {
+    // f is exactly linear here, as far as we can tell
+    worst_point = 0.25 * (vertex[0] + vertex[1] + vertex[2] + vertex[3]);
+  } else {
+    worst_point = (double(worst_bary[0]) / worst_denominator) * vertex[0];
+    for (unsigned i = 1; i < 4; ++i)
+      worst_point += (double(worst_bary[i]) / worst_denominator) * vertex[i];
   }
 
   return make_pair(worst_point, worst_point_absolute_error);
 }
 
+pair<Vector<3>,double>
+TetrahedralSubdivision::find_worst_point(unsigned tetra)
+{
+  const Simplex<3> &simplex = subdivision.getSimplex(tetra);
+
+  // The vertex values were computed when the vertices were added
+  Vector<3> vertex[4];
+  complex<double> value[4];
+  unsigned id[4];
+  for (unsigned i = 0; i < 4; ++i) {
+    id[i] = simplex.formingPoint(i);
+    vertex[i] = subdivision.getPoint(id[i]);
+    value[i] = subdivision.getPayload(id[i]);
+  }
+
+  if (estimator == QUADRATIC)
+    return quadraticWorstPoint(f, vertex, value);
+  if (estimator == ADAPTIVE)
+    return adaptiveWorstPoint(f, vertex, sample_budget, value);
+  return worstTestPoint(f, vertex, single_precision, value, id, sample_cache);
+}
+
 bool TetrahedralSubdivision::isBoundary(unsigned tetra)
 {
   const Simplex<3> &simplex = subdivision.getSimplex(tetra);
@@ -155,15 +565,21 @@ bool TetrahedralSubdivision::isBoundary(unsigned tetra)
   return i < 4;
 }
 
-void TetrahedralSubdivision::handleNewTetrahedron(unsigned tetra)
+bool TetrahedralSubdivision::evaluateTetrahedron(unsigned tetra,
+                                                 TetraHeapItem &item)
 {
   // It might have already been subdivided
   if (!subdivision.hasSimplex(tetra))
-    return;
+    return false;
 
   // Ignore tetrahedra that go way out to the giant radius
   if (isBoundary(tetra))
-    return;
+    return false;
+
+  if (lazy) {
+    estimateTetrahedron(tetra, item);
+    return true;
+  }
 
   // Find the worst point in this tetrahedron
   pair<Vector<3>,double> worst = find_worst_point(tetra);
@@ -174,13 +590,166 @@ void TetrahedralSubdivision::handleNewTetrahedron(unsigned tetra)
 
   double error = pow(worst_point_absolute_error, 2.0) * volume;
 
-  heap_of_tetrahedra.push_back(TetraHeapItem(error, tetra, worst_point));
-  push_heap(heap_of_tetrahedra.begin(), heap_of_tetrahedra.end());
+  item = TetraHeapItem(error, tetra, worst_point);
+  return true;
+}
+
+// The linear interpolant's error is usually no more than how far f at
+// the centroid is from the interpolant there, plus how much f varies
+// over the vertices. This guess is cheap, but it isn't a bound: it
+// misses detail that none of the five points see.
+void TetrahedralSubdivision::estimateTetrahedron(unsigned tetra,
+                                                 TetraHeapItem &item)
+{
+  const Simplex<3> &simplex = subdivision.getSimplex(tetra);
+  Vector<3> vertex_value[4];
+  Vector<3> centroid(0.0), average(0.0);
+  for (unsigned i = 0; i < 4; ++i) {
+    unsigned p = simplex.formingPoint(i);
+    vertex_value[i] = to_color_space(subdivision.getPayload(p));
+    centroid += 0.25 * subdivision.getPoint(p);
+    average += 0.25 * vertex_value[i];
+  }
+  double spread = 0.0;
+  for (unsigned i = 0; i < 4; ++i)
+    for (unsigned j = i + 1; j < 4; ++j)
+      spread = max(spread, norm(vertex_value[i] - vertex_value[j]));
+  double deviation =
+    norm(to_color_space(evaluate_at(f, centroid)) - average);
+
+  double error = pow(spread + deviation, 2.0) * simplexVolume(tetra);
+  item = TetraHeapItem(error, tetra, centroid, true);
+}
+
+void TetrahedralSubdivision::pushItem(const TetraHeapItem &item)
+{
+  heap_of_tetrahedra.push(item.tetra, item);
+  // stats() reads these from other threads, but only the worker writes
+  // them, so they needn't be in step with each other or the mesh
+  if (item.estimated)
+    statistics.estimates.fetch_add(1, memory_order_relaxed);
+  else
+    statistics.probes.fetch_add(1, memory_order_relaxed);
+  unsigned long size = heap_of_tetrahedra.size();
+  if (size > statistics.peak_heap_size.load(memory_order_relaxed))
+    statistics.peak_heap_size.store(size, memory_order_relaxed);
+}
+
+void TetrahedralSubdivision::handleNewTetrahedron(unsigned tetra)
+{
+  TetraHeapItem item(0.0, 0, Vector<3>(0.0));
+  if (!evaluateTetrahedron(tetra, item))
+    return;
+
+  pushItem(item);
+}
+
+void TetrahedralSubdivision::evaluate_task(void *evaluation, unsigned i)
+{
+  Evaluation *e = static_cast<Evaluation *>(evaluation);
+  e->valid[i] = e->self->evaluateTetrahedron(e->first + i, e->items[i]);
+}
+
+void TetrahedralSubdivision::handleNewTetrahedra()
+{
+  if (!pool) {
+    for (; examined <= subdivision.maxSimplex(); ++examined)
+      handleNewTetrahedron(examined);
+    return;
+  }
+
+  // Evaluate in parallel, then push onto the heap in order of simplex
+  // number, exactly as the serial loop above would
+  Evaluation e;
+  e.self = this;
+  e.first = examined;
+  unsigned count = subdivision.maxSimplex() + 1 - examined;
+  e.items.resize(count, TetraHeapItem(0.0, 0, Vector<3>(0.0)));
+  e.valid.resize(count);
+  pool->run(evaluate_task, &e, count);
+  for (unsigned i = 0; i < count; ++i)
+    if (e.valid[i])
+      pushItem(e.items[i]);
+  examined += count;
+}
+
+// Whether a simplex is clear of the bounding tetrahedron's vertices
+static bool is_interior(const Simplex<3> &simplex)
+{
+  for (unsigned i = 0; i < 4; ++i)
+    if (simplex.formingPoint(i) < 4)
+      return false;
+  return true;
+}
+
+bool TetrahedralSubdivision::encroachesPlane(const Vector<3> &point,
+                                             unsigned tetra,
+                                             Vector<3> &split,
+                                             unsigned &split_tetra) const
+{
+  // A face of the hull has all but a bounding vertex on the plane. A
+  // point off the plane in its circumsphere would join the bounding
+  // vertex to the points around it, across the plane.
+  set<unsigned> deleted = subdivision.findDeletedSimplices(point, tetra);
+  for (set<unsigned>::const_iterator i = deleted.begin();
+       i != deleted.end(); ++i) {
+    const Simplex<3> &simplex = subdivision.getSimplex(*i);
+    Vector<3> v[3];
+    unsigned n = 0;
+    for (unsigned j = 0; j < 4; ++j)
+      if (simplex.formingPoint(j) >= 4 && n < 3)
+        v[n++] = subdivision.getPoint(simplex.formingPoint(j));
+    if (n != 3 || is_interior(simplex))
+      continue;
+    for (unsigned a = 0; a < 3; ++a) {
+      if (v[0][a] != 0.0 || v[1][a] != 0.0 || v[2][a] != 0.0 ||
+          point[a] == 0.0)
+        continue;
+      // The face's circumcenter is the circumsphere's center dropped
+      // onto the plane. Unless the face is acute, that is on or past
+      // the edge opposite its blunt corner, maybe one on another plane,
+      // so split that edge at its midpoint instead, which stays exactly
+      // on the planes.
+      unsigned blunt = 3;
+      for (unsigned j = 0; j < 3; ++j) {
+        Vector<3> e0 = v[(j + 1) % 3] - v[j], e1 = v[(j + 2) % 3] - v[j];
+        if (dot_product(e0, e1) <= 1e-6 * sqrt(norm_squared(e0) *
+                                               norm_squared(e1)))
+          blunt = j;
+      }
+      if (blunt < 3) {
+        split = 0.5 * (v[(blunt + 1) % 3] + v[(blunt + 2) % 3]);
+      } else {
+        split = simplex.circumcenter();
+        split[a] = 0.0;
+      }
+      split_tetra = *i;
+      return true;
+    }
+  }
+  return false;
 }
 
 TetrahedralSubdivision::
-TetrahedralSubdivision(const Function<3,complex<double> > &f_, double radius) :
-  f(f_), running(false), finished(false), die(false)
+TetrahedralSubdivision(const Function<3,complex<double> > &f_, double radius,
+                       bool single_precision_, Estimator estimator_,
+                       unsigned sample_budget_, Domain domain_,
+                       bool deferred) :
+  f(f_), single_precision(single_precision_), estimator(estimator_),
+  sample_budget(sample_budget_), domain(domain_),
+  stop(false), running(false), finished(false), num_vertices(0), target(0),
+  rolling_back(false), has_failed(false),
+  latest_version(0), pending(NULL), pending_radius(0.0), save_cache(NULL),
+  save_target(0), unsaved(true), undo(false), initial_vertices(0),
+  pool(NULL), sample_cache(NULL), lazy(false), background(false)
+{
+  if (deferred)
+    pending_radius = radius;
+  else
+    start(radius);
+}
+
+void TetrahedralSubdivision::start(double radius)
 {
   // Set up an initial bounding tetrahedron of a large size
   Array<4,Vector<3> > bounding_tetrahedron;
@@ -191,142 +760,722 @@ TetrahedralSubdivision(const Function<3,complex<double> > &f_, double radius) :
   bounding_tetrahedron[3] = Vector3(-big, -big,  big);
 
   // Create a Delaunay triangulation
-  subdivision = Delaunay<3>(bounding_tetrahedron);
+  Array<4,complex<double> > bounding_values;
+  for (unsigned i = 0; i < 4; ++i)
+    bounding_values[i] = evaluate_at(f, bounding_tetrahedron[i]);
+  subdivision = Delaunay<3,complex<double> >(bounding_tetrahedron,
+                                             bounding_values);
+  subdivision.keepUndo(undo);
 
-  // Add some vertices to bound the radius of significance
+  // Add some vertices to bound the radius of significance. Every point
+  // added later is inside the tetrahedra between these, so for an
+  // octant the mesh never crosses the planes bounding it, and
+  // encroachesPlane keeps it up against them.
   Vector<3> point;
-  for (int i=-1; i<=1; i+=2)
-    for (int j=-1; j<=1; j+=2)
-      for (int k=-1; k<=1; k+=2) {
+  int low = domain == OCTANT ? 0 : -1;
+  for (int i=low; i<=1; i+=1-low)
+    for (int j=low; j<=1; j+=1-low)
+      for (int k=low; k<=1; k+=1-low) {
         point[0] = i * radius;
         point[1] = j * radius;
         point[2] = k * radius;
-        subdivision.inefficientAddPoint(point);
+        subdivision.inefficientAddPoint(point, evaluate_at(f, point));
       }
+  startVersions();
 
   // Add tetrahedra to a heap sorted by worst error
   for (examined = 1; examined <= subdivision.maxSimplex(); ++examined)
     handleNewTetrahedron(examined);
+}
+
+TetrahedralSubdivision::
+TetrahedralSubdivision(const Function<3,complex<double> > &f_,
+                       const MappedMesh &saved,
+                       bool single_precision_, Estimator estimator_,
+                       unsigned sample_budget_, Domain domain_) :
+  f(f_), single_precision(single_precision_), estimator(estimator_),
+  sample_budget(sample_budget_), domain(domain_),
+  stop(false), running(false), finished(false), num_vertices(0), target(0),
+  rolling_back(false), has_failed(false),
+  latest_version(0), pending(NULL), pending_radius(0.0), save_cache(NULL),
+  save_key(saved.header().key), save_target(0), unsaved(false),
+  undo(false), initial_vertices(0),
+  pool(NULL), sample_cache(NULL), lazy(false), background(false)
+{
+  restore(saved);
+  startVersions();
+}
+
+TetrahedralSubdivision::
+TetrahedralSubdivision(const Function<3,complex<double> > &f_,
+                       MappedMesh *saved,
+                       bool single_precision_, Estimator estimator_,
+                       unsigned sample_budget_, Domain domain_) :
+  f(f_), single_precision(single_precision_), estimator(estimator_),
+  sample_budget(sample_budget_), domain(domain_),
+  stop(false), running(false), finished(false), num_vertices(0), target(0),
+  rolling_back(false), has_failed(false),
+  latest_version(0), pending(saved), pending_radius(0.0), save_cache(NULL),
+  save_key(saved->header().key), save_target(0), unsaved(false),
+  undo(false), initial_vertices(0),
+  pool(NULL), sample_cache(NULL), lazy(false), background(false)
+{
+  startVersions(*saved);
+}
+
+void TetrahedralSubdivision::restore(const MappedMesh &saved)
+{
+  const MeshFileHeader &header = saved.header();
+  vector<Vector<3> > points(header.num_points);
+  vector<complex<double> > values(header.num_points);
+  for (unsigned p = 0; p < header.num_points; ++p) {
+    for (unsigned i = 0; i < 3; ++i)
+      points[p][i] = saved.points()[3 * p + i];
+    values[p] = complex<double>(saved.values()[2 * p],
+                                saved.values()[2 * p + 1]);
+  }
+  vector<unsigned> indices(header.num_simplices);
+  vector<Array<4,unsigned> > forming_points(header.num_simplices);
+  vector<Array<4,unsigned> > adjacencies(header.num_simplices);
+  for (unsigned s = 0; s < header.num_simplices; ++s) {
+    const MeshSimplex &simplex = saved.simplices()[s];
+    indices[s] = simplex.index;
+    for (unsigned i = 0; i < 4; ++i) {
+      forming_points[s][i] = simplex.forming_point[i];
+      adjacencies[s][i] = simplex.adjacency[i];
+    }
+  }
+  subdivision = Delaunay<3,complex<double> >(points, values, indices,
+                                             forming_points, adjacencies,
+                                             header.max_simplex);
+  subdivision.keepUndo(undo);
+
+  // The heap as it was, so that refining carries on just the same
+  for (unsigned i = 0; i < header.num_heap_items; ++i) {
+    const MeshHeapItem &h = saved.heap()[i];
+    if (!subdivision.hasSimplex(h.tetra))
+      throw std::logic_error("Saved heap item for a nonexistent simplex");
+    TetraHeapItem item(h.error, h.tetra,
+                       Vector3(h.point[0], h.point[1], h.point[2]),
+                       h.estimated != 0);
+    heap_of_tetrahedra.push(item.tetra, item);
+  }
+  examined = subdivision.maxSimplex() + 1;
+}
+
+void TetrahedralSubdivision::startVersions()
+{
+  num_vertices = subdivision.numPoints();
+  initial_vertices = subdivision.numPoints();
+
+  // Version 0 is the empty mesh, and version 1 all of this one
+  VersionMark empty = { 0, 0 };
+  versions.push_back(empty);
+  for (unsigned s = 0; s <= subdivision.maxSimplex(); ++s)
+    if (subdivision.hasSimplex(s) && is_interior(subdivision.getSimplex(s))) {
+      MeshChange change = { s, true };
+      change_log.push_back(change);
+    }
+  VersionMark constructed = { subdivision.numPoints(),
+                              unsigned(change_log.size()) };
+  versions.push_back(constructed);
+  latest_version = 1;
+}
+
+void TetrahedralSubdivision::startVersions(const MappedMesh &saved)
+{
+  const MeshFileHeader &header = saved.header();
+  num_vertices = header.num_points;
+  initial_vertices = header.num_points;
+
+  // Just as startVersions will make them once restored
+  VersionMark empty = { 0, 0 };
+  versions.push_back(empty);
+  change_log.resize(header.num_tetrahedra);
+  for (unsigned t = 0; t < header.num_tetrahedra; ++t) {
+    change_log[t].simplex = saved.tetrahedronIndices()[t];
+    change_log[t].added = true;
+  }
+  VersionMark constructed = { header.num_points, header.num_tetrahedra };
+  versions.push_back(constructed);
+  latest_version = 1;
+}
+
+void TetrahedralSubdivision::buildPending()
+{
+  // Not the mutex, which start takes to push heap items; readers take
+  // this first, so none sees a half built mesh
+  lock_guard<std::mutex> lock(pending_mutex);
+  if (pending) {
+    // A saved subdivision can pass MappedMesh's checks and still not
+    // restore. Rather than throw at whichever thread got here first,
+    // leave an empty mesh, and let failed() tell the owner.
+    try {
+      restore(*pending);
+    } catch (const exception &) {
+      mutex.lock();
+      subdivision = Delaunay<3,complex<double> >();
+      heap_of_tetrahedra = IndexedHeap<TetraHeapItem>();
+      change_log.clear();
+      versions.resize(1);
+      latest_version = 0;
+      num_vertices = 0;
+      initial_vertices = 0;
+      has_failed = true;
+      mutex.unlock();
+    }
+    delete pending;
+    pending = NULL;
+  } else if (pending_radius > 0.0) {
+    start(pending_radius);
+    pending_radius = 0.0;
+  }
+}
+
+void TetrahedralSubdivision::saveTo(const MeshCache *cache,
+                                    const MeshCacheKey &key,
+                                    unsigned vertices)
+{
+  mutex.lock();
+  if (!(key == save_key))
+    unsaved = true;
+  save_cache = cache;
+  save_key = key;
+  save_target = vertices;
+  mutex.unlock();
+}
+
+void TetrahedralSubdivision::saveState(MeshFileContents &contents)
+{
+  buildPending();
+  mutex.lock();
+  unsigned num_points = subdivision.numPoints();
+  contents.vertices.resize(num_points);
+  contents.points.resize(3 * num_points);
+  contents.values.resize(2 * num_points);
+  for (unsigned p = 0; p < num_points; ++p) {
+    const Vector<3> &x = subdivision.getPoint(p);
+    const complex<double> &value = subdivision.getPayload(p);
+    MeshVertex &v = contents.vertices[p];
+    for (unsigned i = 0; i < 3; ++i) {
+      v.pos[i] = x[i];
+      contents.points[3 * p + i] = x[i];
+    }
+    v.rim[0] = value.real();
+    v.rim[1] = value.imag();
+    v.rim[2] = abs(value);
+    contents.values[2 * p] = value.real();
+    contents.values[2 * p + 1] = value.imag();
+  }
+
+  contents.indices.clear();
+  contents.tetrahedron_indices.clear();
+  contents.simplices.clear();
+  for (unsigned s = 0; s <= subdivision.maxSimplex(); ++s) {
+    if (!subdivision.hasSimplex(s))
+      continue;
+    const Simplex<3> &simplex = subdivision.getSimplex(s);
+    MeshSimplex saved;
+    saved.index = s;
+    for (unsigned i = 0; i < 4; ++i) {
+      saved.forming_point[i] = simplex.formingPoint(i);
+      saved.adjacency[i] = simplex.adjacency(i);
+    }
+    contents.simplices.push_back(saved);
+    if (!is_interior(simplex))
+      continue;
+    contents.tetrahedron_indices.push_back(s);
+    for (unsigned i = 0; i < 4; ++i)
+      contents.indices.push_back(simplex.formingPoint(i));
+  }
+  contents.max_simplex = subdivision.maxSimplex();
+  mutex.unlock();
 
-  pthread_mutex_init(&mutex, NULL);
+  contents.heap.resize(heap_of_tetrahedra.size());
+  for (unsigned i = 0; i < heap_of_tetrahedra.size(); ++i) {
+    const TetraHeapItem &item = heap_of_tetrahedra.item(i);
+    MeshHeapItem &h = contents.heap[i];
+    h.error = item.error;
+    for (unsigned j = 0; j < 3; ++j)
+      h.point[j] = item.point[j];
+    h.tetra = item.tetra;
+    h.estimated = item.estimated;
+  }
+}
+
+TetrahedralSubdivision::~TetrahedralSubdivision()
+{
+  kill();
+  delete pending;
+  delete pool;
+  delete sample_cache;
+}
+
+void TetrahedralSubdivision::setThreads(unsigned threads)
+{
+  delete pool;
+  pool = threads > 1 ? new WorkerPool(threads) : NULL;
+}
+
+// At most this many samples are cached at once, about 32 MB worth
+static const size_t sample_cache_capacity = 1 << 21;
+
+void TetrahedralSubdivision::setSampleCache(bool enabled)
+{
+  delete sample_cache;
+  sample_cache = NULL;
+  if (!enabled)
+    return;
+  sample_cache = new SampleCache(lattice_denominator, sample_cache_capacity);
+}
+
+void TetrahedralSubdivision::setLazyEvaluation(bool lazy_)
+{
+  lazy = lazy_;
+}
+
+void TetrahedralSubdivision::setBackground(bool background_)
+{
+  background = background_;
+}
+
+void TetrahedralSubdivision::setRollBack(bool enabled)
+{
+  if (enabled == undo)
+    return;
+  undo = enabled;
+  subdivision.keepUndo(enabled);
+  if (!enabled) {
+    vector<TetraHeapItem>().swap(heap_undo);
+    vector<unsigned>().swap(heap_undo_marks);
+  }
+  // Nothing was kept for the vertices there are now
+  initial_vertices = max(initial_vertices, unsigned(num_vertices));
+}
+
+size_t TetrahedralSubdivision::memoryUsage()
+{
+  buildPending();
+  mutex.lock();
+  size_t bytes = subdivision.memoryUsage() +
+    heap_of_tetrahedra.memoryUsage() +
+    change_log.capacity() * sizeof(MeshChange) +
+    versions.capacity() * sizeof(VersionMark) +
+    heap_undo.capacity() * sizeof(TetraHeapItem) +
+    heap_undo_marks.capacity() * sizeof(unsigned);
+  mutex.unlock();
+  return bytes;
+}
+
+TetrahedralSubdivision::Stats TetrahedralSubdivision::stats()
+{
+  Stats s;
+  s.probes = statistics.probes.load(memory_order_relaxed);
+  s.estimates = statistics.estimates.load(memory_order_relaxed);
+  s.probed_estimates =
+    statistics.probed_estimates.load(memory_order_relaxed);
+  s.pops = statistics.pops.load(memory_order_relaxed);
+  s.peak_heap_size = statistics.peak_heap_size.load(memory_order_relaxed);
+  return s;
 }
 
 bool TetrahedralSubdivision::isRunning()
 {
-  pthread_mutex_lock(&mutex);
-  bool blet = running;
-  pthread_mutex_unlock(&mutex);
-  return blet;
+  return running;
 }
 
 bool TetrahedralSubdivision::isFinished()
 {
-  pthread_mutex_lock(&mutex);
-  bool blet = finished;
-  finished = false;
-  pthread_mutex_unlock(&mutex);
-  return blet;
+  return finished.exchange(false);
 }
 
 void TetrahedralSubdivision::work(unsigned vertices)
 {
-  while (heap_of_tetrahedra.size() > 0 && subdivision.numPoints() < vertices) {
-    TetraHeapItem next_tetrahedron = heap_of_tetrahedra[0];
-    pop_heap(heap_of_tetrahedra.begin(), heap_of_tetrahedra.end());
-    heap_of_tetrahedra.pop_back();
+  buildPending();
+  target = vertices;
+  rolling_back = false;
+  stop = false;
+  subdivide();
+}
+
+bool TetrahedralSubdivision::failed()
+{
+  return has_failed;
+}
+
+bool TetrahedralSubdivision::canContinue()
+{
+  return !stop && !has_failed && heap_of_tetrahedra.size() > 0 &&
+    subdivision.numPoints() < target;
+}
+
+bool TetrahedralSubdivision::canRemove()
+{
+  return !stop && !has_failed && rolling_back &&
+    subdivision.numPoints() > target;
+}
+
+void TetrahedralSubdivision::subdivide()
+{
+  for (;;) {
+    removePoints();
+    addPoints();
+    // Under the mutex, so that runUntil can't change the target unseen,
+    // and wait() can't miss the notification
+    mutex.lock();
+    if (canContinue() || canRemove()) {
+      mutex.unlock();
+      continue;
+    }
+    // Save the mesh, here rather than on whatever thread waits for it;
+    // then check again, in case the target changed meanwhile
+    if (stop || has_failed || !save_cache || !unsaved ||
+        target != save_target)
+      break;
+    const MeshCache *cache = save_cache;
+    MeshCacheKey key = save_key;
+    unsaved = false;
+    mutex.unlock();
+    // Cancelling gives up on the save too, so that whoever waits for
+    // the worker isn't kept waiting for the disk
+    if (!cache->save(key, *this, &stop) && stop) {
+      mutex.lock();
+      unsaved = true;
+      mutex.unlock();
+    }
+  }
+  running = false;
+  finished = true;
+  mutex.unlock();
+  done.notify_all();
+}
+
+// Make the calling thread give way to every other, where priority can
+// be set for one thread
+static void lowerThreadPriority()
+{
+#if defined(__linux__)
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#elif defined(__APPLE__)
+  setpriority(PRIO_DARWIN_THREAD, 0, PRIO_DARWIN_BG);
+#endif
+}
 
-    if (!subdivision.hasSimplex(next_tetrahedron.tetra))
+void TetrahedralSubdivision::runWorker()
+{
+  if (background)
+    lowerThreadPriority();
+  buildPending();
+  subdivide();
+}
+
+void TetrahedralSubdivision::addPoints()
+{
+  // Only ever stop between points, so the heap stays whole
+  while (canContinue()) {
+    TetraHeapItem next_tetrahedron = heap_of_tetrahedra.top();
+    heap_of_tetrahedra.pop();
+
+    // An estimate that made it to the top: search it for real, and
+    // put it back with its actual error
+    if (next_tetrahedron.estimated) {
+      pair<Vector<3>,double> worst =
+        find_worst_point(next_tetrahedron.tetra);
+      double error = pow(worst.second, 2.0) *
+        simplexVolume(next_tetrahedron.tetra);
+      statistics.pops.fetch_add(1, memory_order_relaxed);
+      statistics.probed_estimates.fetch_add(1, memory_order_relaxed);
+      pushItem(TetraHeapItem(error, next_tetrahedron.tetra, worst.first));
       continue;
+    }
 
-    pthread_mutex_lock(&mutex);
-    if (die) {
-      running = false;
-      finished = true;
-      pthread_mutex_unlock(&mutex);
-      return;
+    // For an octant, split a face on a plane the point would break,
+    // or one on another plane that split would, and put the
+    // tetrahedron back to try again
+    Vector<3> point = next_tetrahedron.point;
+    unsigned tetra = next_tetrahedron.tetra;
+    Vector<3> split_point;
+    unsigned split_tetra;
+    bool split = false;
+    while (domain == OCTANT &&
+           encroachesPlane(point, tetra, split_point, split_tetra)) {
+      split = true;
+      point = split_point;
+      tetra = split_tetra;
     }
-    subdivision.addPoint(next_tetrahedron.point,
-                         next_tetrahedron.tetra);
-    pthread_mutex_unlock(&mutex);
+    if (split)
+      heap_of_tetrahedra.push(next_tetrahedron.tetra, next_tetrahedron);
+
+    // The one evaluation of f at the new point; the estimator and the
+    // renderer both read it from the subdivision from now on
+    complex<double> value = evaluate_at(f, point);
+
+    mutex.lock();
+    subdivision.addPoint(point, tetra, value);
+    logChanges();
+    mutex.unlock();
+    statistics.pops.fetch_add(1, memory_order_relaxed);
+    num_vertices = subdivision.numPoints();
+
+    // The heap only ever holds tetrahedra that still exist. Keep the
+    // items taken out, and the one just popped, for rollBackTo.
+    if (undo) {
+      heap_undo_marks.push_back(heap_undo.size());
+      if (!split)
+        heap_undo.push_back(next_tetrahedron);
+    }
+    const vector<unsigned> &deleted = subdivision.lastDeletedSimplexIndices();
+    for (unsigned i = 0; i < deleted.size(); ++i)
+      if (heap_of_tetrahedra.contains(deleted[i])) {
+        if (undo)
+          heap_undo.push_back(heap_of_tetrahedra.get(deleted[i]));
+        heap_of_tetrahedra.remove(deleted[i]);
+      }
+
+    // Forget the samples on faces and edges that just went away
+    if (sample_cache)
+      sample_cache->removeTetrahedra(subdivision.lastDeletedSimplices());
 
     // Add any new tetrahedra to the heap
-    for (; examined <= subdivision.maxSimplex(); ++examined)
-      handleNewTetrahedron(examined);
+    handleNewTetrahedra();
   }
+}
 
-  pthread_mutex_lock(&mutex);
-  running = false;
-  finished = true;
-  pthread_mutex_unlock(&mutex);
+void TetrahedralSubdivision::runUntil(unsigned vertices)
+{
+  startWorker(vertices, false);
 }
 
-static void *start_worker(void *arg)
+bool TetrahedralSubdivision::rollBackTo(unsigned vertices)
 {
-  WorkerThreadData *worker_data = reinterpret_cast<WorkerThreadData *>(arg);
-  worker_data->self->work(worker_data->vertices);
-  return NULL;
+  if (!undo || vertices < initial_vertices)
+    return false;
+  startWorker(vertices, true);
+  return true;
 }
 
-void TetrahedralSubdivision::runUntil(unsigned vertices)
+void TetrahedralSubdivision::startWorker(unsigned vertices, bool remove)
 {
+  mutex.lock();
+  target = vertices;
+  rolling_back = remove;
+  stop = false;
+  // A running worker carries on to the new target
+  if (running) {
+    mutex.unlock();
+    return;
+  }
   running = true;
-  worker_data.self = this;
-  worker_data.vertices = vertices;
-  pthread_create(&worker, NULL, start_worker, &worker_data);
+  mutex.unlock();
+
+  // Only one worker at a time; the last one has finished
+  if (worker.joinable())
+    worker.join();
+  worker = thread(&TetrahedralSubdivision::runWorker, this);
 }
 
-void TetrahedralSubdivision::kill()
+void TetrahedralSubdivision::removePoints()
 {
-  pthread_mutex_lock(&mutex);
-  if (running) {
-    die = true;
-    // Spin until the other thread exits
-    while (running) {
-      pthread_mutex_unlock(&mutex);
-      pthread_mutex_lock(&mutex);
-    }
-    die = false;
+  // Like addPoints, only stop between points
+  bool removed = false;
+  while (canRemove()) {
+    mutex.lock();
+    subdivision.removeLastPoint();
+    logChanges();
+    mutex.unlock();
+    num_vertices = subdivision.numPoints();
+    removed = true;
+
+    // The point's tetrahedra are gone, and those it split are back,
+    // with the heap items they had then
+    const vector<unsigned> &gone = subdivision.lastDeletedSimplexIndices();
+    for (unsigned i = 0; i < gone.size(); ++i)
+      heap_of_tetrahedra.remove(gone[i]);
+    if (sample_cache)
+      sample_cache->removeTetrahedra(subdivision.lastDeletedSimplices());
+    for (unsigned i = heap_undo_marks.back(); i < heap_undo.size(); ++i)
+      heap_of_tetrahedra.push(heap_undo[i].tetra, heap_undo[i]);
+    heap_undo.erase(heap_undo.begin() + heap_undo_marks.back(),
+                    heap_undo.end());
+    heap_undo_marks.pop_back();
   }
-  pthread_mutex_unlock(&mutex);
+  if (removed)
+    examined = subdivision.maxSimplex() + 1;
+}
+
+void TetrahedralSubdivision::cancelAsync()
+{
+  stop = true;
+}
+
+void TetrahedralSubdivision::wait()
+{
+  unique_lock<std::mutex> lock(mutex);
+  while (running)
+    done.wait(lock);
+  lock.unlock();
+  if (worker.joinable())
+    worker.join();
+}
+
+void TetrahedralSubdivision::kill()
+{
+  cancelAsync();
+  wait();
 }
 
 int TetrahedralSubdivision::numVertices()
 {
-  pthread_mutex_lock(&mutex);
-  int n = subdivision.numPoints();
-  pthread_mutex_unlock(&mutex);
-  return n;
+  return num_vertices;
 }
 
 vector<Vector<3> > TetrahedralSubdivision::vertexPositions()
 {
-  pthread_mutex_lock(&mutex);
+  buildPending();
+  mutex.lock();
   unsigned num_points = subdivision.numPoints();
   vector<Vector<3> > vp(num_points);
   for (unsigned p = 0; p < num_points; ++p)
     vp[p] = subdivision.getPoint(p);
-  pthread_mutex_unlock(&mutex);
+  mutex.unlock();
   return vp;
 }
 
+vector<complex<double> > TetrahedralSubdivision::vertexValues()
+{
+  buildPending();
+  mutex.lock();
+  unsigned num_points = subdivision.numPoints();
+  vector<complex<double> > vv(num_points);
+  for (unsigned p = 0; p < num_points; ++p)
+    vv[p] = subdivision.getPayload(p);
+  mutex.unlock();
+  return vv;
+}
+
 vector<unsigned> TetrahedralSubdivision::tetrahedronVertexIndices()
+{
+  buildPending();
+  mutex.lock();
+  vector<unsigned> vi = collectIndices();
+  mutex.unlock();
+  return vi;
+}
+
+vector<unsigned> TetrahedralSubdivision::collectIndices() const
 {
   vector<unsigned> vi;
-  pthread_mutex_lock(&mutex);
   for (unsigned simplex_index = 0;
        simplex_index <= subdivision.maxSimplex();
        ++simplex_index) {
     if (!subdivision.hasSimplex(simplex_index))
       continue;
     const Simplex<3> &simplex = subdivision.getSimplex(simplex_index);
-    unsigned i;
-    for (i = 0; i < 4; ++i)
-      if (simplex.formingPoint(i) < 4)
-        break;
-    if (i != 4) continue;
-    for (i = 0; i < 4; ++i)
+    if (!is_interior(simplex))
+      continue;
+    for (unsigned i = 0; i < 4; ++i)
       vi.push_back(simplex.formingPoint(i));
   }
-  pthread_mutex_unlock(&mutex);
   return vi;
 }
+
+void TetrahedralSubdivision::logChanges()
+{
+  const vector<Simplex<3> > &gone = subdivision.lastDeletedSimplices();
+  const vector<unsigned> &gone_indices =
+    subdivision.lastDeletedSimplexIndices();
+  for (unsigned i = 0; i < gone.size(); ++i)
+    if (is_interior(gone[i])) {
+      MeshChange change = { gone_indices[i], false };
+      change_log.push_back(change);
+    }
+  const vector<unsigned> &added = subdivision.lastAddedSimplexIndices();
+  for (unsigned i = 0; i < added.size(); ++i)
+    if (is_interior(subdivision.getSimplex(added[i]))) {
+      MeshChange change = { added[i], true };
+      change_log.push_back(change);
+    }
+
+  VersionMark mark;
+  mark.points = subdivision.numPoints();
+  mark.changes = change_log.size();
+  versions.push_back(mark);
+  latest_version = versions.size() - 1;
+  unsaved = true;
+}
+
+unsigned TetrahedralSubdivision::version()
+{
+  return latest_version;
+}
+
+MeshDelta TetrahedralSubdivision::changesSince(unsigned since)
+{
+  buildPending();
+  lock_guard<std::mutex> lock(mutex);
+  return collectChanges(since);
+}
+
+bool TetrahedralSubdivision::tryChangesSince(unsigned since, MeshDelta &d)
+{
+  // The mesh construction left to the worker may take a while, and
+  // only ever goes from pending to built
+  unique_lock<std::mutex> building(pending_mutex, try_to_lock);
+  if (!building.owns_lock() || pending || pending_radius > 0.0 ||
+      has_failed)
+    return false;
+  building.unlock();
+  unique_lock<std::mutex> lock(mutex, try_to_lock);
+  if (!lock.owns_lock())
+    return false;
+  d = collectChanges(since);
+  return true;
+}
+
+MeshDelta TetrahedralSubdivision::collectChanges(unsigned since) const
+{
+  MeshDelta d;
+  if (since >= versions.size())
+    throw std::range_error("changesSince: no such version");
+  d.version = versions.size() - 1;
+
+  // Vertices past the fewest there have been since are new
+  d.first_vertex = versions[since].points;
+  for (unsigned v = since + 1; v < versions.size(); ++v)
+    d.first_vertex = min(d.first_vertex, versions[v].points);
+  for (unsigned p = d.first_vertex; p < subdivision.numPoints(); ++p) {
+    d.positions.push_back(subdivision.getPoint(p));
+    d.values.push_back(subdivision.getPayload(p));
+  }
+
+  // For each simplex changed since, in order of first change: whether
+  // it was there then, which it was if first deleted, and whether it
+  // is there now
+  unordered_map<unsigned, unsigned> changed;
+  vector<unsigned> simplices;
+  vector<char> was_there, is_there;
+  for (unsigned i = versions[since].changes; i < change_log.size(); ++i) {
+    const MeshChange &change = change_log[i];
+    unordered_map<unsigned, unsigned>::iterator c =
+      changed.find(change.simplex);
+    if (c != changed.end()) {
+      is_there[c->second] = change.added;
+      continue;
+    }
+    changed[change.simplex] = simplices.size();
+    simplices.push_back(change.simplex);
+    was_there.push_back(!change.added);
+    is_there.push_back(change.added);
+  }
+  for (unsigned i = 0; i < simplices.size(); ++i) {
+    if (was_there[i])
+      d.removed.push_back(simplices[i]);
+    if (!is_there[i])
+      continue;
+    const Simplex<3> &simplex = subdivision.getSimplex(simplices[i]);
+    d.added.push_back(simplices[i]);
+    for (unsigned j = 0; j < 4; ++j)
+      d.added_indices.push_back(simplex.formingPoint(j));
+  }
+  return d;
+}
@@ -46,8 +46,17 @@
 #ifndef TETRAHEDRALIZE_HH
 #define TETRAHEDRALIZE_HH
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 #include "function.hh"
 #include "delaunay.hh"
+#include "indexed_heap.hh"
+#include "sample_cache.hh"
+#include "workerpool.hh"
+#include "mesh_cache.hh"
 
 // Given a complex-valued function on three dimensional space, an initial
 // radius, and number of vertices, subdivide an initial, large tetrahedron
@@ -59,7 +68,7 @@
 //    number, OR the linear approximation appears to be perfect on each
 //    tatrahedron.
 // 3. The computation takes place in a secondary thread, and can be polled
-//    for whether or not it has finished.
+//    for whether or not it has finished, or cancelled without waiting.
 // This computation may be restarted, hence the need for a class to hold
 // both the tetrahedral subdivision, and the internal data relevant to the
 // subdivision algorithm.
@@ -67,59 +76,391 @@
 // This gets dangerously close to the "create a class to represent a
 // computation" anti-pattern.  :-(
 
-// A helper struct for storing stuff in a maximum priority heap.
+// What changed in the mesh between two versions; see
+// TetrahedralSubdivision::changesSince. Vertices from first_vertex on
+// are replaced by positions; vertices are only removed by rollBackTo,
+// so usually these are just appended. Tetrahedra are named by their
+// simplex numbers, and only those inside the bounding tetrahedron
+// appear. Apply removed before added: after a roll back, a number can
+// be in both, for a different tetrahedron.
+struct MeshDelta
+{
+  // The version this brings the mesh up to
+  unsigned version;
+  unsigned first_vertex;
+  std::vector<Vector<3> > positions;
+  std::vector<std::complex<double> > values;
+  std::vector<unsigned> removed;
+  std::vector<unsigned> added;
+  // Four vertex numbers for each of added
+  std::vector<unsigned> added_indices;
+};
+
+// A helper struct for storing stuff in a maximum priority heap. An
+// estimated item has only a cheap guess at the error, and no point to
+// insert yet.
 struct TetraHeapItem
 {
-  TetraHeapItem(double error_, unsigned tetra_, Vector<3> point_) :
+  TetraHeapItem(double error_, unsigned tetra_, Vector<3> point_,
+                bool estimated_ = false) :
     error(error_),
     tetra(tetra_),
-    point(point_)
+    point(point_),
+    estimated(estimated_)
   {}
   double error;
   unsigned tetra;
   Vector<3> point;
+  bool estimated;
   bool operator<(const struct TetraHeapItem &rhs) const
   {
     return error < rhs.error;
   }
 };
 
-class TetrahedralSubdivision;
-struct WorkerThreadData
-{
-  TetrahedralSubdivision *self;
-  unsigned vertices;
-};
+// Of the test points of the tetrahedron with the given vertices, the
+// one where linear interpolation of f from the vertices is worst, and
+// the error there. With single_precision set, f is evaluated at the
+// test points in single precision, which is enough to rank them; the
+// vertex values are always double precision. If the values of f at
+// the vertices are already known, pass them as vertex_values and f
+// won't be evaluated there; this goes for the estimators below too.
+// Given the vertices' numbers in a mesh and a cache of samples on the
+// mesh's faces and edges, test points on the faces and edges are
+// taken from the cache where possible, and added to it otherwise.
+std::pair<Vector<3>,double>
+worstTestPoint(const Function<3,std::complex<double> > &f,
+               const Vector<3> vertex[4], bool single_precision = false,
+               const std::complex<double> *vertex_values = NULL,
+               const unsigned *vertex_ids = NULL, SampleCache *cache = NULL);
+
+// An estimate of the same thing from only ten evaluations, at the
+// vertices and edge midpoints. These determine a quadratic model of f,
+// and the difference between that and the linear interpolant is
+//   sum over edges ij of 4 lambda_i lambda_j d_ij,
+// where d_ij is how far f at the midpoint of ij is from the average of
+// its ends. The worst point of the model is found on the same lattice
+// of test points, but without evaluating f there.
+std::pair<Vector<3>,double>
+quadraticWorstPoint(const Function<3,std::complex<double> > &f,
+                    const Vector<3> vertex[4],
+                    const std::complex<double> *vertex_values = NULL);
+
+// A coarse-to-fine search for the worst point: evaluate f on a coarse
+// lattice (denominator 3), then repeatedly halve the lattice spacing
+// around the worst point found so far, until the worst error stops
+// growing or budget evaluations have been spent. Where f is smooth
+// this stops after one refinement, at about 30 evaluations.
+std::pair<Vector<3>,double>
+adaptiveWorstPoint(const Function<3,std::complex<double> > &f,
+                   const Vector<3> vertex[4], unsigned budget,
+                   const std::complex<double> *vertex_values = NULL);
 
 class TetrahedralSubdivision
 {
 public:
+  // How to find where to insert the next point in a tetrahedron
+  enum Estimator {
+    LATTICE,   // Evaluate f on a lattice of test points; see worstTestPoint
+    QUADRATIC, // Model f from its second differences along the edges;
+               // see quadraticWorstPoint
+    ADAPTIVE   // Refine a coarse lattice near the worst point, within a
+               // budget of evaluations; see adaptiveWorstPoint
+  };
+  // What to subdivide
+  enum Domain {
+    WHOLE_SPACE, // The cube of side 2 radius centered at the origin
+    OCTANT       // Only its octant x, y, z >= 0, for f with the
+                 // reflection symmetries of Orbital::reflection; the
+                 // mesh is drawn reflected into the other seven (see
+                 // Cloud::setOctantSymmetry)
+  };
+  TetrahedralSubdivision(const Function<3,std::complex<double> > &f_,
+                         double radius, bool single_precision_ = false,
+                         Estimator estimator_ = LATTICE,
+                         unsigned sample_budget_ = 64,
+                         Domain domain_ = WHOLE_SPACE,
+                         bool deferred = false);
+  // With deferred, the initial mesh, which evaluates f at the lattice
+  // of every starting tetrahedron, is left to the worker runUntil
+  // starts, or to whatever call needs it first; until then the mesh is
+  // empty, at version 0.
+
+  // Carry on from a subdivision of f saved with saveState; see
+  // MeshCache. Vertices can't be rolled back past those saved.
+  TetrahedralSubdivision(const Function<3,std::complex<double> > &f_,
+                         const MappedMesh &saved,
+                         bool single_precision_ = false,
+                         Estimator estimator_ = LATTICE,
+                         unsigned sample_budget_ = 64,
+                         Domain domain_ = WHOLE_SPACE);
+  // The same, but taking saved, and leaving the triangulation to be
+  // rebuilt from it by the worker runUntil starts, or by whatever call
+  // needs it first. Construction only copies the saved tetrahedra's
+  // numbers, for version 1, so it's quick enough for the render thread.
   TetrahedralSubdivision(const Function<3,std::complex<double> > &f_,
-                         double radius);
+                         MappedMesh *saved,
+                         bool single_precision_ = false,
+                         Estimator estimator_ = LATTICE,
+                         unsigned sample_budget_ = 64,
+                         Domain domain_ = WHOLE_SPACE);
+  // Bump this when a change would give different meshes, so that those
+  // saved before are no longer used
+  enum { algorithm_version = 2 };
+  // Everything needed to carry on from here later. The subdivision
+  // must not be working.
+  void saveState(MeshFileContents &contents);
+  // Have the worker save the mesh to cache under key when it stops
+  // with its target at this many vertices, unless it was cancelled or
+  // the mesh is saved under key already. cache must outlive the
+  // subdivision. Call this before runUntil or rollBackTo with the same
+  // target, so that a worker stopping at the old one doesn't save
+  // under the new key.
+  void saveTo(const MeshCache *cache, const MeshCacheKey &key,
+              unsigned vertices);
+  // Subdivide in a worker thread until there are this many vertices.
+  // This may be called again, with a higher target, to carry on from
+  // where the subdivision is; a running worker just takes the new
+  // target, and a cancelled one is revived. A lower target than there
+  // are vertices already just stops the worker; see rollBackTo.
   void runUntil(unsigned vertices);
+  // These two, numVertices and version don't lock anything, so they're
+  // cheap enough to poll every frame
   bool isRunning();
   bool isFinished();
+  // Whether a saved subdivision given to the constructor turned out to
+  // be damaged when its triangulation was rebuilt. The mesh is then
+  // empty, at version 0, and the worker does nothing; it's no use but
+  // to delete.
+  bool failed();
+  // Ask the worker to stop after the point it's adding, and return at
+  // once. isRunning says when it has stopped.
+  void cancelAsync();
+  // Block until the worker stops
+  void wait();
+  // cancelAsync, then wait
   void kill();
+  // Like runUntil, but if there are more than this many vertices, the
+  // worker removes the most recently added until there are this many.
+  // As the mesh was refined worst first, these matter least. This
+  // takes time in proportion to the vertices removed, and leaves the
+  // subdivision as it was when it last had this many vertices, so that
+  // runUntil can carry on from there. Only vertices added while
+  // setRollBack was on can be removed; if that isn't enough, this
+  // returns false and does nothing.
+  bool rollBackTo(unsigned vertices);
   int numVertices();
   std::vector<Vector<3> > vertexPositions();
+  // f at each vertex, evaluated once when the vertex was added
+  std::vector<std::complex<double> > vertexValues();
   std::vector<unsigned> tetrahedronVertexIndices();
+  // The mesh's version goes up by one with each vertex added or rolled
+  // back. Version 0 is the empty mesh, so changesSince(0) is the whole
+  // mesh. That takes the mutex, but only for time in proportion to the
+  // changes.
+  unsigned version();
+  MeshDelta changesSince(unsigned version);
+  // The same, but rather than wait for the worker to build the mesh or
+  // finish adding a point, return false at once; for the render
+  // thread, which can try again next frame
+  bool tryChangesSince(unsigned version, MeshDelta &delta);
+
+  ~TetrahedralSubdivision();
+  // Spread the error evaluation of new tetrahedra over this many
+  // threads, counting the subdivision thread itself. The result
+  // doesn't depend on the number of threads. Call this before
+  // runUntil or work.
+  void setThreads(unsigned threads);
+  // Share the LATTICE estimator's test points on faces and edges
+  // between the tetrahedra containing them. This about halves the
+  // evaluations of f, but costs memory and bookkeeping, which for an
+  // Orbital take longer than the evaluations saved; so it's off by
+  // default. The result doesn't depend on it. Call this before
+  // runUntil or work.
+  void setSampleCache(bool enabled);
+  // The cache, or NULL if there is none
+  const SampleCache *sampleCache() const { return sample_cache; }
+  // Instead of searching each new tetrahedron for its worst point
+  // right away, give it an optimistic estimate of its error from its
+  // vertex values and one evaluation at its centroid, and only search
+  // it if it reaches the top of the heap. Tetrahedra that are split
+  // before then are never searched. Off by default. Call this before
+  // runUntil or work.
+  void setLazyEvaluation(bool lazy_);
+  // Run the workers that runUntil starts at the lowest priority, so
+  // that they only take time no one else wants. Meant for subdivisions
+  // made in case they're needed; use setThreads(1) with it, as the
+  // pool's threads keep their priority. Call this before runUntil.
+  void setBackground(bool background_);
+  // Keep what rollBackTo needs to remove each vertex added from now on.
+  // This takes about as much memory again as the mesh, so it's off by
+  // default; turning it off frees it. Call this while the worker isn't
+  // running.
+  void setRollBack(bool enabled);
+
+  struct Stats
+  {
+    Stats() : probes(0), estimates(0), probed_estimates(0), pops(0),
+              peak_heap_size(0) {}
+    // Full searches for a tetrahedron's worst point
+    unsigned long probes;
+    // Tetrahedra given an estimate instead, and how many of those were
+    // searched later anyway
+    unsigned long estimates;
+    unsigned long probed_estimates;
+    // Items taken off the heap, and the most it ever held
+    unsigned long pops;
+    unsigned long peak_heap_size;
+    unsigned long probesAvoided() const
+    {
+      return estimates - probed_estimates;
+    }
+  };
+  Stats stats();
+  // Roughly the bytes allocated for the mesh, its heap and its history
+  size_t memoryUsage();
 
-  // Thread interface only, not for class-external use
+  // runUntil in the calling thread
   void work(unsigned vertices);
 
 private:
+  TetrahedralSubdivision(const TetrahedralSubdivision &);
+  TetrahedralSubdivision &operator=(const TetrahedralSubdivision &);
+  // Error evaluation of new tetrahedra first..maxSimplex(), on the pool
+  struct Evaluation
+  {
+    TetrahedralSubdivision *self;
+    unsigned first;
+    std::vector<TetraHeapItem> items;
+    std::vector<char> valid;
+  };
+  static void evaluate_task(void *evaluation, unsigned i);
+  void handleNewTetrahedra();
+  bool evaluateTetrahedron(unsigned tetra, TetraHeapItem &item);
+  void estimateTetrahedron(unsigned tetra, TetraHeapItem &item);
+  void pushItem(const TetraHeapItem &item);
   double simplexVolume(unsigned tetra) const;
   std::pair<Vector<3>,double> find_worst_point(unsigned tetra);
   bool isBoundary(unsigned tetra);
+  // Whether adding point, which tetra's circumsphere holds, would break
+  // a face of the hull on a plane through the origin, leaving a gap
+  // against it; if so, where to split that face instead, and the
+  // tetrahedron on the face
+  bool encroachesPlane(const Vector<3> &point, unsigned tetra,
+                       Vector<3> &split, unsigned &split_tetra) const;
   void handleNewTetrahedron(unsigned tetra);
+  // Add or remove points until there are target vertices, or stop is
+  // set; then check again under the mutex, in case runUntil or
+  // rollBackTo changed the target
+  void subdivide();
+  // The body of runUntil and rollBackTo, the latter with remove set
+  void startWorker(unsigned vertices, bool remove);
+  // The body of the thread runUntil starts
+  void runWorker();
+  void addPoints();
+  bool canContinue();
+  // Undo addPoints, while rollBackTo asks for fewer vertices
+  void removePoints();
+  bool canRemove();
+  // These don't lock, so only the worker, or a reader holding the mutex,
+  // may call them
+  std::vector<unsigned> collectIndices() const;
+  // Record the changes the last addPoint or removeLastPoint made
+  void logChanges();
+  MeshDelta collectChanges(unsigned since) const;
+  // Set up versions 0 and 1 from a newly made subdivision
+  void startVersions();
+  // Or from a saved one, before its triangulation is rebuilt
+  void startVersions(const MappedMesh &saved);
+  // Make the initial mesh, out to radius
+  void start(double radius);
+  // Rebuild the triangulation and heap from a saved subdivision
+  void restore(const MappedMesh &saved);
+  // Make the mesh construction left to the worker: restore from
+  // pending, or start out to pending_radius. Every call that reads the
+  // triangulation outside the worker does this first.
+  void buildPending();
   const Function<3,std::complex<double> > &f;
-  bool running, finished, die;
-  Delaunay<3> subdivision;
-  std::vector<TetraHeapItem> heap_of_tetrahedra;
+  // Sample test points in single precision
+  const bool single_precision;
+  const Estimator estimator;
+  // Evaluations per tetrahedron for the ADAPTIVE estimator
+  const unsigned sample_budget;
+  const Domain domain;
+  // Set by cancelAsync, and checked by the worker between points
+  std::atomic<bool> stop;
+  std::atomic<bool> running, finished;
+  std::atomic<int> num_vertices;
+  std::atomic<unsigned> target;
+  // Whether the worker may remove vertices to get down to target, as
+  // rollBackTo asks
+  std::atomic<bool> rolling_back;
+  // Set by buildPending if the saved subdivision couldn't be restored
+  std::atomic<bool> has_failed;
+  Delaunay<3,std::complex<double> > subdivision;
+  // Keyed by simplex number, so that the tetrahedra addPoint deletes
+  // can be taken out of it at once
+  IndexedHeap<TetraHeapItem> heap_of_tetrahedra;
   unsigned examined;
-  pthread_t worker;
-  WorkerThreadData worker_data;
-  pthread_mutex_t mutex;
+  std::thread worker;
+  // Guards subdivision against the worker while the mesh is read
+  std::mutex mutex;
+  // Notified when the worker finishes
+  std::condition_variable done;
+  // Every interior simplex added or deleted since construction, in
+  // order, and for each version, the number of points and where its
+  // changes end
+  struct MeshChange
+  {
+    unsigned simplex;
+    bool added;
+  };
+  std::vector<MeshChange> change_log;
+  struct VersionMark
+  {
+    unsigned points;
+    unsigned changes;
+  };
+  std::vector<VersionMark> versions;
+  // versions.size() - 1, for version() to read without the mutex
+  std::atomic<unsigned> latest_version;
+  // The saved subdivision not yet restored, which this owns, or the
+  // radius of the initial mesh not yet made, or 0
+  MappedMesh *pending;
+  double pending_radius;
+  // Held by buildPending, so that callers wait for the worker to build
+  std::mutex pending_mutex;
+  // Where saveTo asked to save, for which target, and whether the mesh
+  // has changed since it was last saved under save_key
+  const MeshCache *save_cache;
+  MeshCacheKey save_key;
+  unsigned save_target;
+  bool unsaved;
+  // Whether setRollBack is on
+  bool undo;
+  // For rollBackTo: the heap items of the tetrahedra each point's
+  // addition deleted, and where each point's items start
+  std::vector<TetraHeapItem> heap_undo;
+  std::vector<unsigned> heap_undo_marks;
+  // The vertices added on construction or before setRollBack, which
+  // stay
+  unsigned initial_vertices;
+  WorkerPool *pool;
+  SampleCache *sample_cache;
+  bool lazy;
+  bool background;
+  // The counts stats() returns, kept by the worker without the mutex
+  struct Counters
+  {
+    Counters() : probes(0), estimates(0), probed_estimates(0), pops(0),
+                 peak_heap_size(0) {}
+    std::atomic<unsigned long> probes;
+    std::atomic<unsigned long> estimates;
+    std::atomic<unsigned long> probed_estimates;
+    std::atomic<unsigned long> pops;
+    std::atomic<unsigned long> peak_heap_size;
+  };
+  Counters statistics;
 };
 
 #endif
@@ -60,6 +60,17 @@ Matrix<4,4> transformTranslation(const Vector<3> &v)
   return m;
 }
 
+Matrix<4,4> transformScale(double s)
+{
+  Matrix<4,4> m(1.0);
+
+  m(0,0) = s;
+  m(1,1) = s;
+  m(2,2) = s;
+
+  return m;
+}
+
 Matrix<4,4> transformRotation(const Quaternion &q)
 {
   double a = q.real();
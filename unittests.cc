@@ -53,6 +53,8 @@
 #include <cfloat>
 #include <cstdio>
 #include <iostream>
+#include <dirent.h>
+#include <unistd.h>
 
 #include "util.hh"
 #include "array.hh"
@@ -61,9 +63,18 @@
 #include "matrix.hh"
 #include "quaternion.hh"
 #include "delaunay.hh"
+#include "indexed_heap.hh"
 #include "function.hh"
 #include "polynomial.hh"
+#include "vecmath.hh"
 #include "wavefunction.hh"
+#include "tabulated_orbital.hh"
+#include "sample_cache.hh"
+#include "tetrahedralize.hh"
+#include "mesh_cache.hh"
+#include "subdivision_cache.hh"
+#include "axial_subdivision.hh"
+#include "workerpool.hh"
 
 using namespace std;
 #include "gtest/gtest.h"
@@ -1825,6 +1836,144 @@ TEST_F(DelaunayTest, AddingPointsOnARegularGridShouldNotThrowInThreeDimensions)
   EXPECT_EQ(u.numPoints(), unsigned((2*k+1)*(2*k+1)+6));
 }
 
+TEST_F(DelaunayTest, PayloadsStayWithTheirPoints)
+{
+  Array<3,Vector<2> > pts;
+  pts[0][0] = -10;
+  pts[0][1] = -10;
+  pts[1][0] = 10;
+  pts[1][1] = -10;
+  pts[2][0] = 0;
+  pts[2][1] = 10;
+  Array<3,int> initial;
+  for (int i = 0; i < 3; ++i)
+    initial[i] = -1 - i;
+  Delaunay<2,int> e(pts, initial);
+  Vector<2> x;
+  srand(0);
+  for (int i = 0; i < 100; ++i) {
+    x[0] = 2.0 * double(rand()) / double(RAND_MAX) - 1.0;
+    x[1] = 2.0 * double(rand()) / double(RAND_MAX) - 1.0;
+    e.inefficientAddPoint(x, i);
+  }
+  ASSERT_EQ(e.numPoints(), 103u);
+  for (int i = 0; i < 3; ++i)
+    EXPECT_EQ(e.getPayload(i), -1 - i);
+  for (int i = 0; i < 100; ++i)
+    EXPECT_EQ(e.getPayload(3 + i), i);
+  EXPECT_THROW(e.getPayload(103), std::range_error);
+}
+
+namespace {
+  // Every simplex's circumsphere is empty, and neighbours agree
+  template <unsigned n, typename P>
+  void expect_valid(const Delaunay<n, P> &e)
+  {
+    for (unsigned s = 0; s <= e.maxSimplex(); ++s) {
+      if (!e.hasSimplex(s))
+        continue;
+      const Simplex<n> &simplex = e.getSimplex(s);
+      for (unsigned p = 0; p < e.numPoints(); ++p)
+        EXPECT_GE(norm_squared(e.getPoint(p) - simplex.circumcenter()),
+                  simplex.radiusSquared() * (1.0 - 1e-9));
+      Array<n + 1, Face<n> > faces = simplex.faces();
+      for (unsigned i = 0; i < n + 1; ++i) {
+        unsigned a = simplex.adjacency(i);
+        if (!a)
+          continue;
+        ASSERT_TRUE(e.hasSimplex(a));
+        Array<n + 1, Face<n> > other_faces = e.getSimplex(a).faces();
+        unsigned j;
+        for (j = 0; j < n + 1; ++j)
+          if (other_faces[j] == faces[i])
+            break;
+        ASSERT_LT(j, n + 1);
+        EXPECT_EQ(s, e.getSimplex(a).adjacency(j));
+      }
+    }
+  }
+
+  // The forming points of each simplex, by simplex number
+  template <unsigned n, typename P>
+  map<unsigned, vector<unsigned> > simplex_points(const Delaunay<n, P> &e)
+  {
+    map<unsigned, vector<unsigned> > sp;
+    for (unsigned s = 0; s <= e.maxSimplex(); ++s)
+      if (e.hasSimplex(s))
+        for (unsigned i = 0; i < n + 1; ++i)
+          sp[s].push_back(e.getSimplex(s).formingPoint(i));
+    return sp;
+  }
+}
+
+TEST_F(DelaunayTest, RemoveLastPointRestoresTheTriangulation)
+{
+  Delaunay<3> u(t);
+  u.keepUndo(true);
+  Vector<3> x;
+  srand(0);
+  map<unsigned, vector<unsigned> > halfway;
+  unsigned halfway_max = 0;
+  for (int i = 0; i < 200; ++i) {
+    if (i == 100) {
+      halfway = simplex_points(u);
+      halfway_max = u.maxSimplex();
+    }
+    x[0] = 2.0 * double(rand()) / double(RAND_MAX) - 1.0;
+    x[1] = 2.0 * double(rand()) / double(RAND_MAX) - 1.0;
+    x[2] = 2.0 * double(rand()) / double(RAND_MAX) - 1.0;
+    u.inefficientAddPoint(x);
+  }
+  expect_valid(u);
+
+  for (int i = 0; i < 100; ++i)
+    u.removeLastPoint();
+  EXPECT_EQ(104u, u.numPoints());
+  EXPECT_EQ(halfway_max, u.maxSimplex());
+  EXPECT_EQ(halfway, simplex_points(u));
+  expect_valid(u);
+
+  // Adding points carries on as usual, and removing them all leaves
+  // the bounding tetrahedron
+  for (int i = 0; i < 50; ++i) {
+    x[0] = double(rand()) / double(RAND_MAX) - 0.5;
+    x[1] = double(rand()) / double(RAND_MAX) - 0.5;
+    x[2] = double(rand()) / double(RAND_MAX) - 0.5;
+    u.inefficientAddPoint(x);
+  }
+  expect_valid(u);
+  for (int i = 0; i < 150; ++i)
+    u.removeLastPoint();
+  EXPECT_EQ(simplex_points(t), simplex_points(u));
+  EXPECT_THROW(u.removeLastPoint(), std::logic_error);
+}
+
+TEST_F(DelaunayTest, RemoveLastPointInTwoDimensions)
+{
+  Delaunay<2> e = d;
+  Vector<2> x;
+  srand(1);
+  for (int i = 0; i < 100; ++i) {
+    x[0] = 0.5 * double(rand()) / double(RAND_MAX) - 0.25;
+    x[1] = 0.5 * double(rand()) / double(RAND_MAX) - 0.25;
+    e.inefficientAddPoint(x);
+  }
+  // Only points added while keeping undo data can be removed
+  EXPECT_THROW(e.removeLastPoint(), std::logic_error);
+  e.keepUndo(true);
+  map<unsigned, vector<unsigned> > before = simplex_points(e);
+  x[0] = 0.1;
+  x[1] = 0.1;
+  e.inefficientAddPoint(x);
+  EXPECT_FALSE(e.lastAddedSimplexIndices().empty());
+  e.removeLastPoint();
+  EXPECT_EQ(before, simplex_points(e));
+  // A point inside makes two more triangles than it deletes
+  EXPECT_EQ(e.lastDeletedSimplexIndices().size(),
+            e.lastAddedSimplexIndices().size() + 2);
+  expect_valid(e);
+}
+
 class TestFunction : public RealFunction<2>
 {
 public:
@@ -2082,6 +2231,62 @@ inline bool operator==(const Quaternion &x, const Quaternion &y)
     x.jmag() == y.jmag() && x.kmag() == y.kmag();
 }
 
+TEST(PolynomialTest, DegreeAndCoefficients)
+{
+  Polynomial x(1., 1);
+  Polynomial f = 3. * x * x * x - 2. * x + 5.;
+  EXPECT_EQ(f.degree(), 3u);
+  EXPECT_EQ(f.coefficient(0), 5.);
+  EXPECT_EQ(f.coefficient(1), -2.);
+  EXPECT_EQ(f.coefficient(2), 0.);
+  EXPECT_EQ(f.coefficient(3), 3.);
+  EXPECT_EQ(f.coefficient(4), 0.);
+  EXPECT_EQ(Polynomial().degree(), 0u);
+}
+
+TEST(CompiledPolynomialTest, Empty)
+{
+  CompiledPolynomial p;
+  EXPECT_EQ(p.degree(), 0u);
+  EXPECT_EQ(p(3.), 0.);
+  EXPECT_EQ(CompiledPolynomial(Polynomial())(3.), 0.);
+}
+
+TEST(CompiledPolynomialTest, MatchesPolynomial)
+{
+  srand(0);
+  for (unsigned d = 0; d <= 20; ++d) {
+    Polynomial f;
+    for (unsigned n = 0; n <= d; ++n)
+      f += Polynomial(double(rand() % 21 - 10), n);
+    f += Polynomial(1., d);
+    CompiledPolynomial g(f);
+    EXPECT_EQ(g.degree(), f.degree());
+    const unsigned count = 50;
+    double xs[count], ys[count];
+    for (unsigned i = 0; i < count; ++i)
+      xs[i] = 2.0 * double(rand()) / double(RAND_MAX) - 1.0;
+    g.evaluate(xs, ys, count);
+    for (unsigned i = 0; i < count; ++i) {
+      double expected = f(xs[i]);
+      double tolerance = 1e-12 * (1.0 + fabs(expected));
+      EXPECT_NEAR(g(xs[i]), expected, tolerance);
+      EXPECT_NEAR(ys[i], expected, tolerance);
+    }
+  }
+}
+
+TEST(CompiledPolynomialTest, ArrayPower)
+{
+  double xs[4] = { 0.0, 1.0, -2.0, 0.5 };
+  double ys[4];
+  for (unsigned y = 0; y < 10; ++y) {
+    ipow(xs, y, ys, 4);
+    for (unsigned i = 0; i < 4; ++i)
+      EXPECT_EQ(ys[i], ipow(xs[i], y));
+  }
+}
+
 class QuaternionTest : public ::testing::Test {
 protected:
   virtual void SetUp()
@@ -2164,3 +2369,1564 @@ TEST(WaveFunctionTest, FactorialTest)
   EXPECT_EQ(factorial(7), 5040.);
   EXPECT_EQ(factorial(8), 40320.);
 }
+
+TEST(VecMathTest, Exp)
+{
+  srand(0);
+  for (int i = 0; i < 10000; ++i) {
+    double x = 1400.0 * double(rand()) / double(RAND_MAX) - 700.0;
+    EXPECT_NEAR(vec_exp(x) / exp(x), 1.0, 1e-15);
+  }
+  EXPECT_EQ(vec_exp(0.0), 1.0);
+}
+
+TEST(VecMathTest, Atan2)
+{
+  srand(0);
+  for (int i = 0; i < 10000; ++i) {
+    double y = 2.0 * double(rand()) / double(RAND_MAX) - 1.0;
+    double x = 2.0 * double(rand()) / double(RAND_MAX) - 1.0;
+    EXPECT_NEAR(vec_atan2(y, x), atan2(y, x), 1e-15);
+  }
+  EXPECT_EQ(vec_atan2(0.0, 0.0), 0.0);
+  EXPECT_EQ(vec_atan2(0.0, 1.0), 0.0);
+  EXPECT_NEAR(vec_atan2(0.0, -1.0), pi, 1e-15);
+  EXPECT_NEAR(vec_atan2(1.0, 0.0), pi / 2.0, 1e-15);
+  EXPECT_NEAR(vec_atan2(-1.0, 0.0), -pi / 2.0, 1e-15);
+}
+
+TEST(VecMathTest, SinCos)
+{
+  srand(0);
+  for (int i = 0; i < 10000; ++i) {
+    // At most M * pi in magnitude
+    double x = 32.0 * pi * double(rand()) / double(RAND_MAX) - 16.0 * pi;
+    double s, c;
+    vec_sincos(x, s, c);
+    EXPECT_NEAR(s, sin(x), 1e-15);
+    EXPECT_NEAR(c, cos(x), 1e-15);
+  }
+}
+
+TEST(WaveFunctionTest, BatchEvaluationMatchesScalar)
+{
+  const int num_points = 100;
+  srand(0);
+  for (int N = 1; N <= 16; ++N)
+    for (int L = 0; L < N; ++L)
+      for (int M = -L; M <= L; ++M)
+        for (int variant = 0; variant < 4; ++variant) {
+          bool real = variant & 1;
+          bool diff = variant & 2;
+          bool square = (N + L + M) & 1;
+          Orbital orbital(1 + (N * L) % 7, N, L, M, real, diff, square);
+          double radius = orbital.radius();
+          vector<double> xs(num_points), ys(num_points), zs(num_points);
+          for (int p = 0; p < num_points; ++p) {
+            xs[p] = radius * (2.0 * double(rand()) / double(RAND_MAX) - 1.0);
+            ys[p] = radius * (2.0 * double(rand()) / double(RAND_MAX) - 1.0);
+            zs[p] = radius * (2.0 * double(rand()) / double(RAND_MAX) - 1.0);
+          }
+          // Include the origin and a point on the z axis
+          xs[0] = ys[0] = zs[0] = 0.0;
+          xs[1] = ys[1] = 0.0;
+          vector<double> re(num_points), im(num_points), mag(num_points);
+          orbital.evaluate(&xs[0], &ys[0], &zs[0], num_points,
+                           &re[0], &im[0], &mag[0]);
+          const double *coords[3] = { &xs[0], &ys[0], &zs[0] };
+          vector<complex<double> > values(num_points);
+          orbital.evaluate(coords, num_points, &values[0]);
+          // The expanded polynomials lose relative precision near their
+          // roots, so compare against the largest value in the sample
+          double largest = 0.0;
+          for (int p = 0; p < num_points; ++p)
+            largest = max(largest, abs(orbital(Vector3(xs[p], ys[p], zs[p]))));
+          double tolerance = 1e-8 * largest;
+          for (int p = 0; p < num_points; ++p) {
+            complex<double> expected = orbital(Vector3(xs[p], ys[p], zs[p]));
+            EXPECT_NEAR(re[p], expected.real(), tolerance);
+            EXPECT_NEAR(im[p], expected.imag(), tolerance);
+            EXPECT_NEAR(mag[p], abs(expected), tolerance);
+            EXPECT_NEAR(values[p].real(), expected.real(), tolerance);
+            EXPECT_NEAR(values[p].imag(), expected.imag(), tolerance);
+          }
+        }
+}
+
+TEST(WaveFunctionTest, SpecializedKernelsMatchGeneric)
+{
+  srand(0);
+  for (int N = 1; N <= 16; ++N)
+    for (int L = 0; L < N; ++L)
+      for (int M = -L; M <= L; ++M) {
+        EXPECT_TRUE(findOrbitalKernel(N, L, abs(M)) != NULL);
+        Orbital generic(3, N, L, M, false, false, false, Orbital::GENERIC);
+        Orbital specialized(3, N, L, M, false, false, false,
+                            Orbital::SPECIALIZED);
+        double radius = generic.radius();
+        vector<Vector<3> > points(50);
+        double largest = 0.0;
+        for (unsigned p = 0; p < points.size(); ++p) {
+          for (unsigned i = 0; i < 3; ++i)
+            points[p][i] =
+              radius * (2.0 * double(rand()) / double(RAND_MAX) - 1.0);
+          largest = max(largest, abs(generic(points[p])));
+        }
+        for (unsigned p = 0; p < points.size(); ++p) {
+          complex<double> expected = generic(points[p]);
+          complex<double> actual = specialized(points[p]);
+          EXPECT_NEAR(actual.real(), expected.real(), 1e-8 * largest);
+          EXPECT_NEAR(actual.imag(), expected.imag(), 1e-8 * largest);
+        }
+      }
+  EXPECT_TRUE(findOrbitalKernel(17, 0, 0) == NULL);
+  EXPECT_TRUE(findOrbitalKernel(2, 2, 0) == NULL);
+  EXPECT_TRUE(findOrbitalKernel(3, 1, 2) == NULL);
+}
+
+TEST(RecurrenceTest, AssocLaguerre)
+{
+  double x[4] = { 0.0, 1.0, 2.5, 7.0 };
+  double result[4];
+  // L_2^1(x) = (x^2 - 6x + 6) / 2
+  assoc_laguerre(2, 1.0, x, result, 4);
+  for (unsigned i = 0; i < 4; ++i)
+    EXPECT_NEAR(result[i], (x[i] * x[i] - 6.0 * x[i] + 6.0) / 2.0, 1e-14);
+  // L_n^a(0) = choose(n + a, n)
+  assoc_laguerre(10, 7.0, x, result, 1);
+  EXPECT_NEAR(result[0], choose(17, 10), 1e-9);
+  // In place
+  assoc_laguerre(0, 3.0, x, x, 4);
+  for (unsigned i = 0; i < 4; ++i)
+    EXPECT_EQ(x[i], 1.0);
+}
+
+TEST(RecurrenceTest, AssocLegendre)
+{
+  double theta[3] = { 0.3, 1.2, 2.9 };
+  double c[3], s[3], result[3];
+  for (unsigned i = 0; i < 3; ++i) {
+    c[i] = cos(theta[i]);
+    s[i] = sin(theta[i]);
+  }
+  assoc_legendre(1, 0, c, s, result, 3);
+  for (unsigned i = 0; i < 3; ++i)
+    EXPECT_NEAR(result[i], sqrt(3.0 / (4.0 * pi)) * c[i], 1e-15);
+  assoc_legendre(1, 1, c, s, result, 3);
+  for (unsigned i = 0; i < 3; ++i)
+    EXPECT_NEAR(result[i], sqrt(3.0 / (8.0 * pi)) * s[i], 1e-15);
+  // Y_3^2 = sqrt(105 / 32pi) sin^2 cos
+  assoc_legendre(3, 2, c, s, result, 3);
+  for (unsigned i = 0; i < 3; ++i)
+    EXPECT_NEAR(result[i], sqrt(105.0 / (32.0 * pi)) * s[i] * s[i] * c[i],
+                1e-14);
+}
+
+TEST(WaveFunctionTest, RecurrenceMatchesGeneric)
+{
+  srand(0);
+  for (int N = 1; N <= 16; ++N)
+    for (int L = 0; L < N; ++L)
+      for (int M = -L; M <= L; ++M) {
+        Orbital generic(3, N, L, M, false, false, false, Orbital::GENERIC);
+        Orbital recurrence(3, N, L, M, false, false, false,
+                           Orbital::RECURRENCE);
+        double radius = generic.radius();
+        const unsigned count = 50;
+        vector<double> xs(count), ys(count), zs(count);
+        vector<double> re(count), im(count), mag(count);
+        double largest = 0.0;
+        for (unsigned p = 0; p < count; ++p) {
+          xs[p] = radius * (2.0 * double(rand()) / double(RAND_MAX) - 1.0);
+          ys[p] = radius * (2.0 * double(rand()) / double(RAND_MAX) - 1.0);
+          zs[p] = radius * (2.0 * double(rand()) / double(RAND_MAX) - 1.0);
+          Vector<3> v;
+          v[0] = xs[p]; v[1] = ys[p]; v[2] = zs[p];
+          largest = max(largest, abs(generic(v)));
+        }
+        recurrence.evaluate(&xs[0], &ys[0], &zs[0], count,
+                            &re[0], &im[0], &mag[0]);
+        for (unsigned p = 0; p < count; ++p) {
+          Vector<3> v;
+          v[0] = xs[p]; v[1] = ys[p]; v[2] = zs[p];
+          complex<double> expected = generic(v);
+          complex<double> actual = recurrence(v);
+          EXPECT_NEAR(actual.real(), expected.real(), 1e-8 * largest);
+          EXPECT_NEAR(actual.imag(), expected.imag(), 1e-8 * largest);
+          EXPECT_NEAR(re[p], expected.real(), 1e-8 * largest);
+          EXPECT_NEAR(im[p], expected.imag(), 1e-8 * largest);
+        }
+      }
+}
+
+namespace {
+  class Sine : public Function<1,double>
+  {
+  public:
+    double operator()(const Vector<1> &x) const { return sin(x[0]); }
+  };
+
+  class Cubic : public Function<1,double>
+  {
+  public:
+    double operator()(const Vector<1> &x) const
+    {
+      return ((2.0 * x[0] - 1.0) * x[0] + 3.0) * x[0] - 5.0;
+    }
+  };
+}
+
+TEST(CubicSplineTest, ExactForCubics)
+{
+  Cubic f;
+  CubicSpline spline(f, -2.0, 3.0, 1e-10);
+  EXPECT_EQ(spline.intervals(), 1u);
+  for (double x = -2.0; x <= 3.0; x += 0.1) {
+    Vector<1> v;
+    v[0] = x;
+    EXPECT_NEAR(spline(x), f(v), 1e-8);
+  }
+}
+
+TEST(CubicSplineTest, MeetsTolerance)
+{
+  Sine f;
+  CubicSpline spline(f, 0.0, 20.0, 1e-9);
+  EXPECT_GT(spline.intervals(), 1u);
+  EXPECT_EQ(spline.lower(), 0.0);
+  EXPECT_EQ(spline.upper(), 20.0);
+  for (double x = 0.0; x <= 20.0; x += 0.001)
+    EXPECT_NEAR(spline(x), sin(x), 1e-9);
+}
+
+TEST(TabulatedOrbitalTest, MeetsEstimatedError)
+{
+  srand(0);
+  static const int orbitals[][4] = {
+    { 1, 1, 0, 0 }, { 1, 3, 2, -1 }, { 2, 7, 3, 3 }, { 1, 12, 5, -4 },
+    { 1, 16, 0, 0 }, { 1, 16, 15, 15 }
+  };
+  for (unsigned k = 0; k < sizeof(orbitals) / sizeof(orbitals[0]); ++k)
+    for (int options = 0; options < 8; ++options) {
+      const int *q = orbitals[k];
+      Orbital orbital(q[0], q[1], q[2], q[3], options & 1, options & 2,
+                      options & 4);
+      const double tolerance = 1e-7;
+      TabulatedOrbital tabulated(orbital, tolerance);
+      // Subdivision samples out to 6 times the radius
+      double radius = 6.0 * orbital.radius();
+      for (unsigned p = 0; p < 2000; ++p) {
+        Vector<3> x;
+        double scale = radius * double(rand()) / double(RAND_MAX);
+        for (unsigned i = 0; i < 3; ++i)
+          x[i] = scale * (2.0 * double(rand()) / double(RAND_MAX) - 1.0);
+        complex<double> expected = orbital(x);
+        complex<double> actual = tabulated(x);
+        EXPECT_NEAR(actual.real(), expected.real(), tolerance);
+        EXPECT_NEAR(actual.imag(), expected.imag(), tolerance);
+      }
+    }
+}
+
+TEST(VecMathTest, IntegerPhase)
+{
+  srand(0);
+  const unsigned count = 100;
+  vector<double> c1(count), s1(count), c(count), s(count);
+  vector<double> cc(count), sc(count);
+  for (unsigned i = 0; i < count; ++i) {
+    double phi = 2.0 * pi * double(rand()) / double(RAND_MAX) - pi;
+    c1[i] = cos(phi);
+    s1[i] = sin(phi);
+  }
+  for (int m = -20; m <= 20; ++m) {
+    vec_unit_power(&c1[0], &s1[0], m, &c[0], &s[0], count);
+    if (m >= 0)
+      vec_chebyshev_phase(&c1[0], &s1[0], m, &cc[0], &sc[0], count);
+    for (unsigned i = 0; i < count; ++i) {
+      double phi = atan2(s1[i], c1[i]);
+      EXPECT_NEAR(c[i], cos(m * phi), 1e-13);
+      EXPECT_NEAR(s[i], sin(m * phi), 1e-13);
+      if (m >= 0) {
+        EXPECT_NEAR(cc[i], cos(m * phi), 1e-13);
+        EXPECT_NEAR(sc[i], sin(m * phi), 1e-13);
+      }
+    }
+  }
+}
+
+TEST(WaveFunctionTest, AlgebraicPhaseMatchesTrigonometric)
+{
+  srand(0);
+  for (int N = 1; N <= 16; ++N)
+    for (int L = 0; L < N; ++L)
+      for (int M = -L; M <= L; ++M)
+        for (int options = 0; options < 8; ++options) {
+          bool real = options & 1, diff = options & 2, square = options & 4;
+          Orbital trig(1, N, L, M, real, diff, square, Orbital::SPECIALIZED,
+                       Orbital::TRIGONOMETRIC);
+          Orbital algebraic(1, N, L, M, real, diff, square,
+                            Orbital::SPECIALIZED, Orbital::ALGEBRAIC);
+          double radius = trig.radius();
+          const unsigned count = 20;
+          vector<double> xs(count), ys(count), zs(count);
+          vector<double> re(count), im(count), mag(count);
+          vector<double> tre(count), tim(count), tmag(count);
+          for (unsigned p = 0; p < count; ++p) {
+            xs[p] = radius * (2.0 * double(rand()) / double(RAND_MAX) - 1.0);
+            ys[p] = radius * (2.0 * double(rand()) / double(RAND_MAX) - 1.0);
+            zs[p] = radius * (2.0 * double(rand()) / double(RAND_MAX) - 1.0);
+          }
+          // Include the z axis, where phi is taken to be zero
+          xs[0] = ys[0] = 0.0;
+          trig.evaluate(&xs[0], &ys[0], &zs[0], count,
+                        &tre[0], &tim[0], &tmag[0]);
+          algebraic.evaluate(&xs[0], &ys[0], &zs[0], count,
+                             &re[0], &im[0], &mag[0]);
+          for (unsigned p = 0; p < count; ++p) {
+            Vector<3> v;
+            v[0] = xs[p]; v[1] = ys[p]; v[2] = zs[p];
+            complex<double> expected = trig(v);
+            complex<double> actual = algebraic(v);
+            EXPECT_NEAR(actual.real(), expected.real(), 1e-12);
+            EXPECT_NEAR(actual.imag(), expected.imag(), 1e-12);
+            EXPECT_NEAR(re[p], tre[p], 1e-12);
+            EXPECT_NEAR(im[p], tim[p], 1e-12);
+            EXPECT_NEAR(mag[p], tmag[p], 1e-12);
+          }
+        }
+}
+
+TEST(VecMathTest, ExpSingle)
+{
+  for (float x = -86.0f; x < 88.0f; x += 0.0137f) {
+    float expected = exp(double(x));
+    EXPECT_NEAR(vec_exp(x), expected, 3e-7f * expected);
+  }
+  EXPECT_EQ(vec_exp(-90.0f), 0.0f);
+  EXPECT_EQ(vec_exp(-1000.0f), 0.0f);
+}
+
+TEST(WaveFunctionTest, SinglePrecisionMatchesDouble)
+{
+  srand(0);
+  for (int N = 1; N <= 16; ++N)
+    for (int L = 0; L < N; ++L)
+      for (int M = -L; M <= L; ++M)
+        for (int options = 0; options < 8; options += 3) {
+          Orbital orbital(1, N, L, M, options & 1, options & 2, options & 4);
+          // Subdivision samples out to 6 times the radius
+          double radius = 6.0 * orbital.radius();
+          const unsigned count = 50;
+          vector<double> xs(count), ys(count), zs(count);
+          vector<float> fxs(count), fys(count), fzs(count);
+          for (unsigned p = 0; p < count; ++p) {
+            double scale = radius * double(rand()) / double(RAND_MAX);
+            fxs[p] = xs[p] =
+              scale * (2.0 * double(rand()) / double(RAND_MAX) - 1.0);
+            fys[p] = ys[p] =
+              scale * (2.0 * double(rand()) / double(RAND_MAX) - 1.0);
+            fzs[p] = zs[p] =
+              scale * (2.0 * double(rand()) / double(RAND_MAX) - 1.0);
+          }
+          const double *coords[3] = { &xs[0], &ys[0], &zs[0] };
+          const float *fcoords[3] = { &fxs[0], &fys[0], &fzs[0] };
+          vector<complex<double> > expected(count);
+          vector<complex<float> > actual(count);
+          orbital.evaluate(coords, count, &expected[0]);
+          orbital.evaluate(fcoords, count, &actual[0]);
+          double largest = 0.0;
+          for (unsigned p = 0; p < count; ++p)
+            largest = max(largest, abs(expected[p]));
+          for (unsigned p = 0; p < count; ++p) {
+            EXPECT_NEAR(actual[p].real(), expected[p].real(),
+                        1e-4 * largest);
+            EXPECT_NEAR(actual[p].imag(), expected[p].imag(),
+                        1e-4 * largest);
+          }
+        }
+}
+
+TEST(FunctionTest, DefaultSinglePrecision)
+{
+  Orbital orbital(1, 3, 2, 1, false, false, false);
+  TabulatedOrbital tabulated(orbital, 1e-9);
+  const Function<3,complex<double> > &f = tabulated;
+  float xs[3] = { 0.5f, -1.0f, 2.0f };
+  float ys[3] = { 1.5f, 0.25f, -3.0f };
+  float zs[3] = { -0.5f, 2.0f, 1.0f };
+  const float *coords[3] = { xs, ys, zs };
+  complex<float> values[3];
+  f.evaluate(coords, 3, values);
+  for (unsigned p = 0; p < 3; ++p) {
+    Vector<3> x;
+    x[0] = xs[p];
+    x[1] = ys[p];
+    x[2] = zs[p];
+    complex<double> expected = f(x);
+    EXPECT_FLOAT_EQ(values[p].real(), expected.real());
+    EXPECT_FLOAT_EQ(values[p].imag(), expected.imag());
+  }
+}
+
+TEST(WaveFunctionTest, AnalyticDerivativesMatchFiniteDifferences)
+{
+  srand(0);
+  static const int orbitals[][4] = {
+    { 1, 1, 0, 0 }, { 1, 2, 1, 1 }, { 1, 3, 2, -1 }, { 2, 4, 3, 2 },
+    { 1, 6, 2, 0 }, { 1, 7, 5, -3 }, { 1, 10, 4, 3 }, { 1, 16, 15, 15 }
+  };
+  for (unsigned k = 0; k < sizeof(orbitals) / sizeof(orbitals[0]); ++k)
+    for (int options = 0; options < 8; ++options) {
+      const int *q = orbitals[k];
+      bool square = options & 4;
+      Orbital orbital(q[0], q[1], q[2], q[3], options & 1, options & 2,
+                      square);
+      double radius = orbital.radius();
+      const double h = 1e-4 * radius;
+      for (unsigned p = 0; p < 20; ++p) {
+        Vector<3> x;
+        for (unsigned i = 0; i < 3; ++i)
+          x[i] = radius * (2.0 * double(rand()) / double(RAND_MAX) - 1.0);
+        complex<double> value;
+        CVector<3> grad;
+        CMatrix<3,3> hess;
+        orbital.derivatives(x, value, grad, hess);
+        complex<double> expected = orbital(x);
+        EXPECT_NEAR(value.real(), expected.real(), 1e-10);
+        EXPECT_NEAR(value.imag(), expected.imag(), 1e-10);
+
+        // Scale for the tolerances: the size of the derivatives
+        double grad_scale = 1e-12, hess_scale = 1e-12;
+        for (unsigned i = 0; i < 3; ++i) {
+          grad_scale = max(grad_scale, abs(grad[i]));
+          for (unsigned j = 0; j < 3; ++j)
+            hess_scale = max(hess_scale, abs(hess(i,j)));
+        }
+        for (unsigned i = 0; i < 3; ++i) {
+          Vector<3> d(0.0);
+          d[i] = h;
+          complex<double> fd = (orbital(x + d) - orbital(x - d)) / (2.0 * h);
+          EXPECT_LT(abs(fd - grad[i]), 1e-5 * grad_scale + 1e-9);
+          // The Hessian of a squared orbital jumps across nodes
+          if (square)
+            continue;
+          for (unsigned j = 0; j < 3; ++j) {
+            Vector<3> e(0.0);
+            e[j] = h;
+            complex<double> fd2 =
+              (orbital(x + d + e) - orbital(x + d - e) -
+               orbital(x - d + e) + orbital(x - d - e)) / (4.0 * h * h);
+            EXPECT_LT(abs(fd2 - hess(i,j)), 1e-4 * hess_scale + 1e-9);
+          }
+        }
+      }
+    }
+}
+
+TEST(WaveFunctionTest, CanonicalOrbitalScalesAndConjugates)
+{
+  srand(0);
+  static const int orbitals[][4] = {
+    { 1, 1, 0, 0 }, { 2, 2, 1, 1 }, { 3, 3, 2, -1 }, { 26, 4, 3, -2 },
+    { 79, 6, 2, 0 }, { 118, 7, 5, -3 }, { 5, 10, 4, 3 }, { 47, 16, 15, -15 }
+  };
+  for (unsigned k = 0; k < sizeof(orbitals) / sizeof(orbitals[0]); ++k)
+    for (int options = 0; options < 8; ++options) {
+      const int *q = orbitals[k];
+      bool real = options & 1;
+      // Real orbitals are made with |M|
+      int m = real ? abs(q[3]) : q[3];
+      Orbital orbital(q[0], q[1], q[2], m, real, options & 2, options & 4);
+      Orbital canonical = orbital.canonical();
+      EXPECT_EQ(1, canonical.Z);
+      EXPECT_GE(canonical.M, 0);
+      EXPECT_EQ(q[3] < 0 && !real, orbital.conjugatesCanonical());
+      double radius = orbital.radius();
+      EXPECT_NEAR(radius * double(q[0]), canonical.radius(), 1e-12 * radius);
+      for (unsigned p = 0; p < 20; ++p) {
+        Vector<3> x;
+        for (unsigned i = 0; i < 3; ++i)
+          x[i] = radius * (2.0 * double(rand()) / double(RAND_MAX) - 1.0);
+        complex<double> expected = orbital(x);
+        complex<double> value =
+          orbital.valueScale() * canonical(x * double(orbital.Z));
+        if (orbital.conjugatesCanonical())
+          value = conj(value);
+        EXPECT_LT(abs(value - expected), 1e-10 * abs(expected) + 1e-300);
+      }
+    }
+}
+
+TEST(WaveFunctionTest, ReflectionSymmetries)
+{
+  srand(0);
+  static const int orbitals[][3] = {
+    { 1, 0, 0 }, { 2, 1, 1 }, { 3, 2, -1 }, { 4, 3, -2 }, { 4, 3, 3 },
+    { 6, 2, 0 }, { 7, 5, -3 }, { 10, 4, 3 }, { 16, 15, -15 }
+  };
+  for (unsigned k = 0; k < sizeof(orbitals) / sizeof(orbitals[0]); ++k)
+    for (int options = 0; options < 8; ++options) {
+      const int *q = orbitals[k];
+      bool real = options & 1;
+      int m = real ? abs(q[2]) : q[2];
+      Orbital orbital(1, q[0], q[1], m, real, options & 2, options & 4);
+      double radius = orbital.radius();
+      for (unsigned axis = 0; axis < 3; ++axis) {
+        Orbital::Reflection r = orbital.reflection(axis);
+        for (unsigned p = 0; p < 10; ++p) {
+          Vector<3> x;
+          for (unsigned i = 0; i < 3; ++i)
+            x[i] = radius * (2.0 * double(rand()) / double(RAND_MAX) - 1.0);
+          Vector<3> reflected = x;
+          reflected[axis] = -x[axis];
+          complex<double> value = r.sign * orbital(x);
+          if (r.conjugate)
+            value = conj(value);
+          complex<double> expected = orbital(reflected);
+          EXPECT_LT(abs(value - expected), 1e-10 * abs(expected) + 1e-300)
+            << "N=" << q[0] << " L=" << q[1] << " M=" << m
+            << " options=" << options << " axis=" << axis;
+        }
+      }
+    }
+}
+
+TEST(TetrahedralizeTest, QuadraticEstimateOfSmallTetrahedra)
+{
+  srand(0);
+  Orbital orbital(1, 4, 2, 1, false, false, false);
+  double radius = orbital.radius();
+  unsigned close = 0;
+  for (unsigned k = 0; k < 20; ++k) {
+    Vector<3> vertex[4];
+    Vector<3> center;
+    for (unsigned i = 0; i < 3; ++i)
+      center[i] = radius * (double(rand()) / double(RAND_MAX) - 0.5);
+    for (unsigned v = 0; v < 4; ++v)
+      for (unsigned i = 0; i < 3; ++i)
+        vertex[v][i] = center[i] +
+          0.02 * radius * (double(rand()) / double(RAND_MAX) - 0.5);
+    pair<Vector<3>,double> lattice = worstTestPoint(orbital, vertex);
+    pair<Vector<3>,double> quadratic = quadraticWorstPoint(orbital, vertex);
+    // On a small tetrahedron f is nearly quadratic, so the model's
+    // error is nearly the true error, except near nodes, where |f|
+    // has a kink
+    if (fabs(quadratic.second - lattice.second) < 0.1 * lattice.second)
+      ++close;
+  }
+  EXPECT_GE(close, 18u);
+}
+
+TEST(TetrahedralizeTest, QuadraticEstimatorSubdivides)
+{
+  Orbital orbital(1, 3, 1, 0, false, false, false);
+  TetrahedralSubdivision ts(orbital, orbital.radius(), false,
+                            TetrahedralSubdivision::QUADRATIC);
+  ts.work(500);
+  EXPECT_EQ(ts.numVertices(), 500);
+  EXPECT_GT(ts.tetrahedronVertexIndices().size(), 0u);
+}
+
+TEST(TetrahedralizeTest, RunUntilInWorkerThread)
+{
+  Orbital orbital(1, 3, 1, 0, false, false, false);
+  TetrahedralSubdivision ts(orbital, orbital.radius());
+  ts.runUntil(300);
+  ts.wait();
+  EXPECT_FALSE(ts.isRunning());
+  EXPECT_TRUE(ts.isFinished());
+  EXPECT_FALSE(ts.isFinished());
+  EXPECT_EQ(ts.numVertices(), 300);
+}
+
+TEST(TetrahedralizeTest, CancelAsyncStopsWorker)
+{
+  Orbital orbital(1, 3, 1, 0, false, false, false);
+  TetrahedralSubdivision ts(orbital, orbital.radius());
+  ts.runUntil(1000000);
+  ts.cancelAsync();
+  ts.wait();
+  EXPECT_FALSE(ts.isRunning());
+  EXPECT_TRUE(ts.isFinished());
+  EXPECT_LT(ts.numVertices(), 1000000);
+  EXPECT_EQ(unsigned(ts.numVertices()), ts.vertexValues().size());
+}
+
+TEST(TetrahedralizeTest, RunUntilResumes)
+{
+  Orbital orbital(1, 3, 1, 0, false, false, false);
+  TetrahedralSubdivision once(orbital, orbital.radius());
+  once.work(400);
+
+  TetrahedralSubdivision resumed(orbital, orbital.radius());
+  resumed.runUntil(150);
+  resumed.wait();
+  EXPECT_EQ(150, resumed.numVertices());
+  resumed.runUntil(250);
+  // Raise the target of the running worker
+  resumed.runUntil(400);
+  resumed.wait();
+  EXPECT_EQ(400, resumed.numVertices());
+  EXPECT_EQ(once.vertexPositions(), resumed.vertexPositions());
+  EXPECT_EQ(once.tetrahedronVertexIndices(),
+            resumed.tetrahedronVertexIndices());
+
+  // A cancelled subdivision carries on from where it stopped
+  TetrahedralSubdivision cancelled(orbital, orbital.radius());
+  cancelled.runUntil(300);
+  cancelled.cancelAsync();
+  cancelled.wait();
+  cancelled.runUntil(400);
+  cancelled.wait();
+  EXPECT_EQ(once.vertexPositions(), cancelled.vertexPositions());
+}
+
+namespace {
+  // The tetrahedra in a list of indices, each with its vertices sorted
+  set<vector<unsigned> > tetrahedron_set(const vector<unsigned> &indices)
+  {
+    set<vector<unsigned> > tetrahedra;
+    for (unsigned i = 0; i < indices.size(); i += 4) {
+      vector<unsigned> t(indices.begin() + i, indices.begin() + i + 4);
+      sort(t.begin(), t.end());
+      tetrahedra.insert(t);
+    }
+    return tetrahedra;
+  }
+}
+
+TEST(TetrahedralizeTest, DeltasRebuildTheMesh)
+{
+  Orbital orbital(1, 3, 1, 0, false, false, false);
+  TetrahedralSubdivision ts(orbital, orbital.radius());
+  ts.setRollBack(true);
+
+  // Follow the mesh in steps of various sizes, both ways
+  vector<Vector<3> > positions;
+  map<unsigned, vector<unsigned> > tetrahedra;
+  unsigned version = 0;
+  const unsigned steps[] = { 20, 21, 50, 51, 150, 120, 250, 200, 300 };
+  for (unsigned i = 0; i < 9; ++i) {
+    if (steps[i] > unsigned(ts.numVertices()))
+      ts.work(steps[i]);
+    else {
+      ASSERT_TRUE(ts.rollBackTo(steps[i]));
+      ts.wait();
+    }
+    MeshDelta delta = ts.changesSince(version);
+    EXPECT_EQ(ts.version(), delta.version);
+    ASSERT_LE(delta.first_vertex, positions.size());
+    ASSERT_EQ(delta.positions.size(), delta.values.size());
+    positions.resize(delta.first_vertex);
+    positions.insert(positions.end(), delta.positions.begin(),
+                     delta.positions.end());
+    for (unsigned j = 0; j < delta.removed.size(); ++j)
+      EXPECT_EQ(1u, tetrahedra.erase(delta.removed[j]));
+    ASSERT_EQ(4 * delta.added.size(), delta.added_indices.size());
+    for (unsigned j = 0; j < delta.added.size(); ++j)
+      tetrahedra[delta.added[j]] =
+        vector<unsigned>(delta.added_indices.begin() + 4 * j,
+                         delta.added_indices.begin() + 4 * j + 4);
+    version = delta.version;
+  }
+
+  EXPECT_EQ(ts.vertexPositions(), positions);
+  vector<unsigned> indices;
+  for (map<unsigned, vector<unsigned> >::iterator i = tetrahedra.begin();
+       i != tetrahedra.end(); ++i)
+    indices.insert(indices.end(), i->second.begin(), i->second.end());
+  EXPECT_EQ(tetrahedron_set(ts.tetrahedronVertexIndices()),
+            tetrahedron_set(indices));
+
+  // Nothing has changed since the latest version, and everything since 0
+  MeshDelta none = ts.changesSince(version);
+  EXPECT_TRUE(none.positions.empty());
+  EXPECT_TRUE(none.removed.empty());
+  EXPECT_TRUE(none.added.empty());
+  MeshDelta all = ts.changesSince(0);
+  EXPECT_EQ(300u, all.positions.size());
+  EXPECT_TRUE(all.removed.empty());
+  EXPECT_EQ(tetrahedron_set(all.added_indices), tetrahedron_set(indices));
+  EXPECT_THROW(ts.changesSince(version + 1), std::range_error);
+}
+
+TEST(TetrahedralizeTest, OctantMeshFillsTheOctant)
+{
+  Orbital orbital(1, 4, 2, 1, false, false, false);
+  double radius = orbital.radius();
+  TetrahedralSubdivision ts(orbital, radius, false,
+                            TetrahedralSubdivision::LATTICE, 64,
+                            TetrahedralSubdivision::OCTANT);
+  ts.setRollBack(true);
+  ts.work(300);
+  vector<Vector<3> > positions = ts.vertexPositions();
+  vector<unsigned> indices = ts.tetrahedronVertexIndices();
+
+  // The tetrahedra stay inside the octant and fill it, so that with
+  // its reflections it fills the cube
+  double volume = 0.0;
+  for (unsigned t = 0; t < indices.size(); t += 4) {
+    Vector<3> v[4];
+    for (unsigned k = 0; k < 4; ++k) {
+      v[k] = positions[indices[t + k]];
+      for (unsigned i = 0; i < 3; ++i) {
+        EXPECT_GE(v[k][i], 0.0);
+        EXPECT_LE(v[k][i], radius);
+      }
+    }
+    volume += fabs(dot_product(v[1] - v[0], cross_product(v[2] - v[0],
+                                                          v[3] - v[0]))) / 6.0;
+  }
+  EXPECT_NEAR(radius * radius * radius, volume, 1e-9 * volume);
+
+  // Faces split to keep it against the planes roll back like any point
+  ASSERT_TRUE(ts.rollBackTo(150));
+  ts.wait();
+  ts.work(300);
+  EXPECT_EQ(positions, ts.vertexPositions());
+  EXPECT_EQ(indices, ts.tetrahedronVertexIndices());
+}
+
+TEST(TetrahedralizeTest, RollBackUndoesSubdivision)
+{
+  Orbital orbital(1, 3, 1, 0, false, false, false);
+  TetrahedralSubdivision shorter(orbital, orbital.radius());
+  shorter.work(250);
+  TetrahedralSubdivision longer(orbital, orbital.radius());
+  longer.work(400);
+
+  // Without setRollBack, nothing can be rolled back
+  TetrahedralSubdivision kept(orbital, orbital.radius());
+  kept.work(300);
+  EXPECT_FALSE(kept.rollBackTo(250));
+  EXPECT_EQ(300, kept.numVertices());
+
+  TetrahedralSubdivision ts(orbital, orbital.radius());
+  ts.setRollBack(true);
+  ts.work(400);
+  EXPECT_TRUE(ts.rollBackTo(250));
+  ts.wait();
+  EXPECT_EQ(250, ts.numVertices());
+  EXPECT_EQ(shorter.vertexPositions(), ts.vertexPositions());
+  EXPECT_EQ(shorter.vertexValues(), ts.vertexValues());
+  EXPECT_EQ(tetrahedron_set(shorter.tetrahedronVertexIndices()),
+            tetrahedron_set(ts.tetrahedronVertexIndices()));
+
+  // The heap is as it was, so going forward again repeats the mesh
+  ts.runUntil(400);
+  ts.wait();
+  EXPECT_EQ(longer.vertexPositions(), ts.vertexPositions());
+
+  // The vertices from construction stay
+  EXPECT_FALSE(ts.rollBackTo(0));
+  EXPECT_TRUE(ts.rollBackTo(12));
+  ts.wait();
+  EXPECT_EQ(12, ts.numVertices());
+  EXPECT_FALSE(ts.tetrahedronVertexIndices().empty());
+}
+
+TEST(TetrahedralizeTest, RollBackBeforeTheTargetCarriesOn)
+{
+  Orbital orbital(1, 3, 1, 0, false, false, false);
+  TetrahedralSubdivision direct(orbital, orbital.radius());
+  direct.work(300);
+
+  // Lowered while the worker is short of even the new target, or past
+  // it, the mesh still ends up with exactly that many vertices
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    TetrahedralSubdivision ts(orbital, orbital.radius());
+    ts.setRollBack(true);
+    ts.runUntil(attempt ? 600 : 5000);
+    if (attempt)
+      usleep(20000);
+    EXPECT_TRUE(ts.rollBackTo(300));
+    ts.wait();
+    EXPECT_EQ(300, ts.numVertices());
+    EXPECT_EQ(direct.vertexPositions(), ts.vertexPositions());
+  }
+}
+
+TEST(TetrahedralizeTest, DeferredStartMakesTheSameMesh)
+{
+  Orbital orbital(1, 3, 1, 0, false, false, false);
+  TetrahedralSubdivision direct(orbital, orbital.radius());
+  direct.work(300);
+
+  TetrahedralSubdivision deferred(orbital, orbital.radius(), false,
+                                  TetrahedralSubdivision::LATTICE, 64,
+                                  TetrahedralSubdivision::WHOLE_SPACE, true);
+  EXPECT_EQ(0u, deferred.version());
+  EXPECT_EQ(0, deferred.numVertices());
+  deferred.runUntil(300);
+  deferred.wait();
+  EXPECT_EQ(direct.vertexPositions(), deferred.vertexPositions());
+
+  // Read first, it's made on the spot, except by tryChangesSince,
+  // which leaves that to the worker
+  TetrahedralSubdivision unstarted(orbital, orbital.radius(), false,
+                                   TetrahedralSubdivision::LATTICE, 64,
+                                   TetrahedralSubdivision::WHOLE_SPACE, true);
+  MeshDelta delta;
+  EXPECT_FALSE(unstarted.tryChangesSince(0, delta));
+  EXPECT_EQ(4u + 8u, unstarted.vertexPositions().size());
+  EXPECT_EQ(1u, unstarted.version());
+  ASSERT_TRUE(unstarted.tryChangesSince(0, delta));
+  EXPECT_EQ(1u, delta.version);
+  EXPECT_EQ(unstarted.changesSince(0).added, delta.added);
+}
+
+TEST(MeshCacheTest, SavedMeshCarriesOn)
+{
+  char directory[] = "/tmp/mesh_cache_test.XXXXXX";
+  ASSERT_TRUE(mkdtemp(directory) != NULL);
+  MeshCache cache(string(directory) + "/cache");
+  Orbital orbital(1, 3, 1, 0, false, false, false);
+  MeshCacheKey key(orbital, 3, TetrahedralSubdivision::LATTICE);
+  EXPECT_TRUE(cache.load(key) == NULL);
+
+  TetrahedralSubdivision saved(orbital, orbital.radius());
+  saved.work(250);
+  ASSERT_TRUE(cache.save(key, saved));
+  MappedMesh *mesh = cache.load(key);
+  ASSERT_TRUE(mesh != NULL);
+  EXPECT_EQ(250u, mesh->header().num_points);
+  EXPECT_EQ(saved.tetrahedronVertexIndices(),
+            vector<unsigned>(mesh->indices(), mesh->indices() +
+                             4 * mesh->header().num_tetrahedra));
+
+  TetrahedralSubdivision restored(orbital, *mesh);
+  restored.setRollBack(true);
+  delete mesh;
+  EXPECT_EQ(250, restored.numVertices());
+  EXPECT_EQ(saved.vertexPositions(), restored.vertexPositions());
+  EXPECT_EQ(saved.vertexValues(), restored.vertexValues());
+  EXPECT_EQ(saved.tetrahedronVertexIndices(),
+            restored.tetrahedronVertexIndices());
+
+  // Carrying on gives what an unbroken run would
+  TetrahedralSubdivision unbroken(orbital, orbital.radius());
+  unbroken.work(400);
+  restored.runUntil(400);
+  restored.wait();
+  EXPECT_EQ(unbroken.vertexPositions(), restored.vertexPositions());
+  EXPECT_EQ(tetrahedron_set(unbroken.tetrahedronVertexIndices()),
+            tetrahedron_set(restored.tetrahedronVertexIndices()));
+  // But it can't go back past what was saved
+  EXPECT_FALSE(restored.rollBackTo(100));
+  EXPECT_EQ(400, restored.numVertices());
+  EXPECT_TRUE(restored.rollBackTo(250));
+  restored.wait();
+  EXPECT_EQ(250, restored.numVertices());
+
+  // Other keys aren't found, and neither are damaged files
+  MeshCacheKey other(orbital, 4, TetrahedralSubdivision::LATTICE);
+  EXPECT_TRUE(cache.load(other) == NULL);
+  string path = string(directory) + "/cache/" + key.fileName();
+  ASSERT_EQ(0, truncate(path.c_str(), 8192));
+  EXPECT_TRUE(cache.load(key) == NULL);
+
+  unlink(path.c_str());
+  rmdir((string(directory) + "/cache").c_str());
+  rmdir(directory);
+}
+
+TEST(MeshCacheTest, WorkerSavesAndRestores)
+{
+  char directory[] = "/tmp/mesh_cache_test.XXXXXX";
+  ASSERT_TRUE(mkdtemp(directory) != NULL);
+  MeshCache cache(directory);
+  Orbital orbital(1, 3, 1, 0, false, false, false);
+  MeshCacheKey key(orbital, 3, TetrahedralSubdivision::LATTICE);
+  MeshCacheKey other(orbital, 4, TetrahedralSubdivision::LATTICE);
+
+  // Only a mesh that stops at the target it was saved for is saved
+  TetrahedralSubdivision ts(orbital, orbital.radius());
+  ts.saveTo(&cache, key, 300);
+  ts.runUntil(200);
+  ts.wait();
+  EXPECT_FALSE(cache.has(key));
+  ts.runUntil(300);
+  ts.wait();
+  ASSERT_TRUE(cache.has(key));
+  ts.saveTo(&cache, other, 400);
+  ts.runUntil(400);
+  ts.cancelAsync();
+  ts.wait();
+  if (ts.numVertices() < 400) {
+    EXPECT_FALSE(cache.has(other));
+  }
+
+  // Restored on the worker, the mesh is the one saved, at version 1,
+  // and carries on as if it had never stopped
+  MappedMesh *mesh = cache.load(key);
+  ASSERT_TRUE(mesh != NULL);
+  TetrahedralSubdivision restored(orbital, mesh);
+  EXPECT_EQ(1u, restored.version());
+  EXPECT_EQ(300, restored.numVertices());
+  restored.runUntil(400);
+  restored.wait();
+  TetrahedralSubdivision unbroken(orbital, orbital.radius());
+  unbroken.work(400);
+  EXPECT_EQ(unbroken.vertexPositions(), restored.vertexPositions());
+  EXPECT_EQ(tetrahedron_set(unbroken.tetrahedronVertexIndices()),
+            tetrahedron_set(restored.tetrahedronVertexIndices()));
+
+  // Read before the worker runs, it's restored on the spot
+  mesh = cache.load(key);
+  ASSERT_TRUE(mesh != NULL);
+  TetrahedralSubdivision unstarted(orbital, mesh);
+  MeshDelta whole = unstarted.changesSince(0);
+  EXPECT_EQ(300u, whole.positions.size());
+  EXPECT_EQ(1u, whole.version);
+
+  cache.remove(key);
+  cache.remove(other);
+  rmdir(directory);
+}
+
+TEST(MeshCacheTest, DamagedIndicesAreAMiss)
+{
+  char directory[] = "/tmp/mesh_cache_test.XXXXXX";
+  ASSERT_TRUE(mkdtemp(directory) != NULL);
+  MeshCache cache(directory);
+  Orbital orbital(1, 3, 1, 0, false, false, false);
+  MeshCacheKey key(orbital, 3, TetrahedralSubdivision::LATTICE);
+  TetrahedralSubdivision ts(orbital, orbital.radius());
+  ts.work(200);
+  MeshFileContents contents;
+  ts.saveState(contents);
+
+  // Each of these would have the restored mesh index past its end, or
+  // its heap hold a tetrahedron twice
+  for (int damage = 0; damage < 6; ++damage) {
+    MeshFileContents damaged = contents;
+    switch (damage) {
+    case 0: damaged.indices[7] = 200; break;
+    case 1: damaged.tetrahedron_indices[3] = contents.max_simplex + 1;
+      break;
+    case 2: damaged.simplices[5].forming_point[2] = 1000000; break;
+    case 3: damaged.simplices[5].adjacency[1] = contents.max_simplex + 1;
+      break;
+    case 4: damaged.heap[0].tetra = contents.max_simplex + 7; break;
+    case 5: damaged.heap[1].tetra = contents.heap[0].tetra; break;
+    }
+    ASSERT_TRUE(cache.save(key, damaged));
+    EXPECT_TRUE(cache.load(key) == NULL) << "damage " << damage;
+  }
+  ASSERT_TRUE(cache.save(key, contents));
+  EXPECT_TRUE(cache.has(key));
+  cache.remove(key);
+  EXPECT_FALSE(cache.has(key));
+
+  rmdir(directory);
+}
+
+TEST(MeshCacheTest, UnrestorableFileFails)
+{
+  char directory[] = "/tmp/mesh_cache_test.XXXXXX";
+  ASSERT_TRUE(mkdtemp(directory) != NULL);
+  MeshCache cache(directory);
+  Orbital orbital(1, 3, 1, 0, false, false, false);
+  MeshCacheKey key(orbital, 3, TetrahedralSubdivision::LATTICE);
+  TetrahedralSubdivision ts(orbital, orbital.radius());
+  ts.work(200);
+  MeshFileContents contents;
+  ts.saveState(contents);
+
+  // Every index is in range, but the simplex is flat
+  MeshFileContents damaged = contents;
+  damaged.simplices[5].forming_point[1] =
+    damaged.simplices[5].forming_point[0];
+  ASSERT_TRUE(cache.save(key, damaged));
+  MappedMesh *mesh = cache.load(key);
+  ASSERT_TRUE(mesh != NULL);
+
+  // The worker finds out, and leaves an empty mesh that goes nowhere
+  TetrahedralSubdivision restored(orbital, mesh);
+  EXPECT_FALSE(restored.failed());
+  restored.runUntil(300);
+  restored.wait();
+  EXPECT_TRUE(restored.failed());
+  EXPECT_EQ(0u, restored.version());
+  EXPECT_EQ(0, restored.numVertices());
+  MeshDelta delta;
+  EXPECT_FALSE(restored.tryChangesSince(0, delta));
+
+  cache.remove(key);
+  rmdir(directory);
+}
+
+static void save_repeatedly(const MeshCache *cache, const MeshCacheKey *key,
+                            const MeshFileContents *contents, bool *saved)
+{
+  for (int i = 0; i < 10; ++i)
+    *saved = cache->save(*key, *contents) && *saved;
+}
+
+TEST(MeshCacheTest, ConcurrentSavesDontCollide)
+{
+  char directory[] = "/tmp/mesh_cache_test.XXXXXX";
+  ASSERT_TRUE(mkdtemp(directory) != NULL);
+  MeshCache cache(directory);
+  Orbital orbital(1, 3, 1, 0, false, false, false);
+  MeshCacheKey key(orbital, 3, TetrahedralSubdivision::LATTICE);
+  TetrahedralSubdivision ts(orbital, orbital.radius());
+  ts.work(300);
+  MeshFileContents contents;
+  ts.saveState(contents);
+
+  // As two programs sharing the directory might: each writes its own
+  // temporary file, so whichever is renamed last is whole
+  bool saved[2] = { true, true };
+  thread writers[2];
+  for (int w = 0; w < 2; ++w)
+    writers[w] = thread(save_repeatedly, &cache, &key, &contents,
+                        &saved[w]);
+  for (int w = 0; w < 2; ++w)
+    writers[w].join();
+  EXPECT_TRUE(saved[0]);
+  EXPECT_TRUE(saved[1]);
+  MappedMesh *mesh = cache.load(key);
+  ASSERT_TRUE(mesh != NULL);
+  EXPECT_EQ(300u, mesh->header().num_points);
+  delete mesh;
+
+  // And none are left behind
+  unsigned files = 0;
+  DIR *dir = opendir(directory);
+  ASSERT_TRUE(dir != NULL);
+  while (struct dirent *entry = readdir(dir))
+    if (entry->d_name[0] != '.')
+      ++files;
+  closedir(dir);
+  EXPECT_EQ(1u, files);
+
+  cache.remove(key);
+  rmdir(directory);
+}
+
+TEST(MeshCacheTest, CancelledSaveKeepsTheOldFile)
+{
+  char directory[] = "/tmp/mesh_cache_test.XXXXXX";
+  ASSERT_TRUE(mkdtemp(directory) != NULL);
+  MeshCache cache(directory);
+  Orbital orbital(1, 3, 1, 0, false, false, false);
+  MeshCacheKey key(orbital, 3, TetrahedralSubdivision::LATTICE);
+  TetrahedralSubdivision ts(orbital, orbital.radius());
+  ts.work(200);
+  ASSERT_TRUE(cache.save(key, ts));
+
+  ts.work(300);
+  atomic<bool> cancel(true);
+  EXPECT_FALSE(cache.save(key, ts, &cancel));
+  MappedMesh *mesh = cache.load(key);
+  ASSERT_TRUE(mesh != NULL);
+  EXPECT_EQ(200u, mesh->header().num_points);
+  delete mesh;
+
+  cache.remove(key);
+  rmdir(directory);
+}
+
+TEST(MeshCacheTest, EvictsLeastRecentlyUsed)
+{
+  char directory[] = "/tmp/mesh_cache_test.XXXXXX";
+  ASSERT_TRUE(mkdtemp(directory) != NULL);
+  Orbital orbital(1, 3, 1, 0, false, false, false);
+  TetrahedralSubdivision ts(orbital, orbital.radius());
+  ts.work(200);
+  MeshFileContents contents;
+  ts.saveState(contents);
+
+  // Find how big a file is, and make room for two
+  MeshCacheKey keys[3];
+  for (int i = 0; i < 3; ++i)
+    keys[i] = MeshCacheKey(orbital, i, TetrahedralSubdivision::LATTICE);
+  struct stat st;
+  {
+    MeshCache unlimited(directory);
+    ASSERT_TRUE(unlimited.save(keys[0], contents));
+    ASSERT_EQ(0, stat((string(directory) + "/" + keys[0].fileName()).c_str(),
+                      &st));
+    unlimited.remove(keys[0]);
+  }
+  MeshCache cache(directory, 2 * st.st_size + st.st_size / 2);
+
+  // Loading 0 makes 1 the least recently used
+  ASSERT_TRUE(cache.save(keys[0], contents));
+  usleep(20000);
+  ASSERT_TRUE(cache.save(keys[1], contents));
+  usleep(20000);
+  delete cache.load(keys[0]);
+  usleep(20000);
+  ASSERT_TRUE(cache.save(keys[2], contents));
+  EXPECT_TRUE(cache.has(keys[0]));
+  EXPECT_FALSE(cache.has(keys[1]));
+  EXPECT_TRUE(cache.has(keys[2]));
+
+  for (int i = 0; i < 3; ++i)
+    cache.remove(keys[i]);
+  rmdir(directory);
+}
+
+TEST(SubdivisionCacheTest, KeepsRecentlyUsed)
+{
+  shared_ptr<Orbital> orbitals[3];
+  TetrahedralSubdivision *ts[3];
+  for (int i = 0; i < 3; ++i) {
+    orbitals[i] = make_shared<Orbital>(1, 2 + i, 1, 0, false, false, false);
+    ts[i] = new TetrahedralSubdivision(*orbitals[i], orbitals[i]->radius());
+    ts[i]->work(200);
+  }
+  size_t each = ts[0]->memoryUsage();
+  EXPECT_GT(each, 200 * sizeof(Vector<3>));
+
+  // Room for two
+  SubdivisionCache cache(each * 5 / 2);
+  for (int i = 0; i < 3; ++i)
+    cache.put(MeshCacheKey(*orbitals[i], 1, TetrahedralSubdivision::LATTICE),
+              orbitals[i], ts[i]);
+  EXPECT_EQ(2u, cache.size());
+  EXPECT_LE(cache.memoryUsage(), each * 5 / 2);
+
+  shared_ptr<Orbital> orbital;
+  EXPECT_TRUE(cache.take(MeshCacheKey(*orbitals[0], 1,
+                                      TetrahedralSubdivision::LATTICE),
+                         orbital) == NULL);
+  TetrahedralSubdivision *taken =
+    cache.take(MeshCacheKey(*orbitals[1], 1, TetrahedralSubdivision::LATTICE),
+               orbital);
+  ASSERT_EQ(ts[1], taken);
+  EXPECT_EQ(orbitals[1], orbital);
+  EXPECT_EQ(200, taken->numVertices());
+  EXPECT_EQ(1u, cache.size());
+  EXPECT_EQ(1u, cache.hits());
+  EXPECT_EQ(1u, cache.misses());
+  delete taken;
+}
+
+TEST(SubdivisionCacheTest, SpeculatesInTheBackground)
+{
+  Orbital orbital(1, 3, 1, 0, false, false, false);
+  TetrahedralSubdivision direct(orbital, orbital.radius());
+  direct.work(300);
+
+  SubdivisionCache cache(size_t(1) << 30, 2);
+  vector<Orbital> next;
+  next.push_back(orbital);
+  next.push_back(Orbital(1, 3, 1, 1, false, false, false));
+  next.push_back(Orbital(1, 3, 2, 0, false, false, false));
+  cache.speculate(next, 2, 300);
+  // Asking again doesn't start another, and there's no room for a third
+  cache.speculate(next, 2, 300);
+
+  // Taken while working or after, it carries on to the same mesh
+  shared_ptr<Orbital> taken_orbital;
+  TetrahedralSubdivision *ts =
+    cache.take(MeshCacheKey(orbital, 2, TetrahedralSubdivision::LATTICE),
+               taken_orbital);
+  ASSERT_TRUE(ts != NULL);
+  EXPECT_FALSE(ts->isRunning());
+  ts->setBackground(false);
+  ts->runUntil(300);
+  ts->wait();
+  EXPECT_EQ(direct.vertexPositions(), ts->vertexPositions());
+  delete ts;
+
+  // The other is kept once it finishes
+  for (int i = 0; i < 1000 && cache.size() == 0; ++i) {
+    usleep(10000);
+    cache.poll();
+  }
+  EXPECT_EQ(1u, cache.size());
+  EXPECT_GT(cache.memoryUsage(), 0u);
+  EXPECT_TRUE(cache.take(MeshCacheKey(next[2], 2,
+                                      TetrahedralSubdivision::LATTICE),
+                         taken_orbital) == NULL);
+
+  // Cancelled ones are never kept
+  vector<Orbital> unwanted(1, Orbital(1, 4, 2, 0, false, false, false));
+  cache.speculate(unwanted, 2, 300);
+  cache.cancelSpeculation();
+  for (int i = 0; i < 100; ++i) {
+    usleep(1000);
+    cache.poll();
+  }
+  EXPECT_EQ(1u, cache.size());
+}
+
+TEST(AxialSubdivisionTest, AppliesAroundTheAxis)
+{
+  EXPECT_TRUE(AxialSubdivision::applies(Orbital(1, 4, 2, 1, false, false,
+                                                false)));
+  EXPECT_TRUE(AxialSubdivision::applies(Orbital(1, 4, 2, 0, true, false,
+                                                false)));
+  EXPECT_FALSE(AxialSubdivision::applies(Orbital(1, 4, 2, 1, true, false,
+                                                 false)));
+
+  // More steps for a phase that turns faster, or a tighter tolerance,
+  // but as many for M = 0 as for M = 1, for the shape
+  EXPECT_EQ(AxialSubdivision::segments(1, 0.02),
+            AxialSubdivision::segments(0, 0.02));
+  EXPECT_GT(AxialSubdivision::segments(1, 0.02), 1u);
+  EXPECT_GT(AxialSubdivision::segments(2, 0.02),
+            AxialSubdivision::segments(1, 0.02));
+  EXPECT_GT(AxialSubdivision::segments(2, 0.01),
+            AxialSubdivision::segments(2, 0.02));
+}
+
+TEST(AxialSubdivisionTest, SweptMeshFillsTheQuarterCylinder)
+{
+  Orbital orbital(1, 4, 2, 1, false, false, false);
+  double radius = orbital.radius();
+  AxialSubdivision axial(orbital, orbital.M, radius);
+  axial.work(200);
+  EXPECT_EQ(200u, axial.numPlaneVertices());
+  vector<Vector<3> > positions = axial.vertexPositions();
+  vector<complex<double> > values = axial.vertexValues();
+  vector<unsigned> indices = axial.tetrahedronVertexIndices();
+  ASSERT_EQ(positions.size(), values.size());
+
+  // The values are f's, though f was only evaluated at phi = 0
+  double largest = 0.0;
+  for (unsigned v = 0; v < values.size(); ++v)
+    largest = max(largest, abs(values[v]));
+  for (unsigned v = 0; v < positions.size(); ++v) {
+    const Vector<3> &p = positions[v];
+    EXPECT_GE(p[0], 0.0);
+    EXPECT_GE(p[1], 0.0);
+    EXPECT_GE(p[2], 0.0);
+    EXPECT_LE(p[0] * p[0] + p[1] * p[1], radius * radius * (1.0 + 1e-12));
+    EXPECT_LE(p[2], radius);
+    EXPECT_LT(abs(orbital(p) - values[v]), 1e-9 * largest);
+  }
+
+  // The tetrahedra fill the quarter cylinder with its arc cut into
+  // chords, and each face inside is shared by exactly two
+  unsigned K = axial.numSegments();
+  double volume = 0.0;
+  map<vector<unsigned>, int> faces;
+  for (unsigned t = 0; t < indices.size(); t += 4) {
+    Vector<3> v[4];
+    for (unsigned k = 0; k < 4; ++k)
+      v[k] = positions[indices[t + k]];
+    volume += fabs(dot_product(v[1] - v[0], cross_product(v[2] - v[0],
+                                                          v[3] - v[0]))) / 6.0;
+    for (unsigned skip = 0; skip < 4; ++skip) {
+      vector<unsigned> face;
+      for (unsigned k = 0; k < 4; ++k)
+        if (k != skip)
+          face.push_back(indices[t + k]);
+      sort(face.begin(), face.end());
+      ++faces[face];
+    }
+  }
+  EXPECT_NEAR(radius * K * 0.5 * radius * radius * sin(M_PI / 2.0 / K),
+              volume, 1e-9 * volume);
+  for (map<vector<unsigned>, int>::const_iterator i = faces.begin();
+       i != faces.end(); ++i) {
+    EXPECT_LE(i->second, 2);
+    if (i->second == 2)
+      continue;
+    // Then it's on a plane bounding the octant, or on the outside
+    bool on[5] = { true, true, true, true, true };
+    for (unsigned k = 0; k < 3; ++k) {
+      const Vector<3> &p = positions[i->first[k]];
+      on[0] = on[0] && p[0] == 0.0;
+      on[1] = on[1] && p[1] == 0.0;
+      on[2] = on[2] && p[2] == 0.0;
+      on[3] = on[3] && p[2] == radius;
+      on[4] = on[4] && fabs(hypot(p[0], p[1]) - radius) < 1e-9 * radius;
+    }
+    EXPECT_TRUE(on[0] || on[1] || on[2] || on[3] || on[4]);
+  }
+}
+
+TEST(AxialSubdivisionTest, WorkerMakesTheSameMesh)
+{
+  Orbital orbital(1, 5, 3, 2, false, false, false);
+  AxialSubdivision direct(orbital, orbital.M, orbital.radius());
+  direct.work(150);
+
+  AxialSubdivision threaded(orbital, orbital.M, orbital.radius());
+  threaded.runUntil(150);
+  threaded.wait();
+  EXPECT_FALSE(threaded.isRunning());
+  EXPECT_TRUE(threaded.isFinished());
+  EXPECT_FALSE(threaded.isFinished());
+  EXPECT_EQ(direct.vertexPositions(), threaded.vertexPositions());
+  EXPECT_EQ(direct.tetrahedronVertexIndices(),
+            threaded.tetrahedronVertexIndices());
+
+  // All of it in one delta, for the cloud
+  MeshDelta delta = threaded.mesh();
+  EXPECT_EQ(0u, delta.first_vertex);
+  EXPECT_EQ(direct.vertexPositions(), delta.positions);
+  EXPECT_EQ(4 * delta.added.size(), delta.added_indices.size());
+  EXPECT_TRUE(delta.removed.empty());
+}
+
+namespace {
+  class CountedOrbital : public Function<3,complex<double> >
+  {
+  public:
+    explicit CountedOrbital(const Orbital &o) : orbital(o), count(0) {}
+    complex<double> operator()(const Vector<3> &x) const
+    {
+      ++count;
+      return orbital(x);
+    }
+    const Orbital &orbital;
+    mutable unsigned count;
+  };
+}
+
+TEST(TetrahedralizeTest, AdaptiveEstimateWithinBudget)
+{
+  srand(1);
+  Orbital orbital(1, 5, 2, -1, false, false, false);
+  CountedOrbital counted(orbital);
+  double radius = orbital.radius();
+  unsigned close = 0;
+  for (unsigned k = 0; k < 20; ++k) {
+    Vector<3> vertex[4];
+    for (unsigned v = 0; v < 4; ++v)
+      for (unsigned i = 0; i < 3; ++i)
+        vertex[v][i] = 0.5 * radius * (double(rand()) / RAND_MAX - 0.5);
+    pair<Vector<3>,double> lattice = worstTestPoint(orbital, vertex);
+    counted.count = 0;
+    pair<Vector<3>,double> adaptive =
+      adaptiveWorstPoint(counted, vertex, 64);
+    EXPECT_LE(counted.count, 64u);
+    // The refined points aren't all on the lattice, so the adaptive
+    // search can do better as well as worse
+    if (adaptive.second > 0.5 * lattice.second)
+      ++close;
+  }
+  EXPECT_GE(close, 15u);
+}
+
+TEST(TetrahedralizeTest, KnownVertexValuesAreNotReevaluated)
+{
+  Orbital orbital(1, 4, 2, 1, false, false, false);
+  CountedOrbital counted(orbital);
+  double radius = orbital.radius();
+  Vector<3> vertex[4];
+  vertex[0] = Vector3(0.0, 0.0, 0.0);
+  vertex[1] = Vector3(0.3 * radius, 0.0, 0.0);
+  vertex[2] = Vector3(0.0, 0.3 * radius, 0.0);
+  vertex[3] = Vector3(0.0, 0.0, 0.3 * radius);
+  complex<double> value[4];
+  for (unsigned i = 0; i < 4; ++i)
+    value[i] = orbital(vertex[i]);
+
+  pair<Vector<3>,double> unknown = worstTestPoint(counted, vertex);
+  unsigned unknown_count = counted.count;
+  counted.count = 0;
+  pair<Vector<3>,double> known = worstTestPoint(counted, vertex, false, value);
+  EXPECT_EQ(counted.count, unknown_count - 4);
+  EXPECT_TRUE(known.first == unknown.first);
+  EXPECT_NEAR(known.second, unknown.second, 1e-12 * unknown.second);
+
+  counted.count = 0;
+  quadraticWorstPoint(counted, vertex, value);
+  EXPECT_EQ(counted.count, 6u);
+  counted.count = 0;
+  adaptiveWorstPoint(counted, vertex, 64, value);
+  EXPECT_LE(counted.count, 64u);
+}
+
+TEST(TetrahedralizeTest, VertexValuesMatchFunction)
+{
+  Orbital orbital(1, 3, 2, -2, false, false, false);
+  TetrahedralSubdivision ts(orbital, orbital.radius());
+  ts.work(300);
+  vector<Vector<3> > positions = ts.vertexPositions();
+  vector<complex<double> > values = ts.vertexValues();
+  ASSERT_EQ(values.size(), positions.size());
+  for (unsigned p = 0; p < positions.size(); ++p) {
+    complex<double> expected = orbital(positions[p]);
+    EXPECT_NEAR(abs(values[p] - expected), 0.0, 1e-12 * (1.0 + abs(expected)));
+  }
+}
+
+TEST(SampleCacheTest, FaceSlotsAreDistinct)
+{
+  SampleCache cache(11, 1000);
+  EXPECT_EQ(cache.faceSamples(), 45u);
+  EXPECT_EQ(cache.edgeSamples(), 10u);
+  vector<unsigned> used(cache.faceSamples(), 0);
+  for (unsigned a = 1; a < 11; ++a)
+    for (unsigned b = 1; a + b < 11; ++b) {
+      unsigned slot = cache.faceSlot(a, b);
+      ASSERT_LT(slot, cache.faceSamples());
+      ++used[slot];
+    }
+  for (unsigned i = 0; i < used.size(); ++i)
+    EXPECT_EQ(used[i], 1u);
+}
+
+TEST(SampleCacheTest, ForgetsFacesInsideRemovedRegion)
+{
+  // Two tetrahedra sharing the face 1 2 3
+  vector<Vector<3> > points;
+  points.push_back(Vector3(0.0, 0.0, -1.0));
+  points.push_back(Vector3(1.0, 0.0, 0.0));
+  points.push_back(Vector3(0.0, 1.0, 0.0));
+  points.push_back(Vector3(-1.0, -1.0, 0.0));
+  points.push_back(Vector3(0.0, 0.0, 1.0));
+  Array<4,unsigned> lower, upper;
+  for (unsigned i = 0; i < 4; ++i) {
+    lower[i] = i;
+    upper[i] = i + 1;
+  }
+  vector<Simplex<3> > removed;
+  removed.push_back(Simplex<3>(points, lower));
+  removed.push_back(Simplex<3>(points, upper));
+
+  SampleCache cache(11, 1000);
+  vector<complex<double> > face_values(cache.faceSamples(), 1.0);
+  vector<complex<double> > edge_values(cache.edgeSamples(), 2.0);
+  Face<3> inside, outside;
+  inside.points[0] = 1;
+  inside.points[1] = 2;
+  inside.points[2] = 3;
+  outside.points[0] = 0;
+  outside.points[1] = 1;
+  outside.points[2] = 2;
+  Face<2> edge;
+  edge.points[0] = 1;
+  edge.points[1] = 2;
+  cache.store(inside, &face_values[0]);
+  cache.store(outside, &face_values[0]);
+  cache.store(edge, &edge_values[0]);
+  EXPECT_EQ(cache.size(), 2 * 45u + 10u);
+
+  vector<complex<double> > found(cache.faceSamples());
+  EXPECT_TRUE(cache.lookup(inside, &found[0]));
+  EXPECT_TRUE(found == face_values);
+  cache.removeTetrahedra(removed);
+  EXPECT_FALSE(cache.lookup(inside, &found[0]));
+  EXPECT_TRUE(cache.lookup(outside, &found[0]));
+  // Every edge of the two tetrahedra is on the boundary of their union
+  EXPECT_TRUE(cache.lookup(edge, &found[0]));
+  EXPECT_EQ(cache.hits(), 45u + 45u + 10u);
+  EXPECT_EQ(cache.misses(), 45u);
+}
+
+TEST(IndexedHeapTest, PopsInOrder)
+{
+  IndexedHeap<int> heap;
+  const int values[] = { 5, 3, 9, 1, 7, 2, 8, 6, 4, 0 };
+  for (unsigned i = 0; i < 10; ++i)
+    heap.push(i, values[i]);
+  EXPECT_EQ(10u, heap.size());
+  EXPECT_EQ(2u, heap.topId());
+  for (int expected = 9; expected >= 0; --expected) {
+    ASSERT_FALSE(heap.empty());
+    EXPECT_EQ(expected, heap.top());
+    heap.pop();
+  }
+  EXPECT_TRUE(heap.empty());
+  EXPECT_THROW(heap.top(), std::logic_error);
+}
+
+TEST(IndexedHeapTest, RemovesById)
+{
+  IndexedHeap<int> heap;
+  for (unsigned i = 0; i < 100; ++i)
+    heap.push(i, (i * 37) % 100);
+  EXPECT_THROW(heap.push(5, 0), std::logic_error);
+  // Take out every third item, and one that isn't there
+  for (unsigned i = 0; i < 100; i += 3)
+    heap.remove(i);
+  heap.remove(1000);
+  for (unsigned i = 0; i < 100; ++i)
+    EXPECT_EQ(i % 3 != 0, heap.contains(i));
+
+  int last = 100;
+  unsigned count = 0;
+  while (!heap.empty()) {
+    EXPECT_NE(0u, heap.topId() % 3);
+    EXPECT_LT(heap.top(), last);
+    last = heap.top();
+    heap.pop();
+    ++count;
+  }
+  EXPECT_EQ(66u, count);
+}
+
+TEST(TetrahedralizeTest, SampleCacheGivesTheSameMesh)
+{
+  Orbital orbital(1, 4, 2, 1, false, false, false);
+  CountedOrbital uncounted(orbital), counted(orbital);
+  TetrahedralSubdivision plain(uncounted, orbital.radius());
+  plain.work(300);
+  TetrahedralSubdivision cached(counted, orbital.radius());
+  cached.setSampleCache(true);
+  cached.work(300);
+  EXPECT_TRUE(cached.vertexPositions() == plain.vertexPositions());
+  EXPECT_TRUE(cached.tetrahedronVertexIndices() ==
+              plain.tetrahedronVertexIndices());
+  EXPECT_LT(counted.count, 0.7 * uncounted.count);
+  const SampleCache *cache = cached.sampleCache();
+  ASSERT_TRUE(cache != NULL);
+  EXPECT_GT(cache->hits(), 0u);
+  EXPECT_EQ(plain.sampleCache(), (const SampleCache *)NULL);
+}
+
+TEST(TetrahedralizeTest, LazyEvaluationAvoidsProbes)
+{
+  Orbital orbital(1, 4, 2, 1, false, false, false);
+  TetrahedralSubdivision eager(orbital, orbital.radius());
+  eager.work(500);
+  TetrahedralSubdivision lazy(orbital, orbital.radius());
+  lazy.setLazyEvaluation(true);
+  lazy.work(500);
+  EXPECT_EQ(lazy.numVertices(), 500);
+  TetrahedralSubdivision::Stats eager_stats = eager.stats();
+  TetrahedralSubdivision::Stats lazy_stats = lazy.stats();
+  EXPECT_EQ(eager_stats.estimates, 0u);
+  EXPECT_GT(lazy_stats.estimates, 0u);
+  EXPECT_GT(lazy_stats.probesAvoided(), 0u);
+  EXPECT_LT(lazy_stats.probes, eager_stats.probes);
+}
+
+namespace {
+  void square_task(void *arg, unsigned i)
+  {
+    vector<unsigned> &results = *static_cast<vector<unsigned> *>(arg);
+    results[i] = i * i;
+  }
+}
+
+TEST(WorkerPoolTest, RunsEveryTask)
+{
+  for (unsigned size = 1; size <= 4; ++size) {
+    WorkerPool pool(size);
+    EXPECT_EQ(pool.size(), size);
+    for (unsigned count = 0; count < 100; count += 7) {
+      vector<unsigned> results(count, 1);
+      pool.run(square_task, &results, count);
+      for (unsigned i = 0; i < count; ++i)
+        EXPECT_EQ(results[i], i * i);
+    }
+  }
+  EXPECT_GE(WorkerPool::hardwareThreads(), 1u);
+}
+
+TEST(TetrahedralizeTest, ThreadsGiveTheSameMesh)
+{
+  Orbital orbital(1, 4, 2, 1, false, false, false);
+  TetrahedralSubdivision serial(orbital, orbital.radius());
+  serial.work(400);
+  for (unsigned threads = 2; threads <= 4; ++threads) {
+    TetrahedralSubdivision parallel(orbital, orbital.radius());
+    parallel.setThreads(threads);
+    parallel.work(400);
+    EXPECT_TRUE(parallel.vertexPositions() == serial.vertexPositions());
+    EXPECT_TRUE(parallel.tetrahedronVertexIndices() ==
+                serial.tetrahedronVertexIndices());
+  }
+}
@@ -0,0 +1,320 @@
+/*
+ * This file is part of the Electron Orbital Explorer. The Electron
+ * Orbital Explorer is distributed under the Simplified BSD License
+ * (also called the "BSD 2-Clause License"), in hopes that these
+ * rendering techniques might be used by other programmers in
+ * applications such as scientific visualization, video gaming, and so
+ * on. If you find value in this software and use its technologies for
+ * another purpose, I would love to hear back from you at bjthinks (at)
+ * gmail (dot) com. If you improve this software and agree to release
+ * your modifications under the below license, I encourage you to fork
+ * the development tree on github and push your modifications. The
+ * Electron Orbital Explorer's development URL is:
+ * https://github.com/bjthinks/orbital-explorer
+ * (This paragraph is not part of the software license and may be
+ * removed.)
+ *
+ * Copyright (c) 2013, Brian W. Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * + Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * + Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef VECMATH_HH
+#define VECMATH_HH
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+#include "util.hh"
+
+// Branch-free versions of exp, atan2, sincos and integer phases,
+// written so that a loop calling them over plain arrays can be
+// vectorized by the compiler. The C library versions are opaque
+// function calls, which stop vectorization dead. These are accurate to
+// a few ulps over the ranges the wave function code uses them for, and
+// are checked against the C library in the unit tests.
+//
+// GCC will only if-convert the selects below, and so vectorize, when
+// told that floating point traps don't matter; see FPFLAGS in the
+// Makefile.
+
+// Adding and then subtracting 1.5 * 2^52 rounds a double to the
+// nearest integer, and leaves that integer in the low bits of the
+// intermediate sum.
+static const double vec_round_magic = 6755399441055744.0;
+
+inline uint64_t vec_bits(double x)
+{
+  uint64_t b;
+  memcpy(&b, &x, sizeof(b));
+  return b;
+}
+
+inline double vec_from_bits(uint64_t b)
+{
+  double x;
+  memcpy(&x, &b, sizeof(x));
+  return x;
+}
+
+inline double vec_exp(double x)
+{
+  // Clamp so that 2^k stays a normal number. exp(-708) is about
+  // 3e-308, which is zero for all practical purposes here.
+  x = x < -708.0 ? -708.0 : x;
+  x = x > 708.0 ? 708.0 : x;
+
+  // exp(x) = 2^k exp(r), where k = round(x / ln 2) and |r| <= ln(2) / 2
+  double t = x * 1.4426950408889634 + vec_round_magic;
+  uint64_t k = vec_bits(t);
+  double kd = t - vec_round_magic;
+  // ln 2, split so that kd * ln2_hi is exact
+  double r = x - kd * 6.93145751953125e-1;
+  r = r - kd * 1.42860682030941723212e-6;
+
+  // Taylor series for exp(r), enough terms for double precision
+  double p = 1.0 / 479001600.0;
+  p = p * r + 1.0 / 39916800.0;
+  p = p * r + 1.0 / 3628800.0;
+  p = p * r + 1.0 / 362880.0;
+  p = p * r + 1.0 / 40320.0;
+  p = p * r + 1.0 / 5040.0;
+  p = p * r + 1.0 / 720.0;
+  p = p * r + 1.0 / 120.0;
+  p = p * r + 1.0 / 24.0;
+  p = p * r + 1.0 / 6.0;
+  p = p * r + 0.5;
+  p = p * r + 1.0;
+  p = p * r + 1.0;
+
+  // Build 2^k directly in the exponent field
+  double two_k = vec_from_bits((k + 1023) << 52);
+  return p * two_k;
+}
+
+inline uint32_t vec_bits(float x)
+{
+  uint32_t b;
+  memcpy(&b, &x, sizeof(b));
+  return b;
+}
+
+inline float vec_from_bits(uint32_t b)
+{
+  float x;
+  memcpy(&x, &b, sizeof(x));
+  return x;
+}
+
+// Single precision exp, for the single precision orbital evaluator.
+// Unlike vec_exp, this flushes to zero below exp(-87), since single
+// precision values get multiplied by large polynomials.
+inline float vec_exp(float x)
+{
+  bool tiny = x < -87.0f;
+  x = x < -87.0f ? -87.0f : x;
+  x = x > 88.0f ? 88.0f : x;
+
+  float t = x * 1.44269504f + 12582912.0f;
+  uint32_t k = vec_bits(t);
+  float kf = t - 12582912.0f;
+  float r = x - kf * 0.693359375f;
+  r = r + kf * 2.12194440e-4f;
+
+  // Cephes expf polynomial
+  float p = 1.9875691500e-4f;
+  p = p * r + 1.3981999507e-3f;
+  p = p * r + 8.3334519073e-3f;
+  p = p * r + 4.1665795894e-2f;
+  p = p * r + 1.6666665459e-1f;
+  p = p * r + 5.0000001201e-1f;
+  p = p * r * r + r + 1.0f;
+
+  float two_k = vec_from_bits((k + 127) << 23);
+  return tiny ? 0.0f : p * two_k;
+}
+
+// atan of 0 <= x <= tan(pi/8), Cephes rational approximation
+inline double vec_atan_kernel(double x)
+{
+  double z = x * x;
+  double p = -8.750608600031904122785e-1;
+  p = p * z - 1.615753718733365076637e1;
+  p = p * z - 7.500855792314704667340e1;
+  p = p * z - 1.228866684490136173410e2;
+  p = p * z - 6.485021904942025371773e1;
+  double q = z + 2.485846490142306297962e1;
+  q = q * z + 1.650270098316988542046e2;
+  q = q * z + 4.328810604912902668951e2;
+  q = q * z + 4.853903996359136964868e2;
+  q = q * z + 1.945506571482613964425e2;
+  return x + x * z * p / q;
+}
+
+inline double vec_atan2(double y, double x)
+{
+  double ax = x < 0.0 ? -x : x;
+  double ay = y < 0.0 ? -y : y;
+
+  // Reduce to an angle in [0, pi/4] ...
+  bool swap = ay > ax;
+  double num = swap ? ax : ay;
+  double den = swap ? ay : ax;
+  den = den > 0.0 ? den : 1.0;
+  double t = num / den;
+
+  // ... and then to [0, pi/8], using atan(t) = pi/4 + atan((t-1)/(t+1))
+  bool big = t > 0.41421356237309504880;
+  double u = big ? (t - 1.0) / (t + 1.0) : t;
+  double a = vec_atan_kernel(u);
+  a = big ? a + pi / 4.0 : a;
+
+  // Undo the reductions
+  a = swap ? pi / 2.0 - a : a;
+  a = x < 0.0 ? pi - a : a;
+  return y < 0.0 ? -a : a;
+}
+
+inline void vec_sincos(double x, double &s, double &c)
+{
+  // Reduce modulo pi/2: x = q (pi/2) + r, |r| <= pi/4. The three-part
+  // split of pi/2 keeps r accurate for |x| up to a few thousand, far
+  // more than M * phi ever needs.
+  double t = x * 6.36619772367581382433e-1 + vec_round_magic;
+  uint64_t q = vec_bits(t);
+  double qd = t - vec_round_magic;
+  double r = x - qd * 1.570796310901641845703125;
+  r = r - qd * 1.589325471229585673428e-8;
+  r = r - qd * 6.12323399573676588614e-17;
+  double z = r * r;
+
+  // Taylor series for sin(r) and cos(r)
+  double ps = -1.0 / 1307674368000.0;
+  ps = ps * z + 1.0 / 6227020800.0;
+  ps = ps * z - 1.0 / 39916800.0;
+  ps = ps * z + 1.0 / 362880.0;
+  ps = ps * z - 1.0 / 5040.0;
+  ps = ps * z + 1.0 / 120.0;
+  ps = ps * z - 1.0 / 6.0;
+  double sr = r + r * z * ps;
+
+  double pc = 1.0 / 6402373705728000.0;
+  pc = pc * z - 1.0 / 20922789888000.0;
+  pc = pc * z + 1.0 / 87178291200.0;
+  pc = pc * z - 1.0 / 479001600.0;
+  pc = pc * z + 1.0 / 3628800.0;
+  pc = pc * z - 1.0 / 40320.0;
+  pc = pc * z + 1.0 / 720.0;
+  pc = pc * z - 1.0 / 24.0;
+  pc = pc * z + 0.5;
+  double cr = 1.0 - z * pc;
+
+  // Rotate by q quarter turns. The sign flips are done by toggling
+  // sign bits and masking, which keeps everything in straight-line code.
+  uint64_t odd = -(q & 1);
+  double ss = vec_from_bits((vec_bits(cr) & odd) | (vec_bits(sr) & ~odd));
+  double cc = vec_from_bits((vec_bits(sr) & odd) | (vec_bits(cr) & ~odd));
+  s = vec_from_bits(vec_bits(ss) ^ ((q & 2) << 62));
+  c = vec_from_bits(vec_bits(cc) ^ (((q + 1) & 2) << 62));
+}
+
+// cos(m phi) and sin(m phi) at count points, given cos(phi) and
+// sin(phi), without any trig functions: raise cos(phi) + i sin(phi) to
+// the mth power by repeated squaring. m may be negative. The loop over
+// the bits of m is outermost so that the inner loops vectorize. The
+// outputs must not alias the inputs.
+template <typename T>
+inline void vec_unit_power(const T *c1, const T *s1, int m,
+                           T *c, T *s, size_t count)
+{
+  T bc[64], bs[64];
+  unsigned am = m < 0 ? -m : m;
+  T conj = m < 0 ? -1 : 1;
+  for (size_t start = 0; start < count; start += 64) {
+    size_t n = count - start < 64 ? count - start : 64;
+    T *rc = c + start;
+    T *rs = s + start;
+    for (size_t i = 0; i < n; ++i) {
+      bc[i] = c1[start + i];
+      bs[i] = conj * s1[start + i];
+      rc[i] = 1;
+      rs[i] = 0;
+    }
+    for (unsigned bits = am; bits; bits >>= 1) {
+      if (bits & 1)
+        for (size_t i = 0; i < n; ++i) {
+          T t = rc[i] * bc[i] - rs[i] * bs[i];
+          rs[i] = rc[i] * bs[i] + rs[i] * bc[i];
+          rc[i] = t;
+        }
+      if (bits > 1)
+        for (size_t i = 0; i < n; ++i) {
+          T t = bc[i] * bc[i] - bs[i] * bs[i];
+          bs[i] = 2 * bc[i] * bs[i];
+          bc[i] = t;
+        }
+    }
+  }
+}
+
+// The same for m >= 0 by the Chebyshev recurrence P_(k+1) = 2 x P_k -
+// P_(k-1), which gives cos(m phi) = T_m(cos phi) and sin(m phi) =
+// sin(phi) U_(m-1)(cos phi) with one multiply-add per step each.
+template <typename T>
+inline void vec_chebyshev_phase(const T *c1, const T *s1, int m,
+                                T *c, T *s, size_t count)
+{
+  T tp[64], up[64];
+  for (size_t start = 0; start < count; start += 64) {
+    size_t n = count - start < 64 ? count - start : 64;
+    const T *x = c1 + start;
+    T *t = c + start;
+    T *u = s + start;
+    // t holds T_k and u holds U_(k-1), starting from k = 0, with
+    // T_(-1) = x and U_(-2) = -1
+    for (size_t i = 0; i < n; ++i) {
+      tp[i] = x[i];
+      t[i] = 1;
+      up[i] = -1;
+      u[i] = 0;
+    }
+    for (int k = 0; k < m; ++k)
+      for (size_t i = 0; i < n; ++i) {
+        T tn = 2 * x[i] * t[i] - tp[i];
+        T un = 2 * x[i] * u[i] - up[i];
+        tp[i] = t[i];
+        t[i] = tn;
+        up[i] = u[i];
+        u[i] = un;
+      }
+    for (size_t i = 0; i < n; ++i)
+      u[i] *= s1[start + i];
+  }
+}
+
+#endif
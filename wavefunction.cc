@@ -45,19 +45,23 @@
 
 #include <complex>
 #include <cmath>
+#include <vector>
+#include <algorithm>
 
 #include "util.hh"
 #include "vector.hh"
 #include "polynomial.hh"
+#include "vecmath.hh"
 #include "wavefunction.hh"
 #include "radial_data.hh"
 
 using namespace std;
 
 Orbital::Orbital(int Z_, int N_, int L_, int M_,
-                 bool real_, bool diff_, bool square_) :
+                 bool real_, bool diff_, bool square_,
+                 Method method, Phase phase_method_) :
   Z(Z_), N(N_), L(L_), M(M_),
-  real(real_), diff(diff_), square(square_)
+  real(real_), diff(diff_), square(square_), phase_method(phase_method_)
 {
   // Set up radial part of wave function
 
@@ -69,16 +73,23 @@ Orbital::Orbital(int Z_, int N_, int L_, int M_,
   normalization_constant = radialIntegral();
   // e^(-Zr/N)
   radial_exponential_constant = -double(Z) / double(N);
+  // The kernels and recurrences work in terms of rho = 2Zr/N
+  rho_scale = 2.0 * double(Z) / double(N);
+  kernel_constant = radial_constant;
+  recurrence_constant = radial_constant;
   // (2Zr/N)^L
   radial_constant *= pow(2.0 * double(Z) / double(N), L);
   // Associated Laguerre polynomial L_(N-L-1)^(2L+1) (2Zr/N)
-  radial_polynomial = 0.0;
-  Polynomial r(1.0, 1);
-  for (int k = 0; k <= N - L - 1; ++k) {
-    radial_polynomial += ((k & 1) ? -1.0 : 1.0) *
-      choose(N + L, double(N - L - 1 - k)) *
-      pow(2.0 * double(Z) * r / double(N), k) /
-      factorial(k);
+  if (method != RECURRENCE) {
+    Polynomial laguerre;
+    Polynomial r(1.0, 1);
+    for (int k = 0; k <= N - L - 1; ++k) {
+      laguerre += ((k & 1) ? -1.0 : 1.0) *
+        choose(N + L, double(N - L - 1 - k)) *
+        pow(2.0 * double(Z) * r / double(N), k) /
+        factorial(k);
+    }
+    radial_polynomial = CompiledPolynomial(laguerre);
   }
 
   // Set up angular part of wave function
@@ -89,12 +100,130 @@ Orbital::Orbital(int Z_, int N_, int L_, int M_,
   // Other constants: 1 / 2^L L!
   angular_constant /= pow(2.0, L) * factorial(L);
   // Polynomial in cos(theta) comes from associated Legendre polynomial
-  Polynomial x(1.0, 1);
-  cos_theta_polynomial = pow(x * x - 1.0, L).derivative(L + abs(M));
+  if (method != RECURRENCE) {
+    Polynomial x(1.0, 1);
+    cos_theta_polynomial =
+      CompiledPolynomial(pow(x * x - 1.0, L).derivative(L + abs(M)));
+  }
+
+  kernel_constant *= angular_constant;
+  kernel = NULL;
+  if (method == SPECIALIZED)
+    kernel = findOrbitalKernel(N, L, abs(M));
+  use_recurrence = method == RECURRENCE;
+}
+
+template <typename T>
+static void laguerre_recurrence(int n, double a, const T *x, T *result,
+                                size_t count)
+{
+  // L_0 = 1, L_1 = 1 + a - x, and
+  // (k+1) L_(k+1) = (2k + 1 + a - x) L_k - (k + a) L_(k-1)
+  // The previous value is kept in prev, the current one in result.
+  // x is copied a block at a time so that it may alias result.
+  T bx[64], prev[64];
+  for (size_t start = 0; start < count; start += 64) {
+    size_t m = min(size_t(64), count - start);
+    T *br = result + start;
+    for (size_t i = 0; i < m; ++i)
+      bx[i] = x[start + i];
+    T c0 = 1.0 + a;
+    for (size_t i = 0; i < m; ++i) {
+      prev[i] = 1;
+      br[i] = n > 0 ? c0 - bx[i] : 1;
+    }
+    for (int k = 1; k < n; ++k) {
+      T c1 = 2.0 * double(k) + 1.0 + a;
+      T c2 = double(k) + a;
+      T inv = 1.0 / (double(k) + 1.0);
+      for (size_t i = 0; i < m; ++i) {
+        T next = ((c1 - bx[i]) * br[i] - c2 * prev[i]) * inv;
+        prev[i] = br[i];
+        br[i] = next;
+      }
+    }
+  }
+}
+
+template <typename T>
+static void legendre_recurrence(int l, int m, const T *cos_theta,
+                                const T *sin_theta, T *result, size_t count)
+{
+  // Fully normalized, so that nothing overflows on the way up:
+  //   Y_m^m = sqrt((2m+1)/4pi) prod_(k=1..m) sqrt((2k-1)/2k) sin^m
+  //   Y_(m+1)^m = sqrt(2m+3) cos Y_m^m
+  //   Y_j^m = a_j (cos Y_(j-1)^m - b_j Y_(j-2)^m), where
+  //   a_j = sqrt((4j^2-1)/(j^2-m^2)), b_j = sqrt(((j-1)^2-m^2)/(4(j-1)^2-1))
+  double start_constant = sqrt((2.0 * double(m) + 1.0) / (4.0 * pi));
+  for (int k = 1; k <= m; ++k)
+    start_constant *= sqrt((2.0 * double(k) - 1.0) / (2.0 * double(k)));
+
+  T bc[64], prev[64];
+  for (size_t start = 0; start < count; start += 64) {
+    size_t n = min(size_t(64), count - start);
+    T *br = result + start;
+    for (size_t i = 0; i < n; ++i)
+      bc[i] = cos_theta[start + i];
+    ipow(sin_theta + start, m, br, n);
+    for (size_t i = 0; i < n; ++i)
+      br[i] *= T(start_constant);
+    if (l == m)
+      continue;
+    T c = sqrt(2.0 * double(m) + 3.0);
+    for (size_t i = 0; i < n; ++i) {
+      prev[i] = br[i];
+      br[i] *= c * bc[i];
+    }
+    for (int j = m + 2; j <= l; ++j) {
+      double dj = double(j), dm = double(m);
+      T a = sqrt((4.0 * dj * dj - 1.0) / (dj * dj - dm * dm));
+      T b = sqrt(((dj - 1.0) * (dj - 1.0) - dm * dm) /
+                      (4.0 * (dj - 1.0) * (dj - 1.0) - 1.0));
+      for (size_t i = 0; i < n; ++i) {
+        T next = a * (bc[i] * br[i] - b * prev[i]);
+        prev[i] = br[i];
+        br[i] = next;
+      }
+    }
+  }
+}
+
+void assoc_laguerre(int n, double a, const double *x, double *result,
+                    size_t count)
+{
+  laguerre_recurrence(n, a, x, result, count);
+}
+
+void assoc_laguerre(int n, double a, const float *x, float *result,
+                    size_t count)
+{
+  laguerre_recurrence(n, a, x, result, count);
+}
+
+void assoc_legendre(int l, int m, const double *cos_theta,
+                    const double *sin_theta, double *result, size_t count)
+{
+  legendre_recurrence(l, m, cos_theta, sin_theta, result, count);
+}
+
+void assoc_legendre(int l, int m, const float *cos_theta,
+                    const float *sin_theta, float *result, size_t count)
+{
+  legendre_recurrence(l, m, cos_theta, sin_theta, result, count);
 }
 
 double Orbital::radial_part(double r) const
 {
+  if (use_recurrence) {
+    double rho = rho_scale * r;
+    double laguerre;
+    assoc_laguerre(N - L - 1, 2.0 * double(L) + 1.0, &rho, &laguerre, 1);
+    return recurrence_constant *
+      exp(radial_exponential_constant * r) *
+      ipow(rho, L) *
+      laguerre;
+  }
+
   return radial_constant *
     exp(radial_exponential_constant * r) *
     ipow(r, L) *
@@ -103,6 +232,12 @@ double Orbital::radial_part(double r) const
 
 double Orbital::theta_part(double sin_theta, double cos_theta) const
 {
+  if (use_recurrence) {
+    double legendre;
+    assoc_legendre(L, abs(M), &cos_theta, &sin_theta, &legendre, 1);
+    return legendre;
+  }
+
   return angular_constant *
     cos_theta_polynomial(cos_theta) *
     ipow(sin_theta, abs(M));
@@ -113,12 +248,6 @@ std::complex<double> Orbital::operator()(const Vector<3> &x) const
   double x2y2 = x[0] * x[0] + x[1] * x[1];
 
   double r_xy = sqrt(x2y2);
-  double phi;
-  if (r_xy > 0.0)
-    phi = atan2(x[1], x[0]);
-  else
-    phi = 0.0;
-
   double r = sqrt(x2y2 + x[2] * x[2]);
 
   double sin_theta, cos_theta;
@@ -131,11 +260,53 @@ std::complex<double> Orbital::operator()(const Vector<3> &x) const
   }
 
   // val is independent of the sign of M
-  double val = radial_part(r) * theta_part(sin_theta, cos_theta);
+  double val;
+  if (kernel) {
+    double rho = rho_scale * r;
+    kernel(&rho, &cos_theta, &sin_theta, 1, &val);
+    val *= kernel_constant * exp(radial_exponential_constant * r);
+  } else
+    val = radial_part(r) * theta_part(sin_theta, cos_theta);
 
-  // If the sign of M is flipped, angle is negated, so the result
-  // is complex conjugation of the wave function's value.
-  double angle = M * phi;
+  double cos_angle, sin_angle;
+  phase(x[0], x[1], cos_angle, sin_angle);
+  return combine(val, cos_angle, sin_angle);
+}
+
+void Orbital::phase(double x, double y,
+                    double &cos_angle, double &sin_angle) const
+{
+  double r_xy = sqrt(x * x + y * y);
+
+  if (phase_method == TRIGONOMETRIC) {
+    double phi;
+    if (r_xy > 0.0)
+      phi = atan2(y, x);
+    else
+      phi = 0.0;
+    double angle = M * phi;
+    cos_angle = cos(angle);
+    sin_angle = sin(angle);
+    return;
+  }
+
+  // e^(iM phi) = ((x + iy) / r_xy)^M
+  double cos_phi = 1.0, sin_phi = 0.0;
+  if (r_xy > 0.0) {
+    cos_phi = x / r_xy;
+    sin_phi = y / r_xy;
+  }
+  if (real && M > 0)
+    vec_chebyshev_phase(&cos_phi, &sin_phi, M, &cos_angle, &sin_angle, 1);
+  else
+    vec_unit_power(&cos_phi, &sin_phi, M, &cos_angle, &sin_angle, 1);
+}
+
+std::complex<double> Orbital::combine(double val, double cos_angle,
+                                      double sin_angle) const
+{
+  // angle = M * phi. If the sign of M is flipped, angle is negated, so
+  // the result is complex conjugation of the wave function's value.
 
   // An additional sign change is present if M is positive and odd, which
   // makes for a fine mess.
@@ -155,12 +326,12 @@ std::complex<double> Orbital::operator()(const Vector<3> &x) const
     // = val * (sign * cos(angle) + sign * i * sin(angle)
     //          factor * cos(angle) - factor * i * sin(angle))
     // = val * ((sign + factor) cos(angle) + (sign - factor) i sin(angle))
-    result_mag = val * ((sign + factor) * cos(angle) +
-                        (sign - factor) * sin(angle)) / sqrt(2.0);
+    result_mag = val * ((sign + factor) * cos_angle +
+                        (sign - factor) * sin_angle) / sqrt(2.0);
     result_arg = complex<double>(1.0, 0.0);
   } else {
     result_mag = sign * val;
-    result_arg = complex<double>(cos(angle), sin(angle));
+    result_arg = complex<double>(cos_angle, sin_angle);
   }
 
   if (result_mag < 0.0) {
@@ -176,12 +347,476 @@ std::complex<double> Orbital::operator()(const Vector<3> &x) const
   return result_mag * result_arg;
 }
 
+// The phase step of batch evaluation is written without branches, by
+// folding the choices made in combine() into coefficients:
+//   m = val * (kc * cos(angle) + ks * sin(angle) + k1)
+//   arg = (ac * cos(angle) + a1, as * sin(angle))
+//   m *= sq * |m| + (1 - sq)
+void Orbital::combineCoefficients(double &kc, double &ks, double &k1,
+                                  double &ac, double &a1, double &as) const
+{
+  double sign = (M > 0 && (M & 1)) ? -1.0 : 1.0;
+  double factor = diff ? -1.0 : 1.0;
+  if (real && M != 0) {
+    kc = (sign + factor) / sqrt(2.0);
+    ks = (sign - factor) / sqrt(2.0);
+    k1 = 0.0;
+    ac = 0.0;
+    a1 = 1.0;
+    as = 0.0;
+  } else {
+    kc = 0.0;
+    ks = 0.0;
+    k1 = sign;
+    ac = 1.0;
+    a1 = 0.0;
+    as = 1.0;
+  }
+}
+
+// Batch evaluation works on blocks of this many points at a time, so
+// that the intermediate columns stay in L1 cache.
+static const size_t batch_block_size = 64;
+
+void Orbital::evaluate(const double *x, const double *y, const double *z,
+                       size_t count,
+                       double *re, double *im, double *mag) const
+{
+  double r[batch_block_size];
+  double sin_theta[batch_block_size];
+  double cos_theta[batch_block_size];
+  double angle[batch_block_size];
+  double cos_phi[batch_block_size], sin_phi[batch_block_size];
+  double cos_angle[batch_block_size], sin_angle[batch_block_size];
+  double val[batch_block_size];
+  double radial_poly[batch_block_size], r_to_L[batch_block_size];
+  double theta_poly[batch_block_size], sin_to_M[batch_block_size];
+
+  int abs_M = abs(M);
+
+  double kc, ks, k1, ac, a1, as;
+  combineCoefficients(kc, ks, k1, ac, a1, as);
+  double sq = square ? 1.0 : 0.0;
+  double inv_norm = 1.0 / normalization_constant;
+  bool trig = phase_method == TRIGONOMETRIC;
+
+  for (size_t start = 0; start < count; start += batch_block_size) {
+    size_t n = min(batch_block_size, count - start);
+    const double *bx = x + start;
+    const double *by = y + start;
+    const double *bz = z + start;
+
+    // Spherical coordinates, and the exponential part of the radial
+    // factor. Everything here is branch-free, so it vectorizes.
+    for (size_t i = 0; i < n; ++i) {
+      double x2y2 = bx[i] * bx[i] + by[i] * by[i];
+      double r_xy = sqrt(x2y2);
+      double ri = sqrt(x2y2 + bz[i] * bz[i]);
+      double denom = ri > 0.0 ? ri : 1.0;
+      sin_theta[i] = ri > 0.0 ? r_xy / denom : 0.0;
+      cos_theta[i] = ri > 0.0 ? bz[i] / denom : 1.0;
+      // vec_atan2(0, 0) is 0, which is what operator() uses on the z
+      // axis, and phi = 0 there is cos_phi = 1, sin_phi = 0
+      if (trig)
+        angle[i] = double(M) * vec_atan2(by[i], bx[i]);
+      double xy_denom = r_xy > 0.0 ? r_xy : 1.0;
+      cos_phi[i] = r_xy > 0.0 ? bx[i] / xy_denom : 1.0;
+      sin_phi[i] = r_xy > 0.0 ? by[i] / xy_denom : 0.0;
+      r[i] = ri;
+      val[i] = vec_exp(radial_exponential_constant * ri);
+    }
+
+    // Polynomial parts
+    if (kernel) {
+      // Reuse radial_poly for rho, and theta_poly for the result
+      for (size_t i = 0; i < n; ++i)
+        radial_poly[i] = rho_scale * r[i];
+      kernel(radial_poly, cos_theta, sin_theta, n, theta_poly);
+      for (size_t i = 0; i < n; ++i)
+        val[i] *= kernel_constant * theta_poly[i];
+    } else if (use_recurrence) {
+      for (size_t i = 0; i < n; ++i)
+        radial_poly[i] = rho_scale * r[i];
+      ipow(radial_poly, L, r_to_L, n);
+      assoc_laguerre(N - L - 1, 2.0 * double(L) + 1.0, radial_poly,
+                     radial_poly, n);
+      assoc_legendre(L, abs_M, cos_theta, sin_theta, theta_poly, n);
+      for (size_t i = 0; i < n; ++i)
+        val[i] *= recurrence_constant * r_to_L[i] * radial_poly[i] *
+          theta_poly[i];
+    } else {
+      radial_polynomial.evaluate(r, radial_poly, n);
+      ipow(r, L, r_to_L, n);
+      cos_theta_polynomial.evaluate(cos_theta, theta_poly, n);
+      ipow(sin_theta, abs_M, sin_to_M, n);
+      for (size_t i = 0; i < n; ++i)
+        val[i] *= radial_constant * r_to_L[i] * radial_poly[i] *
+          angular_constant * theta_poly[i] * sin_to_M[i];
+    }
+
+    // Phase, real combinations, squaring and normalization; see
+    // operator() for the derivation
+    double *bre = re + start;
+    double *bim = im + start;
+    double *bmag = mag + start;
+    if (trig)
+      for (size_t i = 0; i < n; ++i)
+        vec_sincos(angle[i], sin_angle[i], cos_angle[i]);
+    else if (real && M > 0)
+      vec_chebyshev_phase(cos_phi, sin_phi, M, cos_angle, sin_angle, n);
+    else
+      vec_unit_power(cos_phi, sin_phi, M, cos_angle, sin_angle, n);
+    for (size_t i = 0; i < n; ++i) {
+      double s = sin_angle[i], c = cos_angle[i];
+      double m = val[i] * (kc * c + ks * s + k1);
+      m *= sq * fabs(m) + (1.0 - sq);
+      m *= inv_norm;
+      bre[i] = m * (ac * c + a1);
+      bim[i] = m * (as * s);
+      bmag[i] = fabs(m);
+    }
+  }
+}
+
+void Orbital::evaluate(const double *const coords[3], size_t count,
+                       complex<double> *values) const
+{
+  if (count == 0)
+    return;
+
+  vector<double> re(count), im(count), mag(count);
+  evaluate(coords[0], coords[1], coords[2], count, &re[0], &im[0], &mag[0]);
+  for (size_t k = 0; k < count; ++k)
+    values[k] = complex<double>(re[k], im[k]);
+}
+
+void Orbital::evaluate(const float *x, const float *y, const float *z,
+                       size_t count,
+                       float *re, float *im, float *mag) const
+{
+  float rho[batch_block_size];
+  float sin_theta[batch_block_size], cos_theta[batch_block_size];
+  float cos_phi[batch_block_size], sin_phi[batch_block_size];
+  float cos_angle[batch_block_size], sin_angle[batch_block_size];
+  float val[batch_block_size];
+  float laguerre[batch_block_size], legendre[batch_block_size];
+
+  int abs_M = abs(M);
+
+  double kc, ks, k1, ac, a1, as;
+  combineCoefficients(kc, ks, k1, ac, a1, as);
+  float fkc = kc, fks = ks, fk1 = k1, fac = ac, fa1 = a1, fas = as;
+  float sq = square ? 1.0f : 0.0f;
+  float constant = recurrence_constant;
+  float inv_norm = 1.0 / normalization_constant;
+  float fscale = rho_scale;
+  // e^(-rho/2) = (e^(-rho/2L))^L
+  float exp_scale = L > 0 ? -0.5 / double(L) : -0.5;
+
+  for (size_t start = 0; start < count; start += batch_block_size) {
+    size_t n = min(batch_block_size, count - start);
+    const float *bx = x + start;
+    const float *by = y + start;
+    const float *bz = z + start;
+
+    for (size_t i = 0; i < n; ++i) {
+      float x2y2 = bx[i] * bx[i] + by[i] * by[i];
+      float r_xy = sqrt(x2y2);
+      float ri = sqrt(x2y2 + bz[i] * bz[i]);
+      float denom = ri > 0.0f ? ri : 1.0f;
+      sin_theta[i] = ri > 0.0f ? r_xy / denom : 0.0f;
+      cos_theta[i] = ri > 0.0f ? bz[i] / denom : 1.0f;
+      float xy_denom = r_xy > 0.0f ? r_xy : 1.0f;
+      cos_phi[i] = r_xy > 0.0f ? bx[i] / xy_denom : 1.0f;
+      sin_phi[i] = r_xy > 0.0f ? by[i] / xy_denom : 0.0f;
+      rho[i] = fscale * ri;
+      // rho^L alone overflows for large rho and L, long before the
+      // exponential would bring it back down
+      float e = vec_exp(exp_scale * rho[i]);
+      val[i] = L > 0 ? rho[i] * e : e;
+    }
+    if (L > 1) {
+      ipow(val, L, laguerre, n);
+      for (size_t i = 0; i < n; ++i)
+        val[i] = laguerre[i];
+    }
+
+    assoc_laguerre(N - L - 1, 2.0 * double(L) + 1.0, rho, laguerre, n);
+    assoc_legendre(L, abs_M, cos_theta, sin_theta, legendre, n);
+    for (size_t i = 0; i < n; ++i)
+      val[i] *= constant * laguerre[i] * legendre[i];
+
+    if (real && M > 0)
+      vec_chebyshev_phase(cos_phi, sin_phi, M, cos_angle, sin_angle, n);
+    else
+      vec_unit_power(cos_phi, sin_phi, M, cos_angle, sin_angle, n);
+
+    float *bre = re + start;
+    float *bim = im + start;
+    float *bmag = mag + start;
+    for (size_t i = 0; i < n; ++i) {
+      float s = sin_angle[i], c = cos_angle[i];
+      float m = val[i] * (fkc * c + fks * s + fk1);
+      m *= sq * fabs(m) + (1.0f - sq);
+      m *= inv_norm;
+      bre[i] = m * (fac * c + fa1);
+      bim[i] = m * (fas * s);
+      bmag[i] = fabs(m);
+    }
+  }
+}
+
+void Orbital::evaluate(const float *const coords[3], size_t count,
+                       complex<float> *values) const
+{
+  if (count == 0)
+    return;
+
+  vector<float> re(count), im(count), mag(count);
+  evaluate(coords[0], coords[1], coords[2], count, &re[0], &im[0], &mag[0]);
+  for (size_t k = 0; k < count; ++k)
+    values[k] = complex<float>(re[k], im[k]);
+}
+
+void Orbital::derivatives(const Vector<3> &x, complex<double> &value,
+                          CVector<3> &grad, CMatrix<3,3> &hess) const
+{
+  value = 0.0;
+  grad = 0.0;
+  hess = 0.0;
+
+  double r = sqrt(x[0] * x[0] + x[1] * x[1] + x[2] * x[2]);
+  if (r == 0.0)
+    return;
+
+  // Without the phase, the value is a product of three factors,
+  //   A(r) = radial_part(r) / r^|M|
+  //   B(u) = theta_part(1, u) where u = cos(theta) = z/r
+  //   C(x, y) = (x + i sgn(M) y)^|M| = (r sin(theta))^|M| e^(iM phi)
+  // each of which is easy to differentiate. The derivatives of the
+  // Laguerre and Legendre factors come from their recurrences, so this
+  // works with every Method.
+  int abs_M = abs(M);
+  int D = L - abs_M;
+
+  // A and its first two derivatives with respect to r
+  double rho = rho_scale * r;
+  double lag[3] = { 0.0, 0.0, 0.0 };
+  for (int k = 0; k < 3 && k <= N - L - 1; ++k)
+    assoc_laguerre(N - L - 1 - k, 2.0 * double(L) + 1.0 + k, &rho, &lag[k],
+                   1);
+  // d/drho L_n^a = -L_(n-1)^(a+1)
+  double g = lag[0];
+  double g1 = -rho_scale * lag[1];
+  double g2 = rho_scale * rho_scale * lag[2];
+  // h = r^D g
+  double rD = ipow(r, D);
+  double rD1 = D >= 1 ? double(D) * ipow(r, D - 1) : 0.0;
+  double rD2 = D >= 2 ? double(D) * double(D - 1) * ipow(r, D - 2) : 0.0;
+  double h = rD * g;
+  double h1 = rD1 * g + rD * g1;
+  double h2 = rD2 * g + 2.0 * rD1 * g1 + rD * g2;
+  double kappa = -radial_exponential_constant;
+  double e = recurrence_constant * ipow(rho_scale, L) * exp(-kappa * r);
+  double A = e * h;
+  double A1 = e * (h1 - kappa * h);
+  double A2 = e * (h2 - 2.0 * kappa * h1 + kappa * kappa * h);
+
+  // B and its derivatives with respect to u. Differentiating the
+  // Legendre polynomial raises its order, and the normalizations of
+  // successive orders differ by sqrt((L-m)(L+m+1)).
+  double u = x[2] / r;
+  double one = 1.0;
+  double leg[3] = { 0.0, 0.0, 0.0 };
+  double leg_scale = 1.0;
+  for (int k = 0; k < 3 && abs_M + k <= L; ++k) {
+    assoc_legendre(L, abs_M + k, &u, &one, &leg[k], 1);
+    leg[k] *= leg_scale;
+    leg_scale *= sqrt(double(L - abs_M - k) * double(L + abs_M + k + 1));
+  }
+  double B = leg[0];
+  double B1 = leg[1];
+  double B2 = leg[2];
+
+  // Derivatives of r and u with respect to x, y, z
+  Vector<3> xhat = x / r;
+  Vector<3> grad_u = -u * xhat;
+  grad_u[2] += 1.0;
+  grad_u = grad_u / r;
+  Matrix<3,3> hess_u;
+  for (unsigned i = 0; i < 3; ++i)
+    for (unsigned j = 0; j < 3; ++j)
+      hess_u(i,j) = (3.0 * u * xhat[i] * xhat[j] - u * (i == j) -
+                     (i == 2) * xhat[j] - (j == 2) * xhat[i]) / (r * r);
+
+  // P = A B, real
+  double P = A * B;
+  Vector<3> grad_P;
+  Matrix<3,3> hess_P;
+  for (unsigned i = 0; i < 3; ++i) {
+    double grad_A = A1 * xhat[i];
+    double grad_B = B1 * grad_u[i];
+    grad_P[i] = grad_A * B + A * grad_B;
+  }
+  for (unsigned i = 0; i < 3; ++i)
+    for (unsigned j = 0; j < 3; ++j) {
+      double hess_A = A2 * xhat[i] * xhat[j] +
+        A1 / r * ((i == j) - xhat[i] * xhat[j]);
+      double hess_B = B2 * grad_u[i] * grad_u[j] + B1 * hess_u(i,j);
+      hess_P(i,j) = hess_A * B + A1 * xhat[i] * B1 * grad_u[j] +
+        B1 * grad_u[i] * A1 * xhat[j] + A * hess_B;
+    }
+
+  // C and its derivatives, which only involve x and y
+  complex<double> w(x[0], M < 0 ? -x[1] : x[1]);
+  complex<double> dw_dy(0.0, M < 0 ? -1.0 : 1.0);
+  complex<double> C = 1.0, C1 = 0.0, C2 = 0.0;
+  for (int k = 0; k < abs_M; ++k) {
+    C2 = C2 * w + 2.0 * C1;
+    C1 = C1 * w + C;
+    C = C * w;
+  }
+  CVector<3> grad_C(0.0);
+  grad_C[0] = C1;
+  grad_C[1] = dw_dy * C1;
+  CMatrix<3,3> hess_C(0.0);
+  hess_C(0,0) = C2;
+  hess_C(0,1) = hess_C(1,0) = dw_dy * C2;
+  hess_C(1,1) = dw_dy * dw_dy * C2;
+
+  // The real and diff options take a fixed real linear combination of
+  // the real and imaginary parts of C; see combine()
+  if (real && M != 0) {
+    double kc, ks, k1, ac, a1, as;
+    combineCoefficients(kc, ks, k1, ac, a1, as);
+    C = kc * C.real() + ks * C.imag();
+    for (unsigned i = 0; i < 3; ++i) {
+      grad_C[i] = kc * grad_C[i].real() + ks * grad_C[i].imag();
+      for (unsigned j = 0; j < 3; ++j)
+        hess_C(i,j) = kc * hess_C(i,j).real() + ks * hess_C(i,j).imag();
+    }
+  } else if (M > 0 && (M & 1)) {
+    C = -C;
+    grad_C = -grad_C;
+    hess_C = -hess_C;
+  }
+
+  // f = P C, before squaring and normalization
+  complex<double> f = P * C;
+  CVector<3> grad_f;
+  CMatrix<3,3> hess_f;
+  for (unsigned i = 0; i < 3; ++i)
+    grad_f[i] = grad_P[i] * C + P * grad_C[i];
+  for (unsigned i = 0; i < 3; ++i)
+    for (unsigned j = 0; j < 3; ++j)
+      hess_f(i,j) = hess_P(i,j) * C + grad_P[i] * grad_C[j] +
+        grad_C[i] * grad_P[j] + P * hess_C(i,j);
+
+  if (square) {
+    // f |f|, by way of the derivatives of a = |f|. At a = 0 the
+    // gradient is zero, and the Hessian isn't continuous there.
+    double a = abs(f);
+    Vector<3> grad_a(0.0);
+    Matrix<3,3> hess_a(0.0);
+    if (a > 0.0) {
+      for (unsigned i = 0; i < 3; ++i)
+        grad_a[i] = (conj(f) * grad_f[i]).real() / a;
+      for (unsigned i = 0; i < 3; ++i)
+        for (unsigned j = 0; j < 3; ++j)
+          hess_a(i,j) = ((conj(grad_f[i]) * grad_f[j]).real() +
+                         (conj(f) * hess_f(i,j)).real() -
+                         grad_a[i] * grad_a[j]) / a;
+    }
+    CMatrix<3,3> hess_sq;
+    for (unsigned i = 0; i < 3; ++i)
+      for (unsigned j = 0; j < 3; ++j)
+        hess_sq(i,j) = f * hess_a(i,j) + grad_f[i] * grad_a[j] +
+          grad_a[i] * grad_f[j] + a * hess_f(i,j);
+    for (unsigned i = 0; i < 3; ++i)
+      grad_f[i] = f * grad_a[i] + a * grad_f[i];
+    hess_f = hess_sq;
+    f *= a;
+  }
+
+  double inv_norm = 1.0 / normalization_constant;
+  value = inv_norm * f;
+  for (unsigned i = 0; i < 3; ++i) {
+    grad[i] = inv_norm * grad_f[i];
+    for (unsigned j = 0; j < 3; ++j)
+      hess(i,j) = inv_norm * hess_f(i,j);
+  }
+}
+
+CVector<3> Orbital::gradient(const Vector<3> &x) const
+{
+  complex<double> value;
+  CVector<3> grad;
+  CMatrix<3,3> hess;
+  derivatives(x, value, grad, hess);
+  return grad;
+}
+
+CMatrix<3,3> Orbital::hessian(const Vector<3> &x) const
+{
+  complex<double> value;
+  CVector<3> grad;
+  CMatrix<3,3> hess;
+  derivatives(x, value, grad, hess);
+  return hess;
+}
+
 bool Orbital::operator==(const Orbital &rhs)
 {
   return Z == rhs.Z && N == rhs.N && L == rhs.L && M == rhs.M
     && real == rhs.real && diff == rhs.diff && square == rhs.square;
 }
 
+Orbital Orbital::canonical() const
+{
+  return Orbital(1, N, L, conjugatesCanonical() ? -M : M, real, diff, square,
+                 SPECIALIZED, phase_method);
+}
+
+double Orbital::valueScale() const
+{
+  // Z^1.5 from the radial constant, over Z^0.5 from the normalization;
+  // or if squared, Z^3 over Z^2. Conjugating e^(iM phi) leaves the
+  // Legendre factor, which picks up (-1)^M.
+  double scale = double(Z);
+  if (conjugatesCanonical() && M % 2 != 0)
+    scale = -scale;
+  return scale;
+}
+
+Orbital::Reflection Orbital::reflection(unsigned axis) const
+{
+  Reflection r;
+  r.sign = 1.0;
+  r.conjugate = false;
+  int absM = abs(M);
+  if (axis == 2) {
+    // Only cos(theta) changes sign, and P_L^|M| has parity L - |M|
+    if ((L - absM) % 2 != 0)
+      r.sign = -1.0;
+  } else if (!real) {
+    // phi goes to -phi, or to pi - phi, so e^(iM phi) is conjugated,
+    // and for x picks up (-1)^M
+    r.conjugate = true;
+    if (axis == 0 && absM % 2 != 0)
+      r.sign = -1.0;
+  } else if (M != 0) {
+    // combine() leaves cos(M phi) if the sign it gives odd M matches
+    // the sign of the combination, and sin(M phi) if not. cos is even
+    // in y and sin odd; and in x, both pick up (-1)^M, and sin another
+    // -1.
+    bool odd = absM % 2 != 0;
+    bool sine = odd != diff;
+    if (axis == 0 ? odd != sine : sine)
+      r.sign = -1.0;
+  }
+  return r;
+}
+
 double Orbital::radius() const
 {
   double r;
@@ -48,6 +48,7 @@
 
 #include "function.hh"
 #include "polynomial.hh"
+#include "orbital_kernels.hh"
 
 inline double factorial(int n)
 {
@@ -63,31 +64,126 @@ inline double choose(int n, int k)
   return factorial(n) / (factorial(k) * factorial(n - k));
 }
 
+// The associated Laguerre polynomial L_n^a(x), and the fully
+// normalized associated Legendre function of degree l and order m >= 0
+// (without the Condon-Shortley phase), evaluated at count points by
+// their three-term recurrences. The input and output arrays may be the
+// same.
+void assoc_laguerre(int n, double a, const double *x, double *result,
+                    size_t count);
+void assoc_laguerre(int n, double a, const float *x, float *result,
+                    size_t count);
+void assoc_legendre(int l, int m, const double *cos_theta,
+                    const double *sin_theta, double *result, size_t count);
+void assoc_legendre(int l, int m, const float *cos_theta,
+                    const float *sin_theta, float *result, size_t count);
+
 class Orbital : public Function<3,std::complex<double> >
 {
 public:
+  // How to evaluate the radial and angular polynomial factors
+  enum Method {
+    GENERIC,     // CompiledPolynomials built by the constructor
+    SPECIALIZED, // A compile-time kernel for (N, L, |M|) if there is
+                 // one, otherwise GENERIC
+    RECURRENCE   // Three-term recurrences for the Laguerre and Legendre
+                 // factors at each point; nothing is expanded
+  };
+  // How to compute e^(iM phi)
+  enum Phase {
+    TRIGONOMETRIC, // cos and sin of M atan2(y, x)
+    ALGEBRAIC      // ((x + iy) / r_xy)^M, by repeated squaring or, for
+                   // real orbitals, Chebyshev recurrence
+  };
   Orbital(int Z_, int N_, int L_, int M_,
-          bool real_, bool diff_, bool square_);
+          bool real_, bool diff_, bool square_,
+          Method method = SPECIALIZED, Phase phase_method_ = ALGEBRAIC);
   double radial_part(double r) const;
   double theta_part(double sin_theta, double cos_theta) const;
   std::complex<double> operator()(const Vector<3> &x) const;
+  // cos(M phi) and sin(M phi) at a point with these x and y coordinates
+  void phase(double x, double y, double &cos_angle, double &sin_angle) const;
+  // The value at a point, given val = radial_part * theta_part and the
+  // phase there. This applies e^(iM phi), the real, diff and square
+  // options, and normalization.
+  std::complex<double> combine(double val, double cos_angle,
+                               double sin_angle) const;
+  // Batch evaluation over structure-of-arrays input, writing the real
+  // part, imaginary part and magnitude of each value to separate
+  // columns. This is much faster than calling operator() in a loop.
+  void evaluate(const double *x, const double *y, const double *z,
+                size_t count, double *re, double *im, double *mag) const;
+  void evaluate(const double *const coords[3], size_t count,
+                std::complex<double> *values) const;
+  // The same in single precision, for when values only need to be
+  // compared with each other. This always uses the recurrences and the
+  // algebraic phase, and works in terms of (rho e^(-rho/2L))^L so that
+  // nothing overflows for large rho.
+  void evaluate(const float *x, const float *y, const float *z,
+                size_t count, float *re, float *im, float *mag) const;
+  void evaluate(const float *const coords[3], size_t count,
+                std::complex<float> *values) const;
+  // Analytic first and second derivatives with respect to x, y and z,
+  // computed together with the value since they share most of the
+  // work. They are not defined at the origin, where all three are
+  // returned as zero.
+  void derivatives(const Vector<3> &x, std::complex<double> &value,
+                   CVector<3> &grad, CMatrix<3,3> &hess) const;
+  CVector<3> gradient(const Vector<3> &x) const;
+  CMatrix<3,3> hessian(const Vector<3> &x) const;
   const int Z, N, L, M;
   const bool real; // If true, add values for +/-M and divide by root 2
   const bool diff; // If true, real wave function is a difference of
   //                  wave functions for +/-M. If false, sum.
   const bool square; // If true, square magnitude of the function
+  const Phase phase_method;
   bool operator==(const Orbital &rhs);
   bool operator!=(const Orbital &rhs) { return !(*this == rhs); }
   double radius() const;
   double radialIntegral() const;
+  // Every orbital is the one with Z = 1 and M >= 0, and otherwise the
+  // same, shrunk by a factor of Z and conjugated if M < 0:
+  //   (*this)(x) = valueScale() * canonical()(Z x), conjugated if
+  //   conjugatesCanonical()
+  // so one mesh of canonical() serves every element and both signs of
+  // M. Real orbitals already have M >= 0.
+  Orbital canonical() const;
+  double valueScale() const;
+  bool conjugatesCanonical() const { return !real && M < 0; }
+  // Every orbital is symmetric under reflection in each of the planes
+  // x = 0, y = 0 and z = 0, up to a sign and, for complex orbitals,
+  // conjugation: f(x reflected in the plane normal to axis) = sign *
+  // f(x), conjugated if conjugate. So a mesh of one octant serves for
+  // all eight.
+  struct Reflection
+  {
+    double sign;
+    bool conjugate;
+  };
+  Reflection reflection(unsigned axis) const;
 
 private:
+  void combineCoefficients(double &kc, double &ks, double &k1,
+                           double &ac, double &a1, double &as) const;
+
   double radial_constant;
   double radial_exponential_constant;
-  Polynomial radial_polynomial;
+  CompiledPolynomial radial_polynomial;
 
   double angular_constant;
-  Polynomial cos_theta_polynomial;
+  CompiledPolynomial cos_theta_polynomial;
+
+  // The specialized kernel for (N, L, |M|), or NULL to use the
+  // polynomials above. It computes everything except the exponential
+  // and the constant factors, in terms of rho = rho_scale * r.
+  OrbitalKernel kernel;
+  double rho_scale;
+  double kernel_constant;
+
+  // If set, the radial and angular factors come from assoc_laguerre()
+  // and assoc_legendre() instead of the polynomials above.
+  bool use_recurrence;
+  double recurrence_constant;
 
   double normalization_constant;
 };
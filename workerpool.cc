@@ -0,0 +1,130 @@
+/*
+ * This file is part of the Electron Orbital Explorer. The Electron
+ * Orbital Explorer is distributed under the Simplified BSD License
+ * (also called the "BSD 2-Clause License"), in hopes that these
+ * rendering techniques might be used by other programmers in
+ * applications such as scientific visualization, video gaming, and so
+ * on. If you find value in this software and use its technologies for
+ * another purpose, I would love to hear back from you at bjthinks (at)
+ * gmail (dot) com. If you improve this software and agree to release
+ * your modifications under the below license, I encourage you to fork
+ * the development tree on github and push your modifications. The
+ * Electron Orbital Explorer's development URL is:
+ * https://github.com/bjthinks/orbital-explorer
+ * (This paragraph is not part of the software license and may be
+ * removed.)
+ *
+ * Copyright (c) 2013, Brian W. Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * + Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * + Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <system_error>
+#include <thread>
+
+#include "workerpool.hh"
+
+using namespace std;
+
+WorkerPool::WorkerPool(unsigned size_) :
+  task(NULL), arg(NULL), count(0), next(0), unfinished(0), generation(0),
+  stop(false)
+{
+  // A thread that can't be made just leaves the others more to do
+  for (unsigned i = 1; i < size_; ++i)
+    try {
+      threads.push_back(thread(&WorkerPool::loop, this));
+    } catch (const system_error &) {
+      break;
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+  mutex.lock();
+  stop = true;
+  work_ready.notify_all();
+  mutex.unlock();
+
+  for (unsigned i = 0; i < threads.size(); ++i)
+    threads[i].join();
+}
+
+void WorkerPool::run(void (*task_)(void *, unsigned), void *arg_,
+                     unsigned count_)
+{
+  if (threads.empty()) {
+    for (unsigned i = 0; i < count_; ++i)
+      task_(arg_, i);
+    return;
+  }
+
+  unique_lock<std::mutex> lock(mutex);
+  task = task_;
+  arg = arg_;
+  count = count_;
+  next = 0;
+  unfinished = count_;
+  ++generation;
+  work_ready.notify_all();
+  drain(lock);
+  while (unfinished > 0)
+    work_done.wait(lock);
+}
+
+unsigned WorkerPool::hardwareThreads()
+{
+  unsigned n = thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+}
+
+void WorkerPool::loop()
+{
+  unsigned long seen = 0;
+  unique_lock<std::mutex> lock(mutex);
+  for (;;) {
+    while (!stop && generation == seen)
+      work_ready.wait(lock);
+    if (stop)
+      break;
+    seen = generation;
+    drain(lock);
+  }
+}
+
+// Called, and returns, with the mutex held by lock
+void WorkerPool::drain(unique_lock<std::mutex> &lock)
+{
+  while (next < count) {
+    unsigned i = next++;
+    lock.unlock();
+    task(arg, i);
+    lock.lock();
+    if (--unfinished == 0)
+      work_done.notify_one();
+  }
+}